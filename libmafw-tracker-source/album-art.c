@@ -31,28 +31,290 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* ------------------------- Private API ------------------------- */
+
+/* Set of file names present in a thumbnail (or album-art) cache directory,
+ * kept up to date by a monitor so existence checks do not hit the disk. */
+struct _file_index
+{
+  GHashTable *names;
+  GFileMonitor *monitor;
+  /* The directory is still being scanned, the names are not complete */
+  gboolean scanning;
+  /* While scanning, names the monitor saw go away */
+  GHashTable *removed;
+  /* Changes every time a file is added */
+  guint generation;
+};
+
+/* Directory URI -> struct _file_index. Lookups can happen in worker threads,
+ * so access is protected by a lock. Indexes live until albumart_deinit(), as
+ * their monitors and scans keep pointers to them, which must only be called
+ * once those threads are done, see tracker_cache_deinit(). */
+static GHashTable *file_indexes = NULL;
+G_LOCK_DEFINE_STATIC(file_indexes);
+
+static void
+_file_index_free(struct _file_index *index)
+{
+  if (index->monitor)
+  {
+    g_signal_handlers_disconnect_by_data(index->monitor, index);
+    g_file_monitor_cancel(index->monitor);
+    g_object_unref(index->monitor);
+  }
+
+  if (index->removed)
+    g_hash_table_unref(index->removed);
+
+  g_hash_table_unref(index->names);
+  g_free(index);
+}
+
+/* Both with the lock held */
+static void
+_file_index_add(struct _file_index *index, GFile *file)
+{
+  gchar *name = g_file_get_basename(file);
+
+  if (index->removed)
+    g_hash_table_remove(index->removed, name);
+
+  g_hash_table_add(index->names, name);
+  index->generation++;
+}
+
+static void
+_file_index_remove(struct _file_index *index, GFile *file)
+{
+  gchar *name = g_file_get_basename(file);
+
+  g_hash_table_remove(index->names, name);
+
+  if (index->removed)
+    g_hash_table_add(index->removed, name);
+  else
+    g_free(name);
+}
+
+static void
+_file_index_changed_cb(GFileMonitor *monitor,
+                       GFile *file,
+                       GFile *other_file,
+                       GFileMonitorEvent event_type,
+                       gpointer user_data)
+{
+  struct _file_index *index = user_data;
+
+  G_LOCK(file_indexes);
+
+  switch (event_type)
+  {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    {
+      _file_index_add(index, file);
+      break;
+    }
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+    {
+      _file_index_remove(index, file);
+      break;
+    }
+    case G_FILE_MONITOR_EVENT_RENAMED:
+    {
+      _file_index_remove(index, file);
+
+      if (other_file)
+        _file_index_add(index, other_file);
+
+      break;
+    }
+    default:
+      break;
+  }
+
+  G_UNLOCK(file_indexes);
+}
+
+/* Monitors and scans the directory of an index added in scanning state.
+ * Runs without the lock, so other threads are not blocked meanwhile. */
+static void
+_file_index_scan(struct _file_index *index, const gchar *dir_uri)
+{
+  GFileMonitor *monitor;
+  GPtrArray *scanned;
+  GFile *dir;
+  gchar *dir_path;
+  GError *error = NULL;
+  guint i;
+
+  /* Start monitoring before the scan, so files created meanwhile are not
+   * lost. The directory does not need to exist yet. */
+  dir = g_file_new_for_uri(dir_uri);
+  monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_WATCH_MOVES,
+                                     NULL, &error);
+
+  if (monitor)
+  {
+    g_signal_connect(monitor, "changed",
+                     G_CALLBACK(_file_index_changed_cb), index);
+  }
+  else
+  {
+    g_warning("Unable to monitor %s: %s", dir_uri,
+              error ? error->message : "No error given");
+    g_clear_error(&error);
+  }
+
+  scanned = g_ptr_array_new_with_free_func(g_free);
+  dir_path = g_file_get_path(dir);
+
+  if (dir_path)
+  {
+    GDir *d = g_dir_open(dir_path, 0, NULL);
+
+    if (d)
+    {
+      const gchar *name;
+
+      while ((name = g_dir_read_name(d)) != NULL)
+        g_ptr_array_add(scanned, g_strdup(name));
+
+      g_dir_close(d);
+    }
+
+    g_free(dir_path);
+  }
+
+  g_object_unref(dir);
+
+  G_LOCK(file_indexes);
+
+  /* Skip the files removed since they were scanned */
+  for (i = 0; i < scanned->len; i++)
+  {
+    gchar *name = g_ptr_array_index(scanned, i);
+
+    if (!g_hash_table_contains(index->removed, name))
+      g_hash_table_add(index->names, g_strdup(name));
+  }
+
+  g_hash_table_unref(index->removed);
+  index->removed = NULL;
+  index->monitor = monitor;
+  index->scanning = FALSE;
+  index->generation++;
+
+  G_UNLOCK(file_indexes);
+
+  g_ptr_array_free(scanned, TRUE);
+}
+
+/* Checks whether file_uri exists, using the index of its directory */
+static gboolean
+_file_uri_exists(const gchar *file_uri)
+{
+  const gchar *name;
+  gchar *dir_uri;
+  struct _file_index *index;
+  struct _file_index *new_index = NULL;
+  gboolean exists;
+
+  name = strrchr(file_uri, '/');
+
+  if (!name)
+    return FALSE;
+
+  G_LOCK(file_indexes);
+
+  if (!file_indexes)
+  {
+    file_indexes = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free,
+        (GDestroyNotify)_file_index_free);
+  }
+
+  dir_uri = g_strndup(file_uri, name - file_uri);
+  index = g_hash_table_lookup(file_indexes, dir_uri);
+
+  if (!index)
+  {
+    /* Published before the scan, so only this thread scans it */
+    new_index = index = g_new0(struct _file_index, 1);
+    index->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                         NULL);
+    index->removed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           NULL);
+    index->scanning = TRUE;
+    g_hash_table_insert(file_indexes, g_strdup(dir_uri), index);
+  }
+
+  G_UNLOCK(file_indexes);
+
+  if (new_index)
+    _file_index_scan(new_index, dir_uri);
+
+  g_free(dir_uri);
+
+  G_LOCK(file_indexes);
+
+  /* While scanning, or without a monitor, the index could be incomplete or
+   * stale, so ask the filesystem */
+  if (index->scanning || !index->monitor)
+  {
+    GFile *file;
+
+    G_UNLOCK(file_indexes);
+
+    file = g_file_new_for_uri(file_uri);
+    exists = g_file_query_exists(file, NULL);
+    g_object_unref(file);
+
+    return exists;
+  }
+
+  exists = g_hash_table_contains(index->names, name + 1);
+
+  G_UNLOCK(file_indexes);
+
+  return exists;
+}
+
 /* ------------------------- Public API ------------------------- */
 
+/*
+ * albumart_file_uri_exists:
+ * @file_uri: URI of a thumbnail or album-art file
+ *
+ * Checks whether the file exists, with the index of its directory.
+ *
+ * Returns: @TRUE if it exists
+ */
+gboolean
+albumart_file_uri_exists(const gchar *file_uri)
+{
+  return _file_uri_exists(file_uri);
+}
+
 gchar *
 albumart_get_thumbnail_uri(const gchar *orig_file_uri,
                            enum thumbnail_size size)
 {
   gchar *file_uri;
-  GFile *file;
 
   if (size == THUMBNAIL_CROPPED)
   {
     file_uri = hildon_thumbnail_get_uri(orig_file_uri, 128, 128, TRUE);
-    /* Check if file doesn't exist */
-    file = g_file_new_for_uri(file_uri);
 
-    if (!g_file_query_exists(file, NULL))
+    /* Check if file doesn't exist */
+    if (!_file_uri_exists(file_uri))
     {
       g_free(file_uri);
       file_uri = NULL;
     }
-
-    g_object_unref(file);
   }
   else
   {
@@ -69,7 +331,6 @@ albumart_get_album_art_uri(const gchar *album)
   gchar *file_uri;
   gchar *file_path;
   gchar *album_key;
-  GFile *file;
 
   if (util_tracker_value_is_unknown(album))
     return NULL;
@@ -82,20 +343,53 @@ albumart_get_album_art_uri(const gchar *album)
   g_free(file_path);
 
   /* Check if file exists */
-  file = g_file_new_for_uri(file_uri);
-
-  if (!g_file_query_exists(file, NULL))
+  if (!file_uri || !_file_uri_exists(file_uri))
   {
     g_free(file_uri);
     file_uri = NULL;
   }
 
-  g_object_unref(file);
   g_free(album_key);
 
   return file_uri;
 }
 
+/*
+ * albumart_get_album_art_generation:
+ *
+ * Tells when album art was added: the value changes every time a file
+ * appears in the album-art directory.
+ *
+ * Returns: the generation of the album-art directory, 0 until it is indexed
+ */
+guint
+albumart_get_album_art_generation(void)
+{
+  static gchar *dir_uri = NULL;
+  struct _file_index *index;
+  guint generation = 0;
+
+  if (g_once_init_enter(&dir_uri))
+  {
+    gchar *file_path = hildon_albumart_get_path(NULL, "album", "album");
+    gchar *dir_path = g_path_get_dirname(file_path);
+    gchar *uri = g_filename_to_uri(dir_path, NULL, NULL);
+
+    g_free(dir_path);
+    g_free(file_path);
+    g_once_init_leave(&dir_uri, uri ? uri : g_strdup(""));
+  }
+
+  G_LOCK(file_indexes);
+
+  if (file_indexes && (index = g_hash_table_lookup(file_indexes, dir_uri)))
+    generation = index->generation;
+
+  G_UNLOCK(file_indexes);
+
+  return generation;
+}
+
 gboolean
 albumart_key_is_album_art(const gchar *key)
 {
@@ -121,3 +415,17 @@ albumart_key_is_thumbnail(const gchar *key)
 
   return FALSE;
 }
+
+void
+albumart_deinit(void)
+{
+  G_LOCK(file_indexes);
+
+  if (file_indexes)
+  {
+    g_hash_table_unref(file_indexes);
+    file_indexes = NULL;
+  }
+
+  G_UNLOCK(file_indexes);
+}
@@ -41,9 +41,18 @@ gchar *
 albumart_get_thumbnail_uri(const gchar *orig_file_uri,
                            enum thumbnail_size size);
 
+gboolean
+albumart_file_uri_exists(const gchar *file_uri);
+
+guint
+albumart_get_album_art_generation(void);
+
 gboolean
 albumart_key_is_album_art(const gchar *key);
 gboolean
 albumart_key_is_thumbnail(const gchar *key);
 
+void
+albumart_deinit(void);
+
 #endif
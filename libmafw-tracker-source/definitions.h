@@ -157,6 +157,20 @@ struct _MafwTrackerSourcePrivate
   gint last_progress;
   /* Remaining time (in seconds) to finish the update */
   gint remaining_time;
+  /* Value of MAFW_TRACKER_SOURCE_PROPERTY_DEFERRED_ART */
+  gboolean deferred_art;
+  /* Value of MAFW_TRACKER_SOURCE_PROPERTY_METADATA_BATCHES */
+  guint metadata_batches;
+  /* get_metadata calls waiting to be run together, by requested keys */
+  GHashTable *pending_metadata;
+  /* Idle source running them */
+  guint pending_metadata_id;
+  /* Metadata of browsed clips: object id -> link in metadata_lru */
+  GHashTable *metadata_cache;
+  /* Entries of metadata_cache, most recently used first */
+  GQueue metadata_lru;
+  /* Object ids of playlist entries unknown to tracker */
+  GHashTable *untracked_clips;
 };
 
 #endif                          /* _MAFW_TRACKER_SOURCE_DEFINITIONS_H_ */
@@ -26,8 +26,284 @@
 #include "definitions.h"
 #include "key-mapping.h"
 #include <libmafw/mafw.h>
+#include <stdlib.h>
 #include <string.h>
 
+/* Marks the date keys in the table: G_TYPE_DATE is registered at runtime,
+ * so it is not a constant expression. It is replaced on first use. */
+#define DATE_TYPE G_TYPE_INVALID
+
+#define KEY(key_id, key_name) .id = (key_id), .name = (key_name)
+#define TKEY(key, type) { (key), (type) }
+#define NO_TKEY { NULL, G_TYPE_NONE }
+/* Key mapped to the same tracker key in all services */
+#define COMMON_TKEY(key, type) { TKEY(key, type), TKEY(key, type), \
+                                 TKEY(key, type) }
+#define NO_TRACKER { NO_TKEY, NO_TKEY, NO_TKEY }
+
+#define CHILDCOUNT(level)                                               \
+  {                                                                     \
+    .metadata = { KEY(KEY_ID_CHILDCOUNT_ ## level,                      \
+                      MAFW_METADATA_KEY_CHILDCOUNT_ ## level),          \
+                  .value_type = G_TYPE_INT,                             \
+                  .allowed_empty = TRUE,                                \
+                  .special = SPECIAL_KEY_CHILDCOUNT,                    \
+                  .childcount_level = (level) },                        \
+    .tracker = { NO_TKEY, NO_TKEY,                                      \
+                 TKEY(TRACKER_PKEY_COUNT, G_TYPE_INT) }                 \
+  }
+
+#define ART(key_id, key_name, type, source)                             \
+  {                                                                     \
+    .metadata = { KEY(key_id, key_name),                                \
+                  .value_type = G_TYPE_STRING,                          \
+                  .key_type = (type),                                   \
+                  .depends_on = (source) },                             \
+    .tracker = NO_TRACKER                                               \
+  }
+
+/* Everything known about a key */
+typedef struct KeyDescriptor
+{
+  MetadataKey metadata;
+  /* Tracker key within music, videos and playlist services, with the keys
+   * common to all of them already included */
+  TrackerKey tracker[TRACKER_TYPE_PLAYLIST + 1];
+} KeyDescriptor;
+
+/* The mapping of all known keys, indexed by KeyId */
+static KeyDescriptor keys[KEY_ID_LAST] = {
+  [KEY_ID_TITLE] = {
+    .metadata = { KEY(KEY_ID_TITLE, MAFW_METADATA_KEY_TITLE),
+                  .value_type = G_TYPE_STRING,
+                  .allowed_empty = TRUE,
+                  .special = SPECIAL_KEY_TITLE },
+    .tracker = { TKEY(TRACKER_AKEY_TITLE, G_TYPE_STRING),
+                 TKEY(TRACKER_VKEY_TITLE, G_TYPE_STRING),
+                 NO_TKEY }
+  },
+  [KEY_ID_DURATION] = {
+    .metadata = { KEY(KEY_ID_DURATION, MAFW_METADATA_KEY_DURATION),
+                  .value_type = G_TYPE_INT,
+                  .writable = TRUE,
+                  .special = SPECIAL_KEY_DURATION },
+    .tracker = { TKEY(TRACKER_AKEY_DURATION, G_TYPE_INT),
+                 TKEY(TRACKER_VKEY_DURATION, G_TYPE_INT),
+                 TKEY(TRACKER_PKEY_DURATION, G_TYPE_INT) }
+  },
+  [KEY_ID_ARTIST] = {
+    .metadata = { KEY(KEY_ID_ARTIST, MAFW_METADATA_KEY_ARTIST),
+                  .value_type = G_TYPE_STRING,
+                  .interned = TRUE },
+    .tracker = { TKEY(TRACKER_AKEY_ARTIST, G_TYPE_STRING), NO_TKEY, NO_TKEY }
+  },
+  [KEY_ID_ALBUM] = {
+    .metadata = { KEY(KEY_ID_ALBUM, MAFW_METADATA_KEY_ALBUM),
+                  .value_type = G_TYPE_STRING,
+                  .interned = TRUE },
+    .tracker = { TKEY(TRACKER_AKEY_ALBUM, G_TYPE_STRING), NO_TKEY, NO_TKEY }
+  },
+  [KEY_ID_GENRE] = {
+    .metadata = { KEY(KEY_ID_GENRE, MAFW_METADATA_KEY_GENRE),
+                  .value_type = G_TYPE_STRING,
+                  .interned = TRUE },
+    .tracker = { TKEY(TRACKER_AKEY_GENRE, G_TYPE_STRING), NO_TKEY, NO_TKEY }
+  },
+  [KEY_ID_TRACK] = {
+    .metadata = { KEY(KEY_ID_TRACK, MAFW_METADATA_KEY_TRACK),
+                  .value_type = G_TYPE_INT },
+    .tracker = { TKEY(TRACKER_AKEY_TRACK, G_TYPE_INT), NO_TKEY, NO_TKEY }
+  },
+  [KEY_ID_YEAR] = {
+    .metadata = { KEY(KEY_ID_YEAR, MAFW_METADATA_KEY_YEAR),
+                  .value_type = DATE_TYPE },
+    .tracker = { TKEY(TRACKER_AKEY_YEAR, DATE_TYPE), NO_TKEY, NO_TKEY }
+  },
+  [KEY_ID_BITRATE] = {
+    .metadata = { KEY(KEY_ID_BITRATE, MAFW_METADATA_KEY_BITRATE),
+                  .value_type = G_TYPE_INT },
+    .tracker = { TKEY(TRACKER_AKEY_BITRATE, G_TYPE_DOUBLE), NO_TKEY, NO_TKEY }
+  },
+  [KEY_ID_LAST_PLAYED] = {
+    .metadata = { KEY(KEY_ID_LAST_PLAYED, MAFW_METADATA_KEY_LAST_PLAYED),
+                  .value_type = G_TYPE_LONG,
+                  .writable = TRUE },
+    .tracker = { TKEY(TRACKER_AKEY_LAST_PLAYED, DATE_TYPE), NO_TKEY, NO_TKEY }
+  },
+  [KEY_ID_PLAY_COUNT] = {
+    .metadata = { KEY(KEY_ID_PLAY_COUNT, MAFW_METADATA_KEY_PLAY_COUNT),
+                  .value_type = G_TYPE_INT,
+                  .writable = TRUE,
+                  .allowed_empty = TRUE },
+    .tracker = { TKEY(TRACKER_AKEY_PLAY_COUNT, G_TYPE_INT), NO_TKEY, NO_TKEY }
+  },
+  [KEY_ID_VIDEO_FRAMERATE] = {
+    .metadata = { KEY(KEY_ID_VIDEO_FRAMERATE,
+                      MAFW_METADATA_KEY_VIDEO_FRAMERATE),
+                  .value_type = G_TYPE_FLOAT },
+    .tracker = { NO_TKEY, TKEY(TRACKER_VKEY_FRAMERATE, G_TYPE_DOUBLE), NO_TKEY }
+  },
+  [KEY_ID_PAUSED_THUMBNAIL_URI] = {
+    .metadata = { KEY(KEY_ID_PAUSED_THUMBNAIL_URI,
+                      MAFW_METADATA_KEY_PAUSED_THUMBNAIL_URI),
+                  .value_type = G_TYPE_STRING,
+                  .writable = TRUE },
+    .tracker = COMMON_TKEY(TRACKER_VKEY_PAUSED_THUMBNAIL, G_TYPE_STRING)
+  },
+  [KEY_ID_PAUSED_POSITION] = {
+    .metadata = { KEY(KEY_ID_PAUSED_POSITION,
+                      MAFW_METADATA_KEY_PAUSED_POSITION),
+                  .value_type = G_TYPE_INT,
+                  .writable = TRUE },
+    .tracker = COMMON_TKEY(TRACKER_VKEY_PAUSED_POSITION, G_TYPE_INT)
+  },
+  [KEY_ID_VIDEO_SOURCE] = {
+    .metadata = { KEY(KEY_ID_VIDEO_SOURCE, MAFW_METADATA_KEY_VIDEO_SOURCE),
+                  .value_type = G_TYPE_STRING },
+    .tracker = COMMON_TKEY(TRACKER_VKEY_SOURCE, G_TYPE_STRING)
+  },
+  [KEY_ID_RES_X] = {
+    .metadata = { KEY(KEY_ID_RES_X, MAFW_METADATA_KEY_RES_X),
+                  .value_type = G_TYPE_INT },
+    .tracker = COMMON_TKEY(TRACKER_VKEY_RES_X, G_TYPE_INT)
+  },
+  [KEY_ID_RES_Y] = {
+    .metadata = { KEY(KEY_ID_RES_Y, MAFW_METADATA_KEY_RES_Y),
+                  .value_type = G_TYPE_INT },
+    .tracker = COMMON_TKEY(TRACKER_VKEY_RES_Y, G_TYPE_INT)
+  },
+  [KEY_ID_CHILDCOUNT_1] = CHILDCOUNT(1),
+  [KEY_ID_CHILDCOUNT_2] = CHILDCOUNT(2),
+  [KEY_ID_CHILDCOUNT_3] = CHILDCOUNT(3),
+  [KEY_ID_CHILDCOUNT_4] = CHILDCOUNT(4),
+  [KEY_ID_COPYRIGHT] = {
+    .metadata = { KEY(KEY_ID_COPYRIGHT, MAFW_METADATA_KEY_COPYRIGHT),
+                  .value_type = G_TYPE_STRING },
+    .tracker = COMMON_TKEY(TRACKER_FKEY_COPYRIGHT, G_TYPE_STRING)
+  },
+  [KEY_ID_FILESIZE] = {
+    .metadata = { KEY(KEY_ID_FILESIZE, MAFW_METADATA_KEY_FILESIZE),
+                  .value_type = G_TYPE_INT },
+    .tracker = COMMON_TKEY(TRACKER_FKEY_FILESIZE, G_TYPE_INT)
+  },
+  [KEY_ID_FILENAME] = {
+    .metadata = { KEY(KEY_ID_FILENAME, MAFW_METADATA_KEY_FILENAME),
+                  .value_type = G_TYPE_STRING },
+    .tracker = COMMON_TKEY(TRACKER_FKEY_FILENAME, G_TYPE_STRING)
+  },
+  [KEY_ID_MIME] = {
+    .metadata = { KEY(KEY_ID_MIME, MAFW_METADATA_KEY_MIME),
+                  .value_type = G_TYPE_STRING,
+                  .special = SPECIAL_KEY_MIME,
+                  .interned = TRUE },
+    .tracker = COMMON_TKEY(TRACKER_FKEY_MIME, G_TYPE_STRING)
+  },
+  [KEY_ID_ADDED] = {
+    .metadata = { KEY(KEY_ID_ADDED, MAFW_METADATA_KEY_ADDED),
+                  .value_type = DATE_TYPE },
+    .tracker = COMMON_TKEY(TRACKER_FKEY_ADDED, DATE_TYPE)
+  },
+  [KEY_ID_MODIFIED] = {
+    .metadata = { KEY(KEY_ID_MODIFIED, MAFW_METADATA_KEY_MODIFIED),
+                  .value_type = DATE_TYPE },
+    .tracker = COMMON_TKEY(TRACKER_FKEY_MODIFIED, DATE_TYPE)
+  },
+  [KEY_ID_URI] = {
+    .metadata = { KEY(KEY_ID_URI, MAFW_METADATA_KEY_URI),
+                  .value_type = G_TYPE_STRING },
+    .tracker = COMMON_TKEY(TRACKER_FKEY_FULLNAME, G_TYPE_STRING)
+  },
+  /* Special key (not available in MAFW) */
+  [KEY_ID_PATH] = {
+    .metadata = { KEY(KEY_ID_PATH, TRACKER_FKEY_PATH),
+                  .value_type = G_TYPE_STRING },
+    .tracker = COMMON_TKEY(TRACKER_FKEY_PATH, G_TYPE_STRING)
+  },
+  [KEY_ID_ALBUM_ART_SMALL_URI] = ART(KEY_ID_ALBUM_ART_SMALL_URI,
+                                     MAFW_METADATA_KEY_ALBUM_ART_SMALL_URI,
+                                     ALBUM_ART_KEY,
+                                     MAFW_METADATA_KEY_ALBUM_ART_URI),
+  [KEY_ID_ALBUM_ART_MEDIUM_URI] = ART(KEY_ID_ALBUM_ART_MEDIUM_URI,
+                                      MAFW_METADATA_KEY_ALBUM_ART_MEDIUM_URI,
+                                      ALBUM_ART_KEY,
+                                      MAFW_METADATA_KEY_ALBUM_ART_URI),
+  [KEY_ID_ALBUM_ART_LARGE_URI] = ART(KEY_ID_ALBUM_ART_LARGE_URI,
+                                     MAFW_METADATA_KEY_ALBUM_ART_LARGE_URI,
+                                     ALBUM_ART_KEY,
+                                     MAFW_METADATA_KEY_ALBUM_ART_URI),
+  [KEY_ID_ALBUM_ART_URI] = ART(KEY_ID_ALBUM_ART_URI,
+                               MAFW_METADATA_KEY_ALBUM_ART_URI,
+                               ALBUM_ART_KEY,
+                               MAFW_METADATA_KEY_ALBUM),
+  [KEY_ID_THUMBNAIL_SMALL_URI] = ART(KEY_ID_THUMBNAIL_SMALL_URI,
+                                     MAFW_METADATA_KEY_THUMBNAIL_SMALL_URI,
+                                     THUMBNAIL_KEY,
+                                     MAFW_METADATA_KEY_URI),
+  [KEY_ID_THUMBNAIL_MEDIUM_URI] = ART(KEY_ID_THUMBNAIL_MEDIUM_URI,
+                                      MAFW_METADATA_KEY_THUMBNAIL_MEDIUM_URI,
+                                      THUMBNAIL_KEY,
+                                      MAFW_METADATA_KEY_URI),
+  [KEY_ID_THUMBNAIL_LARGE_URI] = ART(KEY_ID_THUMBNAIL_LARGE_URI,
+                                     MAFW_METADATA_KEY_THUMBNAIL_LARGE_URI,
+                                     THUMBNAIL_KEY,
+                                     MAFW_METADATA_KEY_URI),
+  [KEY_ID_THUMBNAIL_URI] = ART(KEY_ID_THUMBNAIL_URI,
+                               MAFW_METADATA_KEY_THUMBNAIL_URI,
+                               THUMBNAIL_KEY,
+                               MAFW_METADATA_KEY_URI)
+};
+
+/* Key ids sorted by name, to look names up with a binary search */
+static KeyId sorted_ids[KEY_ID_LAST];
+
+/* ------------------------- Private API ------------------------- */
+
+static gint
+_compare_ids(gconstpointer a, gconstpointer b)
+{
+  return strcmp(keys[*(const KeyId *)a].metadata.name,
+                keys[*(const KeyId *)b].metadata.name);
+}
+
+static gint
+_compare_name_id(gconstpointer name, gconstpointer id)
+{
+  return strcmp(name, keys[*(const KeyId *)id].metadata.name);
+}
+
+/* Completes the table with what is not known at compile time */
+static void
+_keys_init(void)
+{
+  static gsize initialized = 0;
+  KeyId id;
+  gint type;
+
+  if (!g_once_init_enter(&initialized))
+    return;
+
+  for (id = 0; id < KEY_ID_LAST; id++)
+  {
+    g_assert(keys[id].metadata.name != NULL);
+    g_assert(keys[id].metadata.id == id);
+
+    if (keys[id].metadata.value_type == DATE_TYPE)
+      keys[id].metadata.value_type = G_TYPE_DATE;
+
+    for (type = TRACKER_TYPE_MUSIC; type <= TRACKER_TYPE_PLAYLIST; type++)
+    {
+      if (keys[id].tracker[type].value_type == DATE_TYPE)
+        keys[id].tracker[type].value_type = G_TYPE_DATE;
+    }
+
+    sorted_ids[id] = id;
+  }
+
+  qsort(sorted_ids, KEY_ID_LAST, sizeof(KeyId), _compare_ids);
+
+  g_once_init_leave(&initialized, 1);
+}
+
 /* ------------------------- Public API ------------------------- */
 
 gchar *
@@ -47,17 +323,21 @@ keymap_mafw_key_to_tracker_key(const gchar *mafw_key,
 gboolean
 keymap_is_key_supported_in_tracker(const gchar *mafw_key)
 {
-  static InfoKeyTable *t = NULL;
+  KeyId id;
+  gint type;
+
+  id = keymap_get_key_id(mafw_key);
+
+  if (id == KEY_ID_UNKNOWN)
+    return FALSE;
 
-  if (!t)
+  for (type = TRACKER_TYPE_MUSIC; type <= TRACKER_TYPE_PLAYLIST; type++)
   {
-    t = keymap_get_info_key_table();
+    if (keys[id].tracker[type].tracker_key)
+      return TRUE;
   }
 
-  return g_hash_table_lookup(t->music_keys, mafw_key) != NULL ||
-         g_hash_table_lookup(t->videos_keys, mafw_key) != NULL ||
-         g_hash_table_lookup(t->playlist_keys, mafw_key) != NULL ||
-         g_hash_table_lookup(t->common_keys, mafw_key) != NULL;
+  return FALSE;
 }
 
 gboolean
@@ -71,435 +351,6 @@ keymap_mafw_key_is_writable(gchar *mafw_key)
   return metadata_key && metadata_key->writable;
 }
 
-InfoKeyTable *
-keymap_get_info_key_table(void)
-{
-  static InfoKeyTable *table = NULL;
-  MetadataKey *metadata_key = NULL;
-  TrackerKey *tracker_key = NULL;
-
-  if (!table)
-  {
-    table = g_new0(InfoKeyTable, 1);
-    table->music_keys = g_hash_table_new(g_str_hash, g_str_equal);
-    table->videos_keys = g_hash_table_new(g_str_hash, g_str_equal);
-    table->playlist_keys = g_hash_table_new(g_str_hash, g_str_equal);
-    table->common_keys = g_hash_table_new(g_str_hash, g_str_equal);
-    table->metadata_keys = g_hash_table_new(g_str_hash, g_str_equal);
-
-    /* Insert mapping for music service */
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_TITLE;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_TITLE,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_DURATION;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_DURATION,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_ARTIST;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_ARTIST,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_ALBUM;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_ALBUM,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_GENRE;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_GENRE,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_TRACK;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_TRACK,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_YEAR;
-    tracker_key->value_type = G_TYPE_DATE;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_YEAR, tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_BITRATE;
-    tracker_key->value_type = G_TYPE_DOUBLE;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_BITRATE,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_LAST_PLAYED;
-    tracker_key->value_type = G_TYPE_DATE;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_LAST_PLAYED,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_AKEY_PLAY_COUNT;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->music_keys, MAFW_METADATA_KEY_PLAY_COUNT,
-                        tracker_key);
-
-    /* Insert mapping for videos service */
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_VKEY_TITLE;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->videos_keys, MAFW_METADATA_KEY_TITLE,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_VKEY_DURATION;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->videos_keys, MAFW_METADATA_KEY_DURATION,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_VKEY_FRAMERATE;
-    tracker_key->value_type = G_TYPE_DOUBLE;
-    g_hash_table_insert(table->videos_keys, MAFW_METADATA_KEY_VIDEO_FRAMERATE,
-                        tracker_key);
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_VKEY_PAUSED_THUMBNAIL;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->common_keys,
-                        MAFW_METADATA_KEY_PAUSED_THUMBNAIL_URI, tracker_key);
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_VKEY_PAUSED_POSITION;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_PAUSED_POSITION,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_VKEY_SOURCE;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_VIDEO_SOURCE,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_VKEY_RES_X;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_RES_X,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_VKEY_RES_Y;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_RES_Y,
-                        tracker_key);
-
-    /* Insert mapping for playlist service */
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_PKEY_DURATION;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->playlist_keys, MAFW_METADATA_KEY_DURATION,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_PKEY_COUNT;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->playlist_keys, MAFW_METADATA_KEY_CHILDCOUNT_1,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_PKEY_COUNT;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->playlist_keys, MAFW_METADATA_KEY_CHILDCOUNT_2,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_PKEY_COUNT;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->playlist_keys, MAFW_METADATA_KEY_CHILDCOUNT_3,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_PKEY_COUNT;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->playlist_keys, MAFW_METADATA_KEY_CHILDCOUNT_4,
-                        tracker_key);
-
-    /* Insert mapping common for all services */
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_FKEY_COPYRIGHT;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_COPYRIGHT,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_FKEY_FILESIZE;
-    tracker_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_FILESIZE,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_FKEY_FILENAME;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_FILENAME,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_FKEY_MIME;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_MIME,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_FKEY_ADDED;
-    tracker_key->value_type = G_TYPE_DATE;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_ADDED,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_FKEY_MODIFIED;
-    tracker_key->value_type = G_TYPE_DATE;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_MODIFIED,
-                        tracker_key);
-
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_FKEY_FULLNAME;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->common_keys, MAFW_METADATA_KEY_URI, tracker_key);
-
-    /* Special key (not available in MAFW) */
-    tracker_key = g_new0(TrackerKey, 1);
-    tracker_key->tracker_key = TRACKER_FKEY_PATH;
-    tracker_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->common_keys, TRACKER_FKEY_PATH, tracker_key);
-
-    /* Insert metadata assocciated with each key */
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    metadata_key->allowed_empty = TRUE;
-    metadata_key->special = SPECIAL_KEY_CHILDCOUNT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_CHILDCOUNT_1,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    metadata_key->allowed_empty = TRUE;
-    metadata_key->special = SPECIAL_KEY_CHILDCOUNT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_CHILDCOUNT_2,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    metadata_key->allowed_empty = TRUE;
-    metadata_key->special = SPECIAL_KEY_CHILDCOUNT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_CHILDCOUNT_3,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    metadata_key->allowed_empty = TRUE;
-    metadata_key->special = SPECIAL_KEY_CHILDCOUNT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_CHILDCOUNT_4,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_FLOAT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_VIDEO_FRAMERATE,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_COPYRIGHT,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_FILESIZE,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_FILENAME,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->allowed_empty = TRUE;
-    metadata_key->special = SPECIAL_KEY_TITLE;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_TITLE,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    metadata_key->special = SPECIAL_KEY_DURATION;
-    metadata_key->writable = TRUE;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_DURATION,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->special = SPECIAL_KEY_MIME;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_MIME,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_ARTIST,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_ALBUM,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_GENRE,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_TRACK,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_DATE;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_YEAR,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_BITRATE,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_LONG;
-    metadata_key->writable = TRUE;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_LAST_PLAYED,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    metadata_key->writable = TRUE;
-    metadata_key->allowed_empty = TRUE;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_PLAY_COUNT,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_DATE;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_ADDED,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_DATE;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_MODIFIED,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->writable = TRUE;
-    g_hash_table_insert(table->metadata_keys,
-                        MAFW_METADATA_KEY_PAUSED_THUMBNAIL_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    metadata_key->writable = TRUE;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_PAUSED_POSITION,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_VIDEO_SOURCE,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_RES_X,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_INT;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_RES_Y,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    g_hash_table_insert(table->metadata_keys, TRACKER_FKEY_PATH,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->key_type = ALBUM_ART_KEY;
-    metadata_key->depends_on = MAFW_METADATA_KEY_ALBUM_ART_URI;
-    g_hash_table_insert(table->metadata_keys,
-                        MAFW_METADATA_KEY_ALBUM_ART_SMALL_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->key_type = ALBUM_ART_KEY;
-    metadata_key->depends_on = MAFW_METADATA_KEY_ALBUM_ART_URI;
-    g_hash_table_insert(table->metadata_keys,
-                        MAFW_METADATA_KEY_ALBUM_ART_MEDIUM_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->key_type = ALBUM_ART_KEY;
-    metadata_key->depends_on = MAFW_METADATA_KEY_ALBUM_ART_URI;
-    g_hash_table_insert(table->metadata_keys,
-                        MAFW_METADATA_KEY_ALBUM_ART_LARGE_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->key_type = ALBUM_ART_KEY;
-    metadata_key->depends_on = MAFW_METADATA_KEY_ALBUM;
-    g_hash_table_insert(table->metadata_keys, MAFW_METADATA_KEY_ALBUM_ART_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->key_type = THUMBNAIL_KEY;
-    metadata_key->depends_on = MAFW_METADATA_KEY_URI;
-    g_hash_table_insert(table->metadata_keys,
-                        MAFW_METADATA_KEY_THUMBNAIL_SMALL_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->key_type = THUMBNAIL_KEY;
-    metadata_key->depends_on = MAFW_METADATA_KEY_URI;
-    g_hash_table_insert(table->metadata_keys,
-                        MAFW_METADATA_KEY_THUMBNAIL_MEDIUM_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->key_type = THUMBNAIL_KEY;
-    metadata_key->depends_on = MAFW_METADATA_KEY_URI;
-    g_hash_table_insert(table->metadata_keys,
-                        MAFW_METADATA_KEY_THUMBNAIL_LARGE_URI,
-                        metadata_key);
-
-    metadata_key = g_new0(MetadataKey, 1);
-    metadata_key->value_type = G_TYPE_STRING;
-    metadata_key->key_type = THUMBNAIL_KEY;
-    metadata_key->depends_on = MAFW_METADATA_KEY_URI;
-    g_hash_table_insert(table->metadata_keys,
-                        MAFW_METADATA_KEY_THUMBNAIL_URI,
-                        metadata_key);
-  }
-
-  return table;
-}
-
 gchar **
 keymap_mafw_keys_to_tracker_keys(gchar **mafw_keys, TrackerObjectType type)
 {
@@ -530,9 +381,7 @@ keymap_mafw_keys_to_tracker_keys(gchar **mafw_keys, TrackerObjectType type)
 
     if (tracker_key)
     {
-      tracker_keys[count++] =
-        keymap_mafw_key_to_tracker_key(mafw_keys[i],
-                                       type);
+      tracker_keys[count++] = g_strdup(tracker_key->tracker_key);
     }
   }
 
@@ -591,10 +440,8 @@ keymap_mafw_sort_keys_to_tracker_keys(gchar **mafw_keys, TrackerObjectType type)
 
     if (tracker_key)
     {
-      gchar *tkey = keymap_mafw_key_to_tracker_key(key, type);
-
-      tracker_keys[count++] = g_strconcat(sort_type, tkey, NULL);
-      g_free(tkey);
+      tracker_keys[count++] = g_strconcat(sort_type, tracker_key->tracker_key,
+                                          NULL);
     }
   }
 
@@ -604,44 +451,70 @@ keymap_mafw_sort_keys_to_tracker_keys(gchar **mafw_keys, TrackerObjectType type)
 MetadataKey *
 keymap_get_metadata(const gchar *mafw_key)
 {
-  static InfoKeyTable *table = NULL;
-
-  if (!table)
-    table = keymap_get_info_key_table();
-
-  return g_hash_table_lookup(table->metadata_keys, mafw_key);
+  return keymap_get_metadata_by_id(keymap_get_key_id(mafw_key));
 }
 
 TrackerKey *
 keymap_get_tracker_info(const gchar *mafw_key,
                         TrackerObjectType type)
 {
-  static InfoKeyTable *table = NULL;
-  TrackerKey *tracker_key;
+  return keymap_get_tracker_info_by_id(keymap_get_key_id(mafw_key), type);
+}
 
-  if (!table)
-    table = keymap_get_info_key_table();
+KeyId
+keymap_get_key_id(const gchar *mafw_key)
+{
+  const KeyId *id;
 
-  switch (type)
-  {
-    case TRACKER_TYPE_VIDEO:
-    {
-      tracker_key = g_hash_table_lookup(table->videos_keys, mafw_key);
-      break;
-    }
-    case TRACKER_TYPE_PLAYLIST:
-    {
-      tracker_key = g_hash_table_lookup(table->playlist_keys, mafw_key);
-      break;
-    }
-    default:
-      tracker_key = g_hash_table_lookup(table->music_keys, mafw_key);
-  }
+  if (!mafw_key)
+    return KEY_ID_UNKNOWN;
 
-  if (tracker_key)
-    return tracker_key;
+  _keys_init();
+
+  id = bsearch(mafw_key, sorted_ids, KEY_ID_LAST, sizeof(KeyId),
+               _compare_name_id);
+
+  if (id)
+    return *id;
+
+  return KEY_ID_UNKNOWN;
+}
+
+const gchar *
+keymap_get_key_name(KeyId id)
+{
+  if (id < 0 || id >= KEY_ID_LAST)
+    return NULL;
+
+  return keys[id].metadata.name;
+}
+
+MetadataKey *
+keymap_get_metadata_by_id(KeyId id)
+{
+  if (id < 0 || id >= KEY_ID_LAST)
+    return NULL;
+
+  _keys_init();
+
+  return &keys[id].metadata;
+}
+
+TrackerKey *
+keymap_get_tracker_info_by_id(KeyId id, TrackerObjectType type)
+{
+  if (id < 0 || id >= KEY_ID_LAST)
+    return NULL;
+
+  if (type > TRACKER_TYPE_PLAYLIST)
+    type = TRACKER_TYPE_MUSIC;
+
+  _keys_init();
+
+  if (!keys[id].tracker[type].tracker_key)
+    return NULL;
 
-  return g_hash_table_lookup(table->common_keys, mafw_key);
+  return &keys[id].tracker[type];
 }
 
 GType
@@ -48,8 +48,56 @@ enum SpecialKey
   SPECIAL_KEY_TITLE
 };
 
+/* Identifiers of the keys known by the source. They index the descriptor
+ * tables, so strings are resolved only once, at the API boundary */
+typedef enum
+{
+  KEY_ID_UNKNOWN = -1,
+  KEY_ID_TITLE = 0,
+  KEY_ID_DURATION,
+  KEY_ID_ARTIST,
+  KEY_ID_ALBUM,
+  KEY_ID_GENRE,
+  KEY_ID_TRACK,
+  KEY_ID_YEAR,
+  KEY_ID_BITRATE,
+  KEY_ID_LAST_PLAYED,
+  KEY_ID_PLAY_COUNT,
+  KEY_ID_VIDEO_FRAMERATE,
+  KEY_ID_PAUSED_THUMBNAIL_URI,
+  KEY_ID_PAUSED_POSITION,
+  KEY_ID_VIDEO_SOURCE,
+  KEY_ID_RES_X,
+  KEY_ID_RES_Y,
+  KEY_ID_CHILDCOUNT_1,
+  KEY_ID_CHILDCOUNT_2,
+  KEY_ID_CHILDCOUNT_3,
+  KEY_ID_CHILDCOUNT_4,
+  KEY_ID_COPYRIGHT,
+  KEY_ID_FILESIZE,
+  KEY_ID_FILENAME,
+  KEY_ID_MIME,
+  KEY_ID_ADDED,
+  KEY_ID_MODIFIED,
+  KEY_ID_URI,
+  KEY_ID_PATH,
+  KEY_ID_ALBUM_ART_SMALL_URI,
+  KEY_ID_ALBUM_ART_MEDIUM_URI,
+  KEY_ID_ALBUM_ART_LARGE_URI,
+  KEY_ID_ALBUM_ART_URI,
+  KEY_ID_THUMBNAIL_SMALL_URI,
+  KEY_ID_THUMBNAIL_MEDIUM_URI,
+  KEY_ID_THUMBNAIL_LARGE_URI,
+  KEY_ID_THUMBNAIL_URI,
+  KEY_ID_LAST
+} KeyId;
+
 typedef struct MetadataKey
 {
+  /* Identifier of the key */
+  KeyId id;
+  /* The name of the key */
+  const gchar *name;
   /* The type of the key. NOTE: G_TYPE_DATE will be handle as
    * G_TYPE_INT. But they are separated 'cause in we need to use
    * conversion functions when converting the keys to tracker keys */
@@ -65,6 +113,11 @@ typedef struct MetadataKey
   /* For special keys (those that are corner cases in the cache), mark its
    * speciality (nothing by default) */
   enum SpecialKey special;
+  /* Are the same values repeated among many clips, so each result stores
+   * them only once and shares them with the metadata? (not by default) */
+  gboolean interned;
+  /* Level of childcount keys (1-4), 0 for the rest */
+  gint childcount_level;
 } MetadataKey;
 
 typedef struct TrackerKey
@@ -75,20 +128,6 @@ typedef struct TrackerKey
   GType value_type;
 } TrackerKey;
 
-typedef struct InfoKeyTable
-{
-  /* Mapping mafw->tracker keys within music service */
-  GHashTable *music_keys;
-  /* Mapping mafw->tracker keys within videos service */
-  GHashTable *videos_keys;
-  /* Mapping mafw->tracker keys within playlist service */
-  GHashTable *playlist_keys;
-  /* Mapping mafw->tracker keys within common service */
-  GHashTable *common_keys;
-  /* Metadata associated with each mafw key */
-  GHashTable *metadata_keys;
-} InfoKeyTable;
-
 gchar *
 keymap_mafw_key_to_tracker_key(const gchar *mafw_key,
                                TrackerObjectType type);
@@ -102,13 +141,19 @@ gboolean
 keymap_is_key_supported_in_tracker(const gchar *mafw_key);
 gboolean
 keymap_mafw_key_is_writable(gchar *mafw_key);
-InfoKeyTable *
-keymap_get_info_key_table(void);
 MetadataKey *
 keymap_get_metadata(const gchar *mafw_key);
 TrackerKey *
 keymap_get_tracker_info(const gchar *mafw_key,
                         TrackerObjectType type);
+KeyId
+keymap_get_key_id(const gchar *mafw_key);
+const gchar *
+keymap_get_key_name(KeyId id);
+MetadataKey *
+keymap_get_metadata_by_id(KeyId id);
+TrackerKey *
+keymap_get_tracker_info_by_id(KeyId id, TrackerObjectType type);
 GType
 keymap_get_tracker_type(const gchar *mafw_key, TrackerObjectType type);
 
@@ -32,12 +32,15 @@
 
 #include "definitions.h"
 #include "mafw-tracker-source.h"
+#include "tracker-cache.h"
 #include "tracker-iface.h"
 #include "util.h"
 
 /* Used to store and emit browse results */
 struct _browse_closure
 {
+  /* Memory of the request: this structure, its object id and keys */
+  UtilPool *pool;
   /* Source instance */
   MafwSource *source;
   /* The browse request identifier */
@@ -57,6 +60,8 @@ struct _browse_closure
   guint count;
   /* A list of objectids of browsed items */
   GList *ids;
+  /* Storage of the strings in ids and pls_local_ids */
+  GStringChunk *strings;
   /* A list of metadata values for each browsed item */
   GList *metadata_values;
   /* A flag stating if the operation has been cancelled */
@@ -87,7 +92,7 @@ struct _browse_closure
   guint current_index;
   guint remaining_count;
 
-  MafwTrackerSourceSparqlBuilder *builder;
+  MafwTrackerSourceSparqlBuilder builder;
 };
 
 struct _browse_error_closure
@@ -194,11 +199,7 @@ _browse_closure_free(gpointer data)
 
   bc = (struct _browse_closure *)data;
 
-  /* Free objectid of browsed item */
-  g_free(bc->object_id);
-
   /* Free list of objectids */
-  g_list_foreach(bc->ids, (GFunc)g_free, NULL);
   g_list_free(bc->ids);
 
   /* For each object, destroy its metadata list */
@@ -210,11 +211,10 @@ _browse_closure_free(gpointer data)
   /* Free pls_(local)_uris field */
   g_list_foreach(bc->pls_uris, (GFunc)g_free, NULL);
   g_list_free(bc->pls_uris);
-  g_list_foreach(bc->pls_local_ids, (GFunc)g_free, NULL);
   g_list_free(bc->pls_local_ids);
 
-  /* Free metadata keys */
-  g_strfreev(bc->metadata_keys);
+  /* Free the strings of the lists above */
+  g_string_chunk_free(bc->strings);
 
   /* Free sort fields */
   g_strfreev(bc->sort_fields);
@@ -228,10 +228,10 @@ _browse_closure_free(gpointer data)
   /* Remove browse closure from pending browse operations */
   _remove_pending_browse_operation(MAFW_TRACKER_SOURCE(bc->source), bc);
 
-  g_object_unref(bc->builder);
+  mafw_tracker_source_sparql_builder_clear(&bc->builder);
 
-  /* Free browse closure structure */
-  g_free(bc);
+  /* Free browse closure structure, its object id and keys */
+  util_pool_free(bc->pool);
 }
 
 static void
@@ -285,35 +285,46 @@ _emit_browse_error(struct _browse_closure *bc,
   }
 }
 
+/* Replaces the elements of the list with object ids stored in the browse
+ * closure */
 static void
-_add_object_id_prefix_to_list(gchar *object_id_prefix,
+_add_object_id_prefix_to_list(struct _browse_closure *bc,
                               GList *list,
                               gboolean escape)
 {
   GList *iter;
-  gchar *data;
+  GString *object_id;
+  gsize prefix_len;
 
-  iter = list;
+  object_id = g_string_new(bc->object_id_prefix);
+  g_string_append_c(object_id, '/');
+  prefix_len = object_id->len;
 
-  while (iter != NULL)
+  for (iter = list; iter != NULL; iter = g_list_next(iter))
   {
+    if (!iter->data)
+      continue;
+
     /* Do not add the prefix if this element has already
        been handled as an URI element */
-    if (iter->data && !g_str_has_prefix((gchar *)iter->data,
-                                        MAFW_URI_SOURCE_UUID "::"))
+    if (g_str_has_prefix((gchar *)iter->data, MAFW_URI_SOURCE_UUID "::"))
     {
-      if (escape)
-        data = mafw_tracker_source_escape_string(iter->data);
-      else
-        data = g_strdup(iter->data);
-
-      g_free(iter->data);
-      iter->data = g_strconcat(object_id_prefix, "/", data, NULL);
-      g_free(data);
+      iter->data = g_string_chunk_insert(bc->strings, iter->data);
+      continue;
     }
 
-    iter = g_list_next(iter);
+    g_string_truncate(object_id, prefix_len);
+
+    if (escape)
+      mafw_tracker_source_append_escaped_string(object_id, iter->data);
+    else
+      g_string_append(object_id, iter->data);
+
+    iter->data = g_string_chunk_insert_len(bc->strings, object_id->str,
+                                           object_id->len);
   }
+
+  g_string_free(object_id, TRUE);
 }
 
 static void
@@ -324,7 +335,18 @@ _browse_tracker_cb(MafwResult *clips, GError *error, gpointer user_data)
   if (error == NULL)
   {
     /* Convert results to object ids */
-    _add_object_id_prefix_to_list(bc->object_id_prefix, clips->ids, TRUE);
+    _add_object_id_prefix_to_list(bc, clips->ids, TRUE);
+    g_string_chunk_free(clips->strings);
+    ti_watch_deferred_art(clips, G_OBJECT(bc->source), clips->ids);
+
+    /* Keep the metadata of clips for later get_metadata calls, unless
+     * some of it is still to come */
+    if (clips->clips && !clips->deferred)
+    {
+      mafw_tracker_source_cache_metadata(MAFW_TRACKER_SOURCE(bc->source),
+                                         bc->metadata_keys, clips->ids,
+                                         clips->metadata_values);
+    }
 
     /* Add results to browse closure */
     bc->ids = g_list_concat(bc->ids, clips->ids);
@@ -362,9 +384,9 @@ _add_playlist_duration_cb(MafwSource *self,
 
     if (gval)
     {
-      mafw_metadata_add_int(playlists_bc->current_metadata_value->data,
-                            MAFW_METADATA_KEY_DURATION,
-                            g_value_get_int(gval));
+      tracker_cache_metadata_add_int(
+        playlists_bc->current_metadata_value->data,
+        MAFW_METADATA_KEY_DURATION, g_value_get_int(gval));
     }
   }
 
@@ -430,8 +452,9 @@ _browse_playlists_tracker_cb(MafwResult *clips,
   if (!error)
   {
     /* Convert the results to object ids */
-    _add_object_id_prefix_to_list(playlists_bc->object_id_prefix, clips->ids,
-                                  TRUE);
+    _add_object_id_prefix_to_list(playlists_bc, clips->ids, TRUE);
+    g_string_chunk_free(clips->strings);
+    ti_watch_deferred_art(clips, G_OBJECT(playlists_bc->source), clips->ids);
 
     /* Add the results to the browse closure */
     playlists_bc->ids = g_list_concat(playlists_bc->ids, clips->ids);
@@ -479,7 +502,8 @@ _consolidate_metadata_cb(MafwSource *source,
   /* Add result */
   if (!error)
   {
-    bc->ids = g_list_prepend(bc->ids, g_strdup(object_id));
+    bc->ids = g_list_prepend(bc->ids,
+                             g_string_chunk_insert(bc->strings, object_id));
     g_hash_table_ref(metadata);
     bc->metadata_values = g_list_prepend(bc->metadata_values, metadata);
   }
@@ -529,7 +553,18 @@ _browse_enqueue_videos_cb(MafwResult *clips,
   if (error == NULL)
   {
     /* Convert results to object ids */
-    _add_object_id_prefix_to_list(bc->object_id_prefix, clips->ids, TRUE);
+    _add_object_id_prefix_to_list(bc, clips->ids, TRUE);
+    g_string_chunk_free(clips->strings);
+    ti_watch_deferred_art(clips, G_OBJECT(bc->source), clips->ids);
+
+    /* Keep the metadata of clips for later get_metadata calls, unless
+     * some of it is still to come */
+    if (clips->clips && !clips->deferred)
+    {
+      mafw_tracker_source_cache_metadata(MAFW_TRACKER_SOURCE(bc->source),
+                                         bc->metadata_keys, clips->ids,
+                                         clips->metadata_values);
+    }
 
     /* Add results to browse closure */
     bc->ids = g_list_concat(bc->ids, clips->ids);
@@ -553,7 +588,7 @@ _browse_enqueue_videos_cb(MafwResult *clips,
   bc->object_id_prefix = _build_object_id(TRACKER_SOURCE_VIDEOS,
                                           NULL);
 
-  ti_get_videos(bc->builder,
+  ti_get_videos(&bc->builder,
                 bc->metadata_keys,
                 bc->filter_criteria,
                 bc->sort_fields,
@@ -578,7 +613,7 @@ _new_metadata_from_untracked_resource(gchar *uri,
     {
       gchar *unescaped_title, *temp;
       temp = g_path_get_basename(uri);
-      unescaped_title = g_uri_unescape_string(temp, NULL);
+      unescaped_title = util_unescape_string(temp);
       mafw_metadata_add_str(metadata, keys[i], unescaped_title);
       g_free(unescaped_title);
       g_free(temp);
@@ -613,10 +648,16 @@ _construct_playlist_entries_result(struct _browse_closure *bc,
   GHashTable *metadata;
   gchar *clip;
   gchar *pathname;
-  gchar *escape_pathname;
-  gchar *objectid;
+  gchar *untracked_id;
+  GString *objectid;
+  gsize prefix_len;
+  gboolean local;
   gchar *uri;
 
+  objectid = g_string_new(bc->object_id_prefix);
+  g_string_append_c(objectid, '/');
+  prefix_len = objectid->len;
+
   iter = bc->pls_uris;
 
   while (iter != NULL)
@@ -629,24 +670,29 @@ _construct_playlist_entries_result(struct _browse_closure *bc,
       continue;
     }
 
+    local = FALSE;
+
     if (g_str_has_prefix(uri, "file://"))
     {
       /* Construct the objectid for the local file */
-      pathname = g_filename_from_uri(uri, NULL, NULL);
-      escape_pathname = mafw_tracker_source_escape_string(pathname);
-      objectid = g_strconcat(bc->object_id_prefix, "/", escape_pathname, NULL);
-      g_free(pathname);
-      g_free(escape_pathname);
+      pathname = util_uri_to_filename(uri, NULL);
+
+      if (pathname)
+      {
+        g_string_truncate(objectid, prefix_len);
+        mafw_tracker_source_append_escaped_string(objectid, pathname);
+        g_free(pathname);
+        local = TRUE;
+      }
     }
-    else
-      objectid = NULL;
 
-    if (objectid && (tracker_metadatas != NULL) &&
-        (metadata = g_hash_table_lookup(tracker_metadatas, objectid)))
+    if (local && (tracker_metadatas != NULL) &&
+        (metadata = g_hash_table_lookup(tracker_metadatas, objectid->str)))
     {
       /* The clip is in tracker results. Add tracker
          metadata. */
-      clip = g_strdup(objectid);
+      clip = g_string_chunk_insert_len(bc->strings, objectid->str,
+                                       objectid->len);
       g_hash_table_ref(metadata);
 
       clips->ids = g_list_prepend(clips->ids, clip);
@@ -657,7 +703,9 @@ _construct_playlist_entries_result(struct _browse_closure *bc,
     {
       /* The clip non-local or missing in tracker
          results. Add untracked metadata. */
-      clip = mafw_source_create_objectid(uri);
+      untracked_id = mafw_source_create_objectid(uri);
+      clip = g_string_chunk_insert(bc->strings, untracked_id);
+      g_free(untracked_id);
       metadata = _new_metadata_from_untracked_resource(uri, bc->metadata_keys);
 
       clips->ids = g_list_prepend(clips->ids, clip);
@@ -665,8 +713,9 @@ _construct_playlist_entries_result(struct _browse_closure *bc,
     }
 
     iter = g_list_next(iter);
-    g_free(objectid);
   }
+
+  g_string_free(objectid, TRUE);
 }
 
 static void
@@ -704,10 +753,14 @@ _pls_entry_parsed (TotemPlParser *parser,
     /* Check if the URI is local (tracker can resolve the metadata) or not  */
     if (g_str_has_prefix(escaped_uri, "file://"))
     {
-      filename = g_filename_from_uri(escaped_uri, NULL, NULL);
+      filename = util_uri_to_filename(escaped_uri, NULL);
 
       if (filename)
-        bc->pls_local_ids = g_list_prepend(bc->pls_local_ids, filename);
+      {
+        bc->pls_local_ids = g_list_prepend(
+          bc->pls_local_ids, g_string_chunk_insert(bc->strings, filename));
+        g_free(filename);
+      }
     }
 
     bc->pls_uris = g_list_prepend(bc->pls_uris, escaped_uri);
@@ -784,22 +837,36 @@ _get_playlist_entries(const gchar *pls_uri,
     if (bc->pls_local_ids != NULL)
     {
       gchar **local_objectids;
+      GList *iter;
+      guint n = 0;
 
       /* Reverse the list */
       bc->pls_local_ids = g_list_reverse(bc->pls_local_ids);
 
-      /* Construct the objectids */
-      _add_object_id_prefix_to_list(bc->object_id_prefix,
-                                    bc->pls_local_ids,
-                                    TRUE);
-      local_objectids = util_list_to_strv(bc->pls_local_ids);
+      /* Construct the objectids, skipping those tracker does not know */
+      _add_object_id_prefix_to_list(bc, bc->pls_local_ids, TRUE);
+      local_objectids = g_new(gchar *, g_list_length(bc->pls_local_ids) + 1);
+
+      for (iter = bc->pls_local_ids; iter; iter = g_list_next(iter))
+      {
+        if (!mafw_tracker_source_is_untracked(MAFW_TRACKER_SOURCE(bc->source),
+                                              iter->data))
+          local_objectids[n++] = iter->data;
+      }
+
+      local_objectids[n] = NULL;
 
       /* Do we have local references in the playlist? If so,
          try to resolve metadata for them using Tracker */
-      mafw_tracker_source_get_metadatas(
-        bc->source, (const gchar **)local_objectids,
-        (const gchar *const *)bc->metadata_keys, _browse_playlist_tracker_cb,
-        bc);
+      if (n)
+      {
+        mafw_tracker_source_get_metadatas(
+          bc->source, (const gchar **)local_objectids,
+          (const gchar *const *)bc->metadata_keys,
+          _browse_playlist_tracker_cb, bc);
+      }
+      else
+        _browse_playlist_tracker_cb(bc->source, NULL, bc, NULL);
 
       g_free(local_objectids);
     }
@@ -869,7 +936,7 @@ _browse_songs_branch(const gchar *genre,
   bc->object_id_prefix = _build_object_id(TRACKER_SOURCE_MUSIC,
                                           TRACKER_SOURCE_SONGS,
                                           NULL);
-  ti_get_songs(bc->builder,
+  ti_get_songs(&bc->builder,
                genre, artist, album,
                bc->metadata_keys,
                bc->filter_criteria,
@@ -901,7 +968,7 @@ _browse_albums_branch(const gchar *album,
                                               TRACKER_SOURCE_ALBUMS,
                                               escaped_album, NULL);
       g_free(escaped_album);
-      ti_get_songs(bc->builder,
+      ti_get_songs(&bc->builder,
                    NULL, NULL, album,
                    bc->metadata_keys,
                    bc->filter_criteria,
@@ -918,7 +985,7 @@ _browse_albums_branch(const gchar *album,
         _build_object_id(TRACKER_SOURCE_MUSIC,
                          TRACKER_SOURCE_ALBUMS,
                          NULL);
-      ti_get_albums(bc->builder,
+      ti_get_albums(&bc->builder,
                     NULL, NULL,
                     bc->metadata_keys,
                     bc->filter_criteria,
@@ -949,7 +1016,7 @@ _browse_artists_branch(const gchar *artist,
         _build_object_id(TRACKER_SOURCE_MUSIC,
                          TRACKER_SOURCE_ARTISTS,
                          artist, album, NULL);
-      ti_get_songs(bc->builder,
+      ti_get_songs(&bc->builder,
                    NULL, artist, album,
                    bc->metadata_keys,
                    bc->filter_criteria,
@@ -966,7 +1033,7 @@ _browse_artists_branch(const gchar *artist,
         _build_object_id(TRACKER_SOURCE_MUSIC,
                          TRACKER_SOURCE_ARTISTS,
                          artist, NULL);
-      ti_get_albums(bc->builder,
+      ti_get_albums(&bc->builder,
                     NULL, artist,
                     bc->metadata_keys,
                     bc->filter_criteria,
@@ -983,7 +1050,7 @@ _browse_artists_branch(const gchar *artist,
         _build_object_id(TRACKER_SOURCE_MUSIC,
                          TRACKER_SOURCE_ARTISTS,
                          NULL);
-      ti_get_artists(bc->builder,
+      ti_get_artists(&bc->builder,
                      NULL,
                      bc->metadata_keys,
                      bc->filter_criteria,
@@ -1015,7 +1082,7 @@ _browse_genres_branch(const gchar *genre,
         _build_object_id(TRACKER_SOURCE_MUSIC,
                          TRACKER_SOURCE_GENRES,
                          genre, artist, album, NULL);
-      ti_get_songs(bc->builder,
+      ti_get_songs(&bc->builder,
                    genre, artist, album,
                    bc->metadata_keys,
                    bc->filter_criteria,
@@ -1032,7 +1099,7 @@ _browse_genres_branch(const gchar *genre,
         _build_object_id(TRACKER_SOURCE_MUSIC,
                          TRACKER_SOURCE_GENRES,
                          genre, artist, NULL);
-      ti_get_albums(bc->builder,
+      ti_get_albums(&bc->builder,
                     genre, artist,
                     bc->metadata_keys,
                     bc->filter_criteria,
@@ -1049,7 +1116,7 @@ _browse_genres_branch(const gchar *genre,
         _build_object_id(TRACKER_SOURCE_MUSIC,
                          TRACKER_SOURCE_GENRES,
                          genre, NULL);
-      ti_get_artists(bc->builder,
+      ti_get_artists(&bc->builder,
                      genre,
                      bc->metadata_keys,
                      bc->filter_criteria,
@@ -1066,7 +1133,7 @@ _browse_genres_branch(const gchar *genre,
         _build_object_id(TRACKER_SOURCE_MUSIC,
                          TRACKER_SOURCE_GENRES,
                          NULL);
-      ti_get_genres(bc->builder,
+      ti_get_genres(&bc->builder,
                     bc->metadata_keys,
                     bc->filter_criteria,
                     bc->sort_fields,
@@ -1088,7 +1155,7 @@ _browse_root(struct _browse_closure *bc)
     bc->object_id_prefix = _build_object_id(TRACKER_SOURCE_MUSIC,
                                             TRACKER_SOURCE_SONGS,
                                             NULL);
-    ti_get_songs(bc->builder,
+    ti_get_songs(&bc->builder,
                  NULL, NULL, NULL,
                  bc->metadata_keys,
                  bc->filter_criteria,
@@ -1134,7 +1201,7 @@ _browse_videos_branch(struct _browse_closure *bc)
   /* Browsing /videos */
   bc->object_id_prefix = _build_object_id(TRACKER_SOURCE_VIDEOS,
                                           NULL);
-  ti_get_videos(bc->builder,
+  ti_get_videos(&bc->builder,
                 bc->metadata_keys,
                 bc->filter_criteria,
                 bc->sort_fields,
@@ -1254,7 +1321,7 @@ _browse_playlists_branch(const gchar *playlist,
                        TRACKER_SOURCE_PLAYLISTS,
                        NULL);
 
-    ti_get_playlists(bc->builder,
+    ti_get_playlists(&bc->builder,
                      bc->metadata_keys,
                      bc->filter_criteria,
                      bc->sort_fields,
@@ -1279,12 +1346,13 @@ mafw_tracker_source_browse(MafwSource *self,
                            gpointer user_data)
 {
   gint browse_id = MAFW_SOURCE_INVALID_BROWSE_ID;
+  UtilPool *pool;
   struct _browse_closure *bc = NULL;
   CategoryType category;
   const gchar *const *meta_keys;
   gchar *album = NULL;
   gchar *artist = NULL;
-  gchar *clip = NULL;
+  UtilResource clip = UTIL_RESOURCE_INIT;
   gchar *genre = NULL;
 
   /* Handle preconditions */
@@ -1311,7 +1379,7 @@ mafw_tracker_source_browse(MafwSource *self,
     goto out;
   }
 
-  if ((clip != NULL) && (category != CATEGORY_MUSIC_PLAYLISTS))
+  if (util_resource_is_set(&clip) && (category != CATEGORY_MUSIC_PLAYLISTS))
   {
     _send_error(self, browse_cb,
                 MAFW_SOURCE_ERROR_INVALID_OBJECT_ID,
@@ -1335,13 +1403,16 @@ mafw_tracker_source_browse(MafwSource *self,
   browse_id = _get_next_browse_id(MAFW_TRACKER_SOURCE(self));
 
   /* Prepare browse operation */
-  bc = g_new0(struct _browse_closure, 1);
+  pool = util_pool_new();
+  bc = util_pool_new0(pool, struct _browse_closure);
+  bc->pool = pool;
   bc->source = self;
-  bc->object_id = g_strdup(object_id);
-  bc->metadata_keys = g_strdupv((gchar **)meta_keys);
+  bc->object_id = util_pool_strdup(pool, object_id);
+  bc->strings = g_string_chunk_new(RESULT_STRINGS_CHUNK_SIZE);
+  bc->metadata_keys = util_pool_strdupv(pool, (gchar **)meta_keys);
   bc->sort_fields = sort_criteria ? g_strsplit(sort_criteria, ",", 0) : NULL;
-  bc->builder = mafw_tracker_source_sparql_builder_new();
-  bc->filter_criteria = ti_create_filter(bc->builder, filter);
+  mafw_tracker_source_sparql_builder_init(&bc->builder);
+  bc->filter_criteria = ti_create_filter(&bc->builder, filter);
   bc->offset = skip_count;
   bc->count = item_count;
   bc->recursive = recursive;
@@ -1404,7 +1475,7 @@ mafw_tracker_source_browse(MafwSource *self,
 
     case CATEGORY_MUSIC_PLAYLISTS:
     {
-      if (!_browse_playlists_branch(clip, bc))
+      if (!_browse_playlists_branch(util_resource_get_uri(&clip), bc))
         browse_id = MAFW_SOURCE_INVALID_BROWSE_ID;
 
       break;
@@ -1421,7 +1492,7 @@ out:
   g_free(genre);
   g_free(artist);
   g_free(album);
-  g_free(clip);
+  util_resource_clear(&clip);
 
   return browse_id;
 }
@@ -1492,20 +1563,21 @@ _get_playlist_duration_cb(MafwSource *self,
     /* The calculation of the playlist duration has finished.
        Now "pls_duration" contains the final value. */
     GHashTable *duration_metadata = NULL;
-    gchar *pls_uri = NULL;
+    UtilResource pls = UTIL_RESOURCE_INIT;
 
     util_extract_category_info(duration_bc->object_id,
                                NULL,
                                NULL,
                                NULL,
-                               &pls_uri);
+                               &pls);
 
     /* Store the new duration in Tracker. */
-    if (pls_uri)
+    if (util_resource_is_set(&pls))
     {
       /* It's a playlist, not the playlists category. */
-      ti_set_playlist_duration(pls_uri, duration_bc->pls_duration);
-      g_free(pls_uri);
+      ti_set_playlist_duration(util_resource_get_uri(&pls),
+                               duration_bc->pls_duration);
+      util_resource_clear(&pls);
     }
 
     /* Create the result adding the duration. */
@@ -31,11 +31,35 @@
 #include "mafw-tracker-source.h"
 
 #include "definitions.h"
+#include "tracker-cache.h"
 #include "tracker-iface.h"
 #include "util.h"
 
+/* How many browsed clips to keep the metadata of, see
+ * mafw_tracker_source_cache_metadata() */
+#ifndef METADATA_CACHE_SIZE
+#define METADATA_CACHE_SIZE 256
+#endif
+
+/* How many clips unknown to tracker to remember, see
+ * mafw_tracker_source_add_untracked() */
+#ifndef UNTRACKED_CLIPS_SIZE
+#define UNTRACKED_CLIPS_SIZE 1024
+#endif
+
+struct _cached_metadata
+{
+  gchar *object_id;
+  GHashTable *metadata;
+  /* Keys the browse asked for, shared by the clips it returned. Those not
+   * in metadata are known to be empty. */
+  GHashTable *keys;
+};
+
 struct _metadatas_common_closure
 {
+  /* Memory of the request: this structure, the closures and the keys */
+  UtilPool *pool;
   /* Source instance */
   MafwSource *source;
   /* Metadata keys requested */
@@ -76,6 +100,18 @@ struct _metadata_closure
   gpointer user_data;
 };
 
+/* get_metadata calls asking for the same keys in the same main loop
+ * iteration, run as a single get_metadatas */
+struct _metadata_batch
+{
+  /* Source instance */
+  MafwSource *source;
+  /* Metadata keys requested */
+  gchar **metadata_keys;
+  /* The calls, as _metadata_closure, last one first */
+  GList *closures;
+};
+
 struct _update_metadata_closure
 {
   /* Source instance */
@@ -89,7 +125,7 @@ struct _update_metadata_closure
   /* User data for callback */
   gpointer user_data;
   /* The clip to be updated */
-  gchar *clip;
+  UtilResource clip;
   CategoryType category;
 };
 
@@ -97,6 +133,25 @@ typedef gboolean (*_GetMetadataFunc)(struct _metadatas_closure *mc,
                                      GList *child,
                                      GError **error);
 
+static void
+_cached_metadata_free(struct _cached_metadata *cm)
+{
+  mafw_metadata_release(cm->metadata);
+  g_hash_table_unref(cm->keys);
+  g_free(cm->object_id);
+  g_free(cm);
+}
+
+static void
+_remove_cached_metadata(MafwTrackerSourcePrivate *priv, GList *link)
+{
+  struct _cached_metadata *cm = link->data;
+
+  g_hash_table_remove(priv->metadata_cache, cm->object_id);
+  g_queue_delete_link(&priv->metadata_lru, link);
+  _cached_metadata_free(cm);
+}
+
 static void
 _metadatas_closure_free(gpointer data)
 {
@@ -104,9 +159,6 @@ _metadatas_closure_free(gpointer data)
 
   mcc = (struct _metadatas_common_closure *)data;
 
-  /* Free metadata keys */
-  g_strfreev(mcc->metadata_keys);
-
   /* Free metadatas */
   g_hash_table_unref(mcc->metadatas);
 
@@ -116,8 +168,8 @@ _metadatas_closure_free(gpointer data)
     g_error_free(mcc->error);
   }
 
-  /* Free common structure */
-  g_free(mcc);
+  /* Free common structure, closures and keys */
+  util_pool_free(mcc->pool);
 }
 
 static gboolean
@@ -170,8 +222,7 @@ _get_metadata_tracker_cb(GHashTable *result,
   if (mc->common->remaining == 0)
     _emit_metadatas_results(mc->common);
 
-  /* Free closure */
-  g_free(mc);
+  /* The closure is released with the common one */
 }
 
 static void
@@ -203,8 +254,15 @@ _get_metadatas_tracker_cb(GList *results,
 
   while (current_obj && current_result)
   {
-    /* Check there's a hashtable for this object id */
-    if (current_result->data)
+    /* Tracker does not have the clip */
+    if (!current_result->data)
+    {
+      mafw_tracker_source_add_untracked(
+        MAFW_TRACKER_SOURCE(mc->common->source), current_obj->data);
+    }
+
+    /* Check there's some metadata for this object id */
+    if (current_result->data && g_hash_table_size(current_result->data))
     {
       g_hash_table_insert(mc->common->metadatas,
                           current_obj->data,
@@ -224,7 +282,6 @@ _get_metadatas_tracker_cb(GList *results,
 
   /* Free closure */
   g_list_free(mc->object_ids);
-  g_free(mc);
 }
 
 static gboolean
@@ -233,7 +290,7 @@ _calculate_duration_is_needed(GHashTable *metadata,
                               const gchar *object_id)
 {
   CategoryType category;
-  gchar *pls_uri = NULL;
+  UtilResource pls;
   gboolean calculate = FALSE;
 
   if (util_is_duration_requested((const gchar **)metadata_keys))
@@ -242,15 +299,15 @@ _calculate_duration_is_needed(GHashTable *metadata,
                                           NULL,
                                           NULL,
                                           NULL,
-                                          &pls_uri);
+                                          &pls);
 
     if (category == CATEGORY_MUSIC_PLAYLISTS)
     {
-      if (pls_uri)
+      if (util_resource_is_set(&pls))
       {
         /* Single playlist. */
         calculate = util_calculate_playlist_duration_is_needed(metadata);
-        g_free(pls_uri);
+        util_resource_clear(&pls);
       }
       else
       {
@@ -296,9 +353,9 @@ _add_playlist_duration_cb(MafwSource *self,
         g_value_set_int(gval, pls_duration);
       else
       {
-        mafw_metadata_add_int(pls_mc->metadata_value,
-                              MAFW_METADATA_KEY_DURATION,
-                              pls_duration);
+        tracker_cache_metadata_add_int(pls_mc->metadata_value,
+                                       MAFW_METADATA_KEY_DURATION,
+                                       pls_duration);
       }
     }
   }
@@ -369,7 +426,6 @@ _get_metadatas_tracker_from_playlist_cb(GList *results,
     /* Free closure */
     g_list_foreach(mc->object_ids, (GFunc)g_free, NULL);
     g_list_free(mc->object_ids);
-    g_free(mc);
 
     return;
   }
@@ -381,12 +437,21 @@ _get_metadatas_tracker_from_playlist_cb(GList *results,
 
   while (current_obj && current_result)
   {
-    if (_calculate_duration_is_needed(current_result->data,
+    if (!current_result->data || !g_hash_table_size(current_result->data))
+    {
+      /* Nothing known about this playlist */
+      g_free(current_obj->data);
+      mc->common->remaining--;
+
+      if (mc->common->remaining == 0)
+        _emit_metadatas_results(mc->common);
+    }
+    else if (_calculate_duration_is_needed(current_result->data,
                                       mc->common->metadata_keys,
                                       current_obj->data))
     {
       /* Create a new closure to store data */
-      nmc = g_new0(struct _metadatas_closure, 1);
+      nmc = util_pool_new0(mc->common->pool, struct _metadatas_closure);
       nmc->object_id = current_obj->data;
       nmc->metadata_value = g_hash_table_ref(current_result->data);
       nmc->common = mc->common;
@@ -420,7 +485,6 @@ _get_metadatas_tracker_from_playlist_cb(GList *results,
   /* The elements of the object_ids list were added to the metadatas
      results and will be released when freeing the common closure. */
   g_list_free(mc->object_ids);
-  g_free(mc);
 }
 
 static void
@@ -534,6 +598,131 @@ _get_metadata_cb(MafwSource *source,
   g_free(mc);
 }
 
+static void
+_get_metadata_batch_cb(MafwSource *source,
+                       GHashTable *metadatas,
+                       gpointer user_data,
+                       const GError *error)
+{
+  struct _metadata_batch *batch = user_data;
+  GList *iter;
+
+  for (iter = batch->closures; iter; iter = g_list_next(iter))
+  {
+    struct _metadata_closure *mc = iter->data;
+    GHashTable *metadata = NULL;
+
+    if (metadatas)
+      metadata = g_hash_table_lookup(metadatas, mc->object_id);
+
+    /* An error only concerns the calls left without metadata */
+    mc->cb(source,
+           mc->object_id,
+           metadata,
+           mc->user_data,
+           metadata ? NULL : error);
+
+    g_free(mc->object_id);
+    g_free(mc);
+  }
+
+  g_list_free(batch->closures);
+  g_strfreev(batch->metadata_keys);
+  g_free(batch);
+}
+
+static void
+_run_metadata_batch(gpointer key, gpointer value, gpointer user_data)
+{
+  struct _metadata_batch *batch = value;
+  GHashTable *seen;
+  const gchar **object_ids;
+  GList *iter;
+  guint n = 0;
+
+  /* Answer the calls in the order they were made */
+  batch->closures = g_list_reverse(batch->closures);
+
+  seen = g_hash_table_new(g_str_hash, g_str_equal);
+  object_ids = g_new(const gchar *, g_list_length(batch->closures) + 1);
+
+  for (iter = batch->closures; iter; iter = g_list_next(iter))
+  {
+    struct _metadata_closure *mc = iter->data;
+
+    if (g_hash_table_add(seen, mc->object_id))
+      object_ids[n++] = mc->object_id;
+  }
+
+  object_ids[n] = NULL;
+
+  mafw_tracker_source_get_metadatas(batch->source,
+                                    object_ids,
+                                    (const gchar *const *)batch->metadata_keys,
+                                    _get_metadata_batch_cb,
+                                    batch);
+
+  g_free(object_ids);
+  g_hash_table_destroy(seen);
+}
+
+static gboolean
+_run_pending_metadata(gpointer data)
+{
+  MafwTrackerSource *source = data;
+  GHashTable *pending = source->priv->pending_metadata;
+
+  source->priv->pending_metadata = NULL;
+  source->priv->pending_metadata_id = 0;
+
+  g_hash_table_foreach(pending, _run_metadata_batch, NULL);
+  g_hash_table_destroy(pending);
+
+  return FALSE;
+}
+
+/* Queues the call to be run with the others for the same keys */
+static void
+_add_pending_metadata(MafwTrackerSource *source,
+                      struct _metadata_closure *mc,
+                      const gchar *const *metadata_keys)
+{
+  MafwTrackerSourcePrivate *priv = source->priv;
+  struct _metadata_batch *batch;
+  gchar *keys_id;
+
+  if (!priv->pending_metadata)
+  {
+    priv->pending_metadata = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                   g_free, NULL);
+  }
+
+  keys_id = metadata_keys ? g_strjoinv(",", (gchar **)metadata_keys) :
+                            g_strdup("");
+  batch = g_hash_table_lookup(priv->pending_metadata, keys_id);
+
+  if (!batch)
+  {
+    batch = g_new0(struct _metadata_batch, 1);
+    batch->source = MAFW_SOURCE(source);
+    batch->metadata_keys = g_strdupv((gchar **)metadata_keys);
+    g_hash_table_insert(priv->pending_metadata, keys_id, batch);
+  }
+  else
+    g_free(keys_id);
+
+  batch->closures = g_list_prepend(batch->closures, mc);
+
+  /* The source is kept alive until the queued calls are run */
+  if (!priv->pending_metadata_id)
+  {
+    priv->pending_metadata_id = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                                                _run_pending_metadata,
+                                                g_object_ref(source),
+                                                g_object_unref);
+  }
+}
+
 static gchar **
 _get_keys(GHashTable *metadata)
 {
@@ -570,7 +759,11 @@ _update_metadata_idle(gpointer data)
 
   umc = (struct _update_metadata_closure *)data;
 
-  non_updated_keys = ti_set_metadata(umc->clip, umc->metadata,
+  mafw_tracker_source_invalidate_metadata(MAFW_TRACKER_SOURCE(umc->source),
+                                          umc->object_id);
+
+  non_updated_keys = ti_set_metadata(util_resource_get_uri(&umc->clip),
+                                     umc->metadata,
                                      umc->category, &updated, &error);
 
   if (non_updated_keys && !error)
@@ -603,7 +796,7 @@ _update_metadata_idle(gpointer data)
 
   g_hash_table_unref(umc->metadata);
   g_free(umc->object_id);
-  g_free(umc->clip);
+  util_resource_clear(&umc->clip);
   g_free(umc);
   g_strfreev(non_updated_keys);
 
@@ -627,6 +820,17 @@ mafw_tracker_source_get_metadata(MafwSource *self,
   mc->cb = metadata_cb;
   mc->user_data = user_data;
 
+  /* Calls made in a row, like one per visible row of a view, share a single
+   * query. Invalid ids are answered on their own so that their error does
+   * not reach the others. */
+  if (object_id &&
+      (util_extract_category_info(object_id, NULL, NULL, NULL, NULL) !=
+       CATEGORY_ERROR))
+  {
+    _add_pending_metadata(MAFW_TRACKER_SOURCE(self), mc, metadata_keys);
+    return;
+  }
+
   object_ids = g_new0(gchar *, 2);
   object_ids[0] = mc->object_id;
 
@@ -638,6 +842,325 @@ mafw_tracker_source_get_metadata(MafwSource *self,
   g_free(object_ids);
 }
 
+/*
+ * Keeps the metadata of browsed clips, so that a get_metadata(s) asking for
+ * keys already got is not sent to tracker. Only the first rows are kept,
+ * those are the ones shown first. @metadata_keys are the keys the browse
+ * asked for, already expanded.
+ */
+void
+mafw_tracker_source_cache_metadata(MafwTrackerSource *self,
+                                   gchar **metadata_keys,
+                                   GList *object_ids,
+                                   GList *metadata_values)
+{
+  MafwTrackerSourcePrivate *priv = self->priv;
+  struct _cached_metadata *cm;
+  GHashTable *keys;
+  GList *link;
+  guint n;
+  gint i;
+
+  if (!priv->metadata_cache)
+    priv->metadata_cache = g_hash_table_new(g_str_hash, g_str_equal);
+
+  keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; metadata_keys[i]; i++)
+    g_hash_table_add(keys, g_strdup(metadata_keys[i]));
+
+  for (n = 0; object_ids && metadata_values && (n < METADATA_CACHE_SIZE);
+       object_ids = object_ids->next, metadata_values = metadata_values->next)
+  {
+    if (!object_ids->data || !metadata_values->data)
+      continue;
+
+    link = g_hash_table_lookup(priv->metadata_cache, object_ids->data);
+
+    if (link)
+      _remove_cached_metadata(priv, link);
+
+    cm = g_new(struct _cached_metadata, 1);
+    cm->object_id = g_strdup(object_ids->data);
+    cm->metadata = g_hash_table_ref(metadata_values->data);
+    cm->keys = g_hash_table_ref(keys);
+    g_queue_push_head(&priv->metadata_lru, cm);
+    g_hash_table_insert(priv->metadata_cache, cm->object_id,
+                        priv->metadata_lru.head);
+    n++;
+  }
+
+  g_hash_table_unref(keys);
+
+  while (priv->metadata_lru.length > METADATA_CACHE_SIZE)
+    _remove_cached_metadata(priv, priv->metadata_lru.tail);
+}
+
+/* Adds to @metadata every value of @key in @cached */
+static void
+_copy_cached_values(GHashTable *metadata, GHashTable *cached,
+                    const gchar *key)
+{
+  GValue *value = g_hash_table_lookup(cached, key);
+  GValueArray *values;
+  guint i;
+
+  if (!G_VALUE_HOLDS(value, G_TYPE_VALUE_ARRAY))
+  {
+    mafw_metadata_add_val(metadata, key, value);
+    return;
+  }
+
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  values = g_value_get_boxed(value);
+
+  for (i = 0; i < values->n_values; i++)
+    mafw_metadata_add_val(metadata, key, g_value_array_get_nth(values, i));
+  G_GNUC_END_IGNORE_DEPRECATIONS
+}
+
+/* Returns a copy of the requested keys of @object_id, or NULL if some of
+ * them is not cached. Keys the browse asked for and did not get are left
+ * out, as tracker has nothing for them. */
+GHashTable *
+mafw_tracker_source_lookup_metadata(MafwTrackerSource *self,
+                                    const gchar *object_id,
+                                    gchar **metadata_keys)
+{
+  MafwTrackerSourcePrivate *priv = self->priv;
+  struct _cached_metadata *cm;
+  GHashTable *metadata;
+  GList *link;
+  gint i;
+
+  if (!priv->metadata_cache)
+    return NULL;
+
+  link = g_hash_table_lookup(priv->metadata_cache, object_id);
+
+  if (!link)
+    return NULL;
+
+  cm = link->data;
+
+  for (i = 0; metadata_keys[i]; i++)
+  {
+    if (!g_hash_table_contains(cm->keys, metadata_keys[i]) &&
+        !g_hash_table_contains(cm->metadata, metadata_keys[i]))
+    {
+      return NULL;
+    }
+  }
+
+  g_queue_unlink(&priv->metadata_lru, link);
+  g_queue_push_head_link(&priv->metadata_lru, link);
+
+  metadata = mafw_metadata_new();
+
+  for (i = 0; metadata_keys[i]; i++)
+  {
+    if (g_hash_table_contains(cm->metadata, metadata_keys[i]))
+      _copy_cached_values(metadata, cm->metadata, metadata_keys[i]);
+  }
+
+  return metadata;
+}
+
+/* Forgets the cached metadata of @object_id. If NULL, forgets all of it,
+ * and the clips known to be missing in tracker too. */
+void
+mafw_tracker_source_invalidate_metadata(MafwTrackerSource *self,
+                                        const gchar *object_id)
+{
+  MafwTrackerSourcePrivate *priv = self->priv;
+  GList *link;
+
+  if (!object_id && priv->untracked_clips)
+    g_hash_table_remove_all(priv->untracked_clips);
+
+  if (!priv->metadata_cache)
+    return;
+
+  if (object_id)
+  {
+    link = g_hash_table_lookup(priv->metadata_cache, object_id);
+
+    if (link)
+      _remove_cached_metadata(priv, link);
+  }
+  else
+  {
+    while (priv->metadata_lru.head)
+      _remove_cached_metadata(priv, priv->metadata_lru.head);
+  }
+}
+
+/*
+ * Remembers that tracker has no metadata for @object_id, a local entry of a
+ * playlist, until tracker tells about some change. Playlists are browsed
+ * again and again, often with entries in places not indexed.
+ */
+void
+mafw_tracker_source_add_untracked(MafwTrackerSource *self,
+                                  const gchar *object_id)
+{
+  MafwTrackerSourcePrivate *priv = self->priv;
+
+  if (!priv->untracked_clips)
+  {
+    priv->untracked_clips = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  g_free, NULL);
+  }
+  else if (g_hash_table_size(priv->untracked_clips) >= UNTRACKED_CLIPS_SIZE)
+    g_hash_table_remove_all(priv->untracked_clips);
+
+  g_hash_table_add(priv->untracked_clips, g_strdup(object_id));
+}
+
+gboolean
+mafw_tracker_source_is_untracked(MafwTrackerSource *self,
+                                 const gchar *object_id)
+{
+  MafwTrackerSourcePrivate *priv = self->priv;
+
+  return priv->untracked_clips &&
+         g_hash_table_contains(priv->untracked_clips, object_id);
+}
+
+/* Artists, albums or genres below the same parents, whose metadata is got
+ * with a single query */
+struct _category_group
+{
+  const gchar *leaf_key;
+  gchar *genre;
+  gchar *artist;
+  GPtrArray *values;
+  GPtrArray *closures;
+};
+
+/* Known artists, albums and genres are asked for together with the others
+ * below the same parents. Returns FALSE for a category or an unknown value,
+ * which are asked for on their own. */
+static gboolean
+_add_to_category_groups(UtilPool *pool,
+                        GPtrArray **groups,
+                        const gchar *genre,
+                        const gchar *artist,
+                        const gchar *album,
+                        struct _metadatas_closure *mc)
+{
+  struct _category_group *group = NULL;
+  const gchar *leaf_key;
+  const gchar *leaf;
+  guint i;
+
+  if (album)
+  {
+    leaf_key = MAFW_METADATA_KEY_ALBUM;
+    leaf = album;
+  }
+  else if (artist)
+  {
+    leaf_key = MAFW_METADATA_KEY_ARTIST;
+    leaf = artist;
+    artist = NULL;
+  }
+  else
+  {
+    leaf_key = MAFW_METADATA_KEY_GENRE;
+    leaf = genre;
+    genre = NULL;
+  }
+
+  if (!leaf || !*leaf)
+    return FALSE;
+
+  if (!*groups)
+    *groups = g_ptr_array_new();
+
+  for (i = 0; i < (*groups)->len; i++)
+  {
+    struct _category_group *g = g_ptr_array_index(*groups, i);
+
+    if (!strcmp(g->leaf_key, leaf_key) && !g_strcmp0(g->genre, genre) &&
+        !g_strcmp0(g->artist, artist))
+    {
+      group = g;
+      break;
+    }
+  }
+
+  if (!group)
+  {
+    group = util_pool_new0(pool, struct _category_group);
+    group->leaf_key = leaf_key;
+    group->genre = util_pool_strdup(pool, genre);
+    group->artist = util_pool_strdup(pool, artist);
+    group->values = g_ptr_array_new();
+    group->closures = g_ptr_array_new();
+    g_ptr_array_add(*groups, group);
+  }
+
+  g_ptr_array_add(group->values, util_pool_strdup(pool, leaf));
+  g_ptr_array_add(group->closures, mc);
+
+  return TRUE;
+}
+
+static void
+_run_category_groups(GPtrArray *groups, gchar **keys)
+{
+  guint i;
+
+  for (i = 0; i < groups->len; i++)
+  {
+    struct _category_group *group = g_ptr_array_index(groups, i);
+
+    if (group->values->len == 1)
+    {
+      const gchar *leaf = g_ptr_array_index(group->values, 0);
+      const gchar *genre = group->genre;
+      const gchar *artist = group->artist;
+      const gchar *album = NULL;
+
+      if (!strcmp(group->leaf_key, MAFW_METADATA_KEY_ALBUM))
+        album = leaf;
+      else if (!strcmp(group->leaf_key, MAFW_METADATA_KEY_ARTIST))
+        artist = leaf;
+      else
+        genre = leaf;
+
+      ti_get_metadata_from_category(genre, artist, album, group->leaf_key,
+                                    NULL, keys, _get_metadata_tracker_cb,
+                                    g_ptr_array_index(group->closures, 0));
+    }
+    else
+    {
+      g_ptr_array_add(group->values, NULL);
+      ti_get_metadata_from_categories(group->genre, group->artist,
+                                      group->leaf_key,
+                                      (gchar **)group->values->pdata,
+                                      keys, _get_metadata_tracker_cb,
+                                      group->closures->pdata);
+    }
+
+    g_ptr_array_free(group->values, TRUE);
+    g_ptr_array_free(group->closures, TRUE);
+  }
+
+  g_ptr_array_free(groups, TRUE);
+}
+
+static GArray *
+_clip_array_new(void)
+{
+  GArray *clips = g_array_new(FALSE, FALSE, sizeof(UtilResource));
+
+  g_array_set_clear_func(clips, (GDestroyNotify)util_resource_clear);
+
+  return clips;
+}
+
 void
 mafw_tracker_source_get_metadatas(MafwSource *self,
                                   const gchar **object_ids,
@@ -650,33 +1173,36 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
   gchar **meta_keys;
   gchar *album = NULL;
   gchar *artist = NULL;
-  gchar *clip = NULL;
-  gchar **clips = NULL;
+  UtilResource clip;
   gchar **playlist_metadata_keys = NULL;
   gchar *genre = NULL;
+  UtilPool *pool;
   struct _metadatas_common_closure *mcc = NULL;
   struct _metadatas_closure *mc = NULL;
   struct _metadatas_closure *video_mc = NULL;
   struct _metadatas_closure *audio_mc = NULL;
   struct _metadatas_closure *playlist_mc = NULL;
-  GList *video_clips = NULL;
-  GList *audio_clips = NULL;
-  GList *playlist_clips = NULL;
+  GArray *video_clips = NULL;
+  GArray *audio_clips = NULL;
+  GArray *playlist_clips = NULL;
+  GPtrArray *category_groups = NULL;
   gint i;
 
   g_return_if_fail(MAFW_IS_TRACKER_SOURCE(self));
 
-  mcc = g_new0(struct _metadatas_common_closure, 1);
+  pool = util_pool_new();
+  mcc = util_pool_new0(pool, struct _metadatas_common_closure);
+  mcc->pool = pool;
 
   if (mafw_source_all_keys(metadata_keys))
   {
     gchar **keys = (gchar **)MAFW_SOURCE_LIST(KNOWN_METADATA_KEYS);
 
-    mcc->metadata_keys = g_strdupv(keys);
+    mcc->metadata_keys = util_pool_strdupv(pool, keys);
   }
   else
   {
-    mcc->metadata_keys = g_strdupv((gchar **)metadata_keys);
+    mcc->metadata_keys = util_pool_strdupv(pool, (gchar **)metadata_keys);
   }
 
   meta_keys = mcc->metadata_keys;
@@ -711,12 +1237,27 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
 
   while (object_ids[i])
   {
+    GHashTable *cached;
+
+    cached = mafw_tracker_source_lookup_metadata(MAFW_TRACKER_SOURCE(self),
+                                                 object_ids[i], meta_keys);
+
+    if (cached)
+    {
+      mc = util_pool_new0(pool, struct _metadatas_closure);
+      mc->object_id = g_strdup(object_ids[i]);
+      mc->common = mcc;
+      _get_metadata_tracker_cb(cached, NULL, mc);
+      i++;
+      continue;
+    }
+
     category = util_extract_category_info(object_ids[i], &genre, &artist,
                                           &album, &clip);
 
     if (category == CATEGORY_ERROR)
     {
-      mc = g_new0(struct _metadatas_closure, 1);
+      mc = util_pool_new0(pool, struct _metadatas_closure);
       mc->object_id = g_strdup(object_ids[i]);
       mc->common = mcc;
 
@@ -726,7 +1267,7 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
 
       _get_metadata_tracker_cb(NULL, error, mc);
     }
-    else if (clip)
+    else if (util_resource_is_set(&clip))
     {
       /* Accumulate clips for later processing */
       switch (category)
@@ -735,32 +1276,35 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
         {
           if (!video_mc)
           {
-            video_mc = g_new0(struct _metadatas_closure, 1);
+            video_mc = util_pool_new0(pool, struct _metadatas_closure);
             video_mc->common = mcc;
+            video_clips = _clip_array_new();
           }
 
           video_mc->object_ids = g_list_prepend(video_mc->object_ids,
                                                 g_strdup(object_ids[i]));
-          video_clips = g_list_prepend(video_clips, clip);
+          g_array_append_val(video_clips, clip);
           break;
         }
         case CATEGORY_MUSIC_PLAYLISTS:
         {
           if (!playlist_mc)
           {
-            playlist_mc = g_new0(struct _metadatas_closure, 1);
+            playlist_mc = util_pool_new0(pool, struct _metadatas_closure);
             playlist_mc->common = mcc;
 
             /* If duration is required, then we need
              * to add a new key in order to check if
              * duration is right or need to be
              * calculated */
-            playlist_metadata_keys = g_strdupv(mcc->metadata_keys);
+            playlist_metadata_keys = util_pool_strdupv(pool,
+                                                       mcc->metadata_keys);
+            playlist_clips = _clip_array_new();
           }
 
           playlist_mc->object_ids = g_list_prepend(playlist_mc->object_ids,
                                                    g_strdup(object_ids[i]));
-          playlist_clips = g_list_prepend(playlist_clips, clip);
+          g_array_append_val(playlist_clips, clip);
 
           break;
         }
@@ -768,20 +1312,21 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
         {
           if (!audio_mc)
           {
-            audio_mc = g_new0(struct _metadatas_closure, 1);
+            audio_mc = util_pool_new0(pool, struct _metadatas_closure);
             audio_mc->common = mcc;
+            audio_clips = _clip_array_new();
           }
 
           audio_mc->object_ids = g_list_prepend(audio_mc->object_ids,
                                                 g_strdup(object_ids[i]));
-          audio_clips = g_list_prepend(audio_clips, clip);
+          g_array_append_val(audio_clips, clip);
           break;
         }
       }
     }
     else
     {
-      mc = g_new0(struct _metadatas_closure, 1);
+      mc = util_pool_new0(pool, struct _metadatas_closure);
       mc->object_id = g_strdup(object_ids[i]);
       mc->common = mcc;
 
@@ -816,6 +1361,10 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
 
         case CATEGORY_MUSIC_ARTISTS:
         {
+          if (_add_to_category_groups(pool, &category_groups,
+                                      genre, artist, album, mc))
+            break;
+
           ti_get_metadata_from_category(genre, artist, album,
                                         MAFW_METADATA_KEY_ARTIST,
                                         ROOT_MUSIC_ARTISTS_TITLE,
@@ -826,6 +1375,10 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
         }
         case CATEGORY_MUSIC_ALBUMS:
         {
+          if (_add_to_category_groups(pool, &category_groups,
+                                      genre, artist, album, mc))
+            break;
+
           ti_get_metadata_from_category(genre, artist, album,
                                         MAFW_METADATA_KEY_ALBUM,
                                         ROOT_MUSIC_ALBUMS_TITLE,
@@ -837,6 +1390,10 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
 
         case CATEGORY_MUSIC_GENRES:
         {
+          if (_add_to_category_groups(pool, &category_groups,
+                                      genre, artist, album, mc))
+            break;
+
           ti_get_metadata_from_category(genre, artist, album,
                                         MAFW_METADATA_KEY_GENRE,
                                         ROOT_MUSIC_GENRES_TITLE,
@@ -885,36 +1442,36 @@ mafw_tracker_source_get_metadatas(MafwSource *self,
     i++;
   }
 
+  if (category_groups)
+    _run_category_groups(category_groups, mcc->metadata_keys);
+
+  /* The clips were appended, the object ids prepended */
   if (audio_mc)
   {
-    clips = util_list_to_strv(audio_clips);
-    ti_get_metadata_from_audioclip(clips, mcc->metadata_keys,
+    audio_mc->object_ids = g_list_reverse(audio_mc->object_ids);
+    ti_get_metadata_from_audioclip(audio_clips, mcc->metadata_keys,
                                    _get_metadatas_tracker_cb,
                                    audio_mc);
-    g_strfreev(clips);
-    g_list_free(audio_clips);
+    g_array_unref(audio_clips);
   }
 
   if (video_mc)
   {
-    clips = util_list_to_strv(video_clips);
-    ti_get_metadata_from_videoclip(clips, mcc->metadata_keys,
+    video_mc->object_ids = g_list_reverse(video_mc->object_ids);
+    ti_get_metadata_from_videoclip(video_clips, mcc->metadata_keys,
                                    _get_metadatas_tracker_cb,
                                    video_mc);
-    g_strfreev(clips);
-    g_list_free(video_clips);
+    g_array_unref(video_clips);
   }
 
   if (playlist_mc)
   {
-    clips = util_list_to_strv(playlist_clips);
-    ti_get_metadata_from_playlist(clips,
+    playlist_mc->object_ids = g_list_reverse(playlist_mc->object_ids);
+    ti_get_metadata_from_playlist(playlist_clips,
                                   playlist_metadata_keys,
                                   _get_metadatas_tracker_from_playlist_cb,
                                   playlist_mc);
-    g_strfreev(clips);
-    g_list_free(playlist_clips);
-    g_strfreev(playlist_metadata_keys);
+    g_array_unref(playlist_clips);
   }
 }
 
@@ -926,7 +1483,7 @@ mafw_tracker_source_set_metadata(MafwSource *self,
                                  gpointer user_data)
 {
   GError *error = NULL;
-  gchar *clip = NULL;
+  UtilResource clip;
   gchar **failed_keys;
   CategoryType category;
 
@@ -968,7 +1525,7 @@ mafw_tracker_source_set_metadata(MafwSource *self,
   category = util_extract_category_info(object_id, NULL,
                                         NULL, NULL, &clip);
 
-  if ((clip) && (category != CATEGORY_MUSIC_PLAYLISTS))
+  if (util_resource_is_set(&clip) && (category != CATEGORY_MUSIC_PLAYLISTS))
   {
     _update_metadata_data = g_new0(struct _update_metadata_closure, 1);
     _update_metadata_data->source = self;
@@ -996,5 +1553,6 @@ mafw_tracker_source_set_metadata(MafwSource *self,
 
     g_strfreev(failed_keys);
     g_error_free(error);
+    util_resource_clear(&clip);
   }
 }
@@ -21,118 +21,111 @@
 
 #include "key-mapping.h"
 
-#include <stdio.h>
+#include <string.h>
 
-struct _MafwTrackerSourceSparqlBuilder
+void
+mafw_tracker_source_sparql_builder_init(
+    MafwTrackerSourceSparqlBuilder *builder)
 {
-  GObject parent;
-};
+  memset(builder, 0, sizeof(MafwTrackerSourceSparqlBuilder));
+}
 
-struct _MafwTrackerSourceSparqlBuilderClass
+static void
+_clear_values(MafwTrackerSourceSparqlBuilder *builder)
 {
-  GObjectClass parent_class;
-};
+  guint i;
 
-typedef struct _MafwTrackerSourceSparqlBuilderPrivate \
-    MafwTrackerSourceSparqlBuilderPrivate;
+  for (i = 0; i < MIN(builder->val_idx, SPARQL_BUILDER_INLINE_VALUES); i++)
+  {
+    g_free(builder->values[i]);
+    builder->values[i] = NULL;
+  }
 
-struct _MafwTrackerSourceSparqlBuilderPrivate
-{
-  unsigned int val_idx;
-  char *val_buffer;
-  unsigned int var_idx;
-  char *var_buffer;
-  GHashTable *values;
-};
-
-G_DEFINE_TYPE_WITH_PRIVATE(
-  MafwTrackerSourceSparqlBuilder,
-  mafw_tracker_source_sparql_builder,
-  G_TYPE_OBJECT
-);
-
-#define PRIVATE(builder) \
-  mafw_tracker_source_sparql_builder_get_instance_private( \
-    (MafwTrackerSourceSparqlBuilder *)(builder))
+  if (builder->more_values)
+    g_ptr_array_set_size(builder->more_values, 0);
+}
 
-static void
-mafw_tracker_source_sparql_builder_dispose(GObject *object)
+/* Forgets variables and values, so the builder can be used for an
+ * unrelated query. The buffers are kept. */
+void
+mafw_tracker_source_sparql_builder_reset(
+    MafwTrackerSourceSparqlBuilder *builder)
 {
-  MafwTrackerSourceSparqlBuilderPrivate *priv = PRIVATE(object);
-
-  g_hash_table_remove_all(priv->values);
-
-  G_OBJECT_CLASS(mafw_tracker_source_sparql_builder_parent_class)->
-      dispose(object);
+  _clear_values(builder);
+  builder->var_idx = 0;
+  builder->val_idx = 0;
 }
 
-static void
-mafw_tracker_source_sparql_builder_finalize(GObject *object)
+void
+mafw_tracker_source_sparql_builder_clear(
+    MafwTrackerSourceSparqlBuilder *builder)
 {
-  MafwTrackerSourceSparqlBuilderPrivate *priv = PRIVATE(object);
+  _clear_values(builder);
 
-  g_hash_table_destroy(priv->values);
-  g_free(priv->val_buffer);
-  g_free(priv->var_buffer);
+  if (builder->more_values)
+    g_ptr_array_free(builder->more_values, TRUE);
 
-  G_OBJECT_CLASS(mafw_tracker_source_sparql_builder_parent_class)->
-      finalize(object);
-}
+  if (builder->select)
+    g_string_free(builder->select, TRUE);
 
-static void
-mafw_tracker_source_sparql_builder_class_init(
-    MafwTrackerSourceSparqlBuilderClass *klass)
-{
-  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+  if (builder->where)
+    g_string_free(builder->where, TRUE);
 
-  object_class->dispose = mafw_tracker_source_sparql_builder_dispose;
-  object_class->finalize = mafw_tracker_source_sparql_builder_finalize;
-}
+  if (builder->tail)
+    g_string_free(builder->tail, TRUE);
 
-static void
-mafw_tracker_source_sparql_builder_init(MafwTrackerSourceSparqlBuilder *self)
-{
-  MafwTrackerSourceSparqlBuilderPrivate *priv = PRIVATE(self);
+  if (builder->query)
+    g_string_free(builder->query, TRUE);
 
-  priv->val_buffer = g_new(char, 13);
-  priv->var_buffer = g_new(char, 13);
-  priv->val_idx = 0;
-  priv->var_idx = 0;
-  priv->values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  mafw_tracker_source_sparql_builder_init(builder);
 }
 
-MafwTrackerSourceSparqlBuilder *
-mafw_tracker_source_sparql_builder_new()
+/* Returns the buffer, emptied and set to @init */
+static GString *
+_buffer(GString **buffer, const gchar *init)
 {
-  return g_object_new(MAFW_TRACKER_SOURCE_TYPE_SPARQL_BUILDER, NULL);
+  if (*buffer)
+    g_string_assign(*buffer, init ? init : "");
+  else
+    *buffer = g_string_new(init);
+
+  return *buffer;
 }
 
 static const gchar *
 _next_var_id(MafwTrackerSourceSparqlBuilder *builder)
 {
-  MafwTrackerSourceSparqlBuilderPrivate *priv = PRIVATE(builder);
+  g_snprintf(builder->var_buffer, sizeof(builder->var_buffer), "?v%u",
+             builder->var_idx++);
 
-  sprintf(priv->var_buffer, "?v%u", priv->var_idx++);
-
-  return priv->var_buffer;
+  return builder->var_buffer;
 }
 
 static const gchar *
 _next_val_id(MafwTrackerSourceSparqlBuilder *builder)
 {
-  MafwTrackerSourceSparqlBuilderPrivate *priv = PRIVATE(builder);
-
-  sprintf(priv->val_buffer, "_%u", priv->val_idx++);
+  g_snprintf(builder->val_buffer, sizeof(builder->val_buffer), "_%u",
+             builder->val_idx);
 
-  return priv->val_buffer;
+  return builder->val_buffer;
 }
 
+/* Stores the value for the id returned by the last _next_val_id() */
 static void _add_value(MafwTrackerSourceSparqlBuilder *builder,
-                       const gchar *id, const gchar *value)
+                       const gchar *value)
 {
-  MafwTrackerSourceSparqlBuilderPrivate *priv = PRIVATE(builder);
+  guint idx = builder->val_idx++;
 
-  g_hash_table_insert(priv->values, g_strdup(id), g_strdup(value));
+  if (idx < SPARQL_BUILDER_INLINE_VALUES)
+  {
+    builder->values[idx] = g_strdup(value);
+    return;
+  }
+
+  if (!builder->more_values)
+    builder->more_values = g_ptr_array_new_with_free_func(g_free);
+
+  g_ptr_array_add(builder->more_values, g_strdup(value));
 }
 
 gchar *
@@ -147,8 +140,8 @@ mafw_tracker_source_sparql_create_query_filter(
   {
     const gchar *id = _next_val_id(builder);
 
-    _add_value(builder, id, value);
     filter = g_strdup_printf(" . %s ~%s", query, id);
+    _add_value(builder, value);
   }
   else
   {
@@ -162,6 +155,77 @@ mafw_tracker_source_sparql_create_query_filter(
   return filter;
 }
 
+/* Same as mafw_tracker_source_sparql_create_query_filter(), matching any of
+ * the values, none of which may be empty */
+gchar *
+mafw_tracker_source_sparql_create_query_filter_in(
+    MafwTrackerSourceSparqlBuilder *builder,
+    const char *query,
+    gchar **values)
+{
+  GString *filter = g_string_new(NULL);
+  const gchar *var = _next_var_id(builder);
+  gint i;
+
+  g_string_append_printf(filter, " . %s %s . FILTER(%s IN (", query, var, var);
+
+  for (i = 0; values[i]; i++)
+  {
+    if (i)
+      g_string_append(filter, ", ");
+
+    g_string_append_printf(filter, "~%s", _next_val_id(builder));
+    _add_value(builder, values[i]);
+  }
+
+  g_string_append(filter, "))");
+
+  return g_string_free(filter, FALSE);
+}
+
+/* File name without extension, used as title of clips without one */
+#define TITLE_FALLBACK "REPLACE(?v%u, '\\\\.[^.]*$', '')"
+
+/* Selects @var as value of @field. If @fallback_var is not NULL, values
+ * are those of clips: it is the variable reserved for the file name, the
+ * title falls back to, and the year is computed from the date. Returns
+ * whether the file name is needed. */
+static gboolean
+_append_field(GString *sparql_select,
+              GString *sparql_where,
+              const gchar *field,
+              const gchar *var,
+              const guint *fallback_var)
+{
+  gboolean title = fallback_var && !strcmp(field, TRACKER_AKEY_TITLE);
+
+  if (title)
+  {
+    g_string_append_printf(sparql_select,
+                           " COALESCE(IF(%s != '', %s, " TITLE_FALLBACK "), "
+                           TITLE_FALLBACK ")",
+                           var, var, *fallback_var, *fallback_var);
+  }
+  else if (fallback_var && !strcmp(field, TRACKER_AKEY_YEAR))
+    g_string_append_printf(sparql_select, " YEAR(%s)", var);
+  else
+    g_string_append_printf(sparql_select, " %s", var);
+
+  g_string_append_printf(sparql_where, " . OPTIONAL {%s %s}", field, var);
+
+  return title;
+}
+
+/* Adds the file name to the variable reserved by _append_field() */
+static void
+_append_title_fallback(MafwTrackerSourceSparqlBuilder *builder,
+                       GString *sparql_where)
+{
+  g_string_append_printf(sparql_where,
+                         " . OPTIONAL {?o nie:isStoredAs/nfo:fileName %s}",
+                         _next_var_id(builder));
+}
+
 static const char *
 _get_service(TrackerObjectType type)
 {
@@ -198,14 +262,38 @@ static void
 _bind_values(MafwTrackerSourceSparqlBuilder *builder,
              TrackerSparqlStatement *stmt)
 {
-  MafwTrackerSourceSparqlBuilderPrivate *priv = PRIVATE(builder);
-  GHashTableIter iter;
-  gpointer key, value;
+  gchar id[16];
+  const gchar *value;
+  guint i;
 
-  g_hash_table_iter_init (&iter, priv->values);
+  for (i = 0; i < builder->val_idx; i++)
+  {
+    if (i < SPARQL_BUILDER_INLINE_VALUES)
+      value = builder->values[i];
+    else
+      value = g_ptr_array_index(builder->more_values,
+                                i - SPARQL_BUILDER_INLINE_VALUES);
 
-  while (g_hash_table_iter_next(&iter, &key, &value))
-    tracker_sparql_statement_bind_string(stmt, key, value);
+    g_snprintf(id, sizeof(id), "_%u", i);
+    tracker_sparql_statement_bind_string(stmt, id, value);
+  }
+}
+
+/* Joins the select, where and tail buffers into the query one */
+static const gchar *
+_build_query(MafwTrackerSourceSparqlBuilder *builder, const gchar *where_sep)
+{
+  GString *query = _buffer(&builder->query, NULL);
+
+  g_string_append_len(query, builder->select->str, builder->select->len);
+  g_string_append(query, where_sep);
+  g_string_append_len(query, builder->where->str, builder->where->len);
+  g_string_append(query, " }");
+
+  if (builder->tail)
+    g_string_append_len(query, builder->tail->str, builder->tail->len);
+
+  return query->str;
 }
 
 TrackerSparqlStatement *
@@ -220,66 +308,66 @@ mafw_tracker_source_sparql_meta(MafwTrackerSourceSparqlBuilder *builder,
   GString *sparql_select;
   GString *sparql_where;
   guint i;
-  gchar *sparql;
-  gchar *uri_var = NULL;
+  const gchar *sparql;
+  guint uri_var = 0;
+  guint fallback_var;
+  gboolean fallback = FALSE;
 
-  sparql_select = g_string_new("SELECT");
-  sparql_where = g_string_new(" { ");
+  sparql_select = _buffer(&builder->select, "SELECT");
+  sparql_where = _buffer(&builder->where, " { ");
+  _buffer(&builder->tail, NULL);
 
   g_string_append(sparql_where, _get_service(type));
 
   if (uris)
   {
-    uri_var = g_strdup(_next_var_id(builder));
-    g_string_append_printf(sparql_select, " %s", uri_var);
-    g_string_append_printf(sparql_where, " . ?o nie:isStoredAs/nie:url %s", uri_var);
+    uri_var = builder->var_idx;
+    g_string_append_printf(sparql_select, " %s", _next_var_id(builder));
+    g_string_append_printf(sparql_where, " . ?o nie:isStoredAs/nie:url %s",
+                           builder->var_buffer);
   }
 
-  for (i = 0; i < g_strv_length((gchar **)fields) && i < max_fields; i++)
+  /* The file name for the title comes right after the fields */
+  fallback_var = builder->var_idx + MIN(g_strv_length((gchar **)fields),
+                                        (guint)max_fields);
+
+  for (i = 0; fields[i] && i < max_fields; i++)
   {
     const gchar *var = _next_var_id(builder);
 
-    g_string_append_printf(sparql_select, " %s", var);
-    g_string_append_printf(sparql_where, " . OPTIONAL{%s %s}", fields[i], var);
+    fallback |= _append_field(sparql_select, sparql_where, fields[i], var,
+                              &fallback_var);
   }
 
+  if (fallback)
+    _append_title_fallback(builder, sparql_where);
+
   if (uris)
   {
-    GString *sparql_in = g_string_new(NULL);
     gchar *const *uri;
 
-    g_string_append_printf(sparql_in, " . FILTER(%s IN(", uri_var);
+    g_string_append_printf(sparql_where, " . FILTER(?v%u IN(", uri_var);
 
     for (uri = uris; *uri; uri++)
     {
-      const gchar *id = _next_val_id(builder);
-
-      _add_value(builder, id, *uri);
-      g_string_append(sparql_in, "~");
-      g_string_append(sparql_in, id);
+      g_string_append_c(sparql_where, '~');
+      g_string_append(sparql_where, _next_val_id(builder));
+      _add_value(builder, *uri);
 
       if (*(uri + 1))
-        g_string_append(sparql_in, ",");
+        g_string_append_c(sparql_where, ',');
     }
 
-    g_string_append(sparql_where, sparql_in->str);
     g_string_append(sparql_where, "))");
-    g_string_free(sparql_in, TRUE);
-    g_free(uri_var);
   }
 
-  sparql = g_strconcat(sparql_select->str,
-                       " WHERE ", sparql_where->str, " }", NULL);
-  g_string_free(sparql_select, TRUE);
-  g_string_free(sparql_where, TRUE);
+  sparql = _build_query(builder, " WHERE ");
 
   g_debug("Created metadata sparql '%s'", sparql);
 
   stmt = tracker_sparql_connection_query_statement(tc, sparql, NULL, NULL);
   _bind_values(builder, stmt);
 
-  g_free(sparql);
-
   return stmt;
 }
 
@@ -289,22 +377,21 @@ mafw_tracker_source_sparql_select(MafwTrackerSourceSparqlBuilder *builder,
                                   TrackerObjectType type,
                                   const gchar *uri)
 {
-  const char *st = _get_service(type);
-  const gchar *id = _next_val_id(builder);
   TrackerSparqlStatement *stmt;
-  gchar *sparql;
+  GString *sparql;
 
+  sparql = _buffer(&builder->query, NULL);
+  g_string_append_printf(sparql,
+                         "SELECT * WHERE {%s ; nie:isStoredAs/nie:url ~%s}",
+                         _get_service(type), _next_val_id(builder));
+  _add_value(builder, uri);
 
-  _add_value(builder, id, uri);
-  sparql = g_strdup_printf("SELECT * WHERE {%s ; nie:isStoredAs/nie:url ~%s}", st, id);
+  g_debug("Created select URI sparql '%s'", sparql->str);
 
-  g_debug("Created select URI sparql '%s'", sparql);
-
-  stmt = tracker_sparql_connection_query_statement(tc, sparql, NULL, NULL);
+  stmt = tracker_sparql_connection_query_statement(tc, sparql->str, NULL,
+                                                   NULL);
   _bind_values(builder, stmt);
 
-  g_free(sparql);
-
   return stmt;
 }
 
@@ -318,11 +405,11 @@ mafw_tracker_source_sparql_update(MafwTrackerSourceSparqlBuilder *builder,
 {
   gchar *sql;
   gchar *escaped_uri = tracker_sparql_escape_string(uri);
-  GString *sparql_delete = g_string_new("");
-  GString *sparql_insert = g_string_new("");
-  GString *sparql_where = g_string_new("");
+  GString *sparql_delete = _buffer(&builder->select, NULL);
+  GString *sparql_insert = _buffer(&builder->tail, NULL);
+  GString *sparql_where = _buffer(&builder->where, NULL);
 
-  for (int i = 0; i < g_strv_length(keys); i++)
+  for (int i = 0; keys[i]; i++)
   {
     const gchar *var = _next_var_id(builder);
 
@@ -336,10 +423,6 @@ mafw_tracker_source_sparql_update(MafwTrackerSourceSparqlBuilder *builder,
         _get_graph(type), sparql_delete->str, sparql_insert->str,
         _get_service(type), escaped_uri, sparql_where->str);
 
-  g_string_free(sparql_delete, TRUE);
-  g_string_free(sparql_insert, TRUE);
-  g_string_free(sparql_where, TRUE);
-
   g_debug("Created update sparql '%s'", sql);
 
   g_free(escaped_uri);
@@ -410,8 +493,8 @@ mafw_tracker_source_sparql_create_filter_from_category(
   return rdf_filter;
 }
 
-static gchar *
-_group_concat(const gchar *v)
+static void
+_append_group_concat(GString *sparql, const gchar *v)
 {
   /* We do all this voodoo magic because SQLITE GROUP_CONCAT() with
    * custom separator is broken, so we cannot replace the default ','
@@ -423,13 +506,43 @@ _group_concat(const gchar *v)
 
 #define SEP "!@_SQLITE_GROUP_CONCAT_IS_BROKEN_@!"
 
-  return g_strdup_printf("REPLACE(REPLACE("
+  g_string_append_printf(sparql, " REPLACE(REPLACE("
                          AGGREGATED_TYPE_CONCAT "(DISTINCT CONCAT(%s, '"
                          SEP "')),'" SEP ",','|'), '" SEP "', '')", v);
 
 #undef SEP
 }
 
+static void
+_append_sample(GString *sparql, const gchar *v)
+{
+  g_string_append_printf(sparql, " IF(COUNT(DISTINCT %s) > 1, '"
+                         SEVERAL_VALUES_DELIMITER "', SAMPLE(%s))", v, v);
+}
+
+static void
+_append_representative(GString *sparql, const gchar *v)
+{
+  g_string_append_printf(sparql, " CONCAT(IF(COUNT(DISTINCT %s) > 1, '"
+                         SEVERAL_VALUES_DELIMITER "', ''), SAMPLE(%s))",
+                         v, v);
+}
+
+/* Whether a sort key names an aggregate, as "AGGREGATE(field)" */
+static gboolean
+_is_aggregate(const gchar *key, const gchar *aggregate, const gchar *field)
+{
+  gsize len = strlen(aggregate);
+
+  if (strncmp(key, aggregate, len) || key[len] != '(')
+    return FALSE;
+
+  key += len + 1;
+  len = strlen(field);
+
+  return !strncmp(key, field, len) && !strcmp(key + len, ")");
+}
+
 TrackerSparqlStatement *
 mafw_tracker_source_sparql_create(MafwTrackerSourceSparqlBuilder *builder,
                                   TrackerSparqlConnection *tc,
@@ -444,38 +557,111 @@ mafw_tracker_source_sparql_create(MafwTrackerSourceSparqlBuilder *builder,
                                   gchar **tracker_sort_keys)
 {
   TrackerSparqlStatement *stmt;
-  GString *sparql_select = g_string_new("SELECT");
-  GString *sparql_where = g_string_new("WHERE { ");
-  GString *sparql_group = g_string_new(NULL);
-  guint i;
-  gchar *sparql;
-  GHashTable *field_vars =
-      g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  GString *sparql_select = _buffer(&builder->select, "SELECT");
+  GString *sparql_where = _buffer(&builder->where, "WHERE { ");
+  GString *sparql_group = _buffer(&builder->tail, NULL);
+  guint i, j;
+  const gchar *sparql;
+  /* Fields get consecutive variables, starting with this one */
+  guint first_field_var = builder->var_idx;
+  gchar field_var[16];
+  /* The file name for the title comes right after the fields */
+  guint fallback_var = first_field_var + g_strv_length(fields);
+  gboolean fallback = FALSE;
+  /* Aggregates, as selected, to sort the groups by them */
+  GPtrArray *aggregate_exprs = g_ptr_array_new_with_free_func(g_free);
+  /* Grouped fields already in the ORDER BY */
+  gboolean *sorted = g_new0(gboolean, g_strv_length(fields));
+  const gchar *ob = " ORDER BY";
 
   g_string_append(sparql_where, _get_service(type));
 
-  for (i = 0; i < g_strv_length(fields); i++)
+  for (i = 0; fields[i]; i++)
   {
     const gchar *var = _next_var_id(builder);
 
-    g_hash_table_insert(field_vars, fields[i], g_strdup(var));
-    g_string_append_printf(sparql_select, " %s", var);
-    g_string_append_printf(sparql_where, " . OPTIONAL {%s %s}", fields[i], var);
+    /* Unique values are grouped by the plain value */
+    fallback |= _append_field(sparql_select, sparql_where, fields[i], var,
+                              unique ? NULL : &fallback_var);
 
     if (unique)
       g_string_append_printf(sparql_group, " GROUP BY %s", var);
   }
 
-  if (tracker_sort_keys)
+  if (fallback)
+    _append_title_fallback(builder, sparql_where);
+
+  if (aggregates)
   {
-    const gchar *ob = " ORDER BY";
+    for (i = 0; aggregates[i]; i++)
+    {
+      const gchar *var = _next_var_id(builder);
+      gsize start = sparql_select->len;
 
-    for (i = 0; i < g_strv_length(tracker_sort_keys); i++)
+      if (!strcmp(aggregates[i], AGGREGATED_TYPE_CONCAT))
+        _append_group_concat(sparql_select, var);
+      else if (!strcmp(aggregates[i], AGGREGATED_TYPE_SAMPLE))
+        _append_sample(sparql_select, var);
+      else if (!strcmp(aggregates[i], AGGREGATED_TYPE_REPRESENTATIVE))
+        _append_representative(sparql_select, var);
+      else if (!strcmp(aggregates[i], AGGREGATED_TYPE_COUNT))
+      {
+        if (!strcmp(aggregate_fields[i], "*"))
+          g_string_append_printf(sparql_select, " %s(*)", aggregates[i]);
+        else
+        {
+          g_string_append_printf(
+                sparql_select, " %s(DISTINCT %s)", aggregates[i], var);
+        }
+      }
+      else
+        g_string_append_printf(sparql_select, " %s(%s)", aggregates[i], var);
+
+      g_ptr_array_add(aggregate_exprs,
+                      g_strdup(sparql_select->str + start));
+
+      if (strcmp(aggregates[i], AGGREGATED_TYPE_COUNT) ||
+          strcmp(aggregate_fields[i], "*"))
+      {
+        g_string_append_printf(sparql_where, " . %s %s",
+                               aggregate_fields[i], var);
+      }
+    }
+  }
+
+  if (tracker_sort_keys)
+  {
+    for (i = 0; tracker_sort_keys[i]; i++)
     {
       const gchar *key = tracker_sort_keys[i];
-      const gchar *var = g_hash_table_lookup(field_vars, key + 1);;
+      const gchar *var = NULL;
       const gchar *cond;
 
+      for (j = 0; fields[j]; j++)
+      {
+        if (!strcmp(fields[j], key + 1))
+        {
+          g_snprintf(field_var, sizeof(field_var), "?v%u",
+                     first_field_var + j);
+          var = field_var;
+
+          if (unique)
+            sorted[j] = TRUE;
+
+          break;
+        }
+      }
+
+      for (j = 0; !var && unique && aggregates && aggregates[j]; j++)
+      {
+        if (_is_aggregate(key + 1, aggregates[j], aggregate_fields[j]))
+          var = g_ptr_array_index(aggregate_exprs, j);
+      }
+
+      /* Groups cannot be sorted by the values of their clips */
+      if (!var && unique)
+        continue;
+
       if (*key == '+')
         cond = "ASC";
       else if (*key == '-')
@@ -500,38 +686,15 @@ mafw_tracker_source_sparql_create(MafwTrackerSourceSparqlBuilder *builder,
     }
   }
 
-  if (aggregates)
+  /* Ties, or no sort keys at all, would leave the order of the groups
+   * undefined, and pages could overlap */
+  for (i = 0; unique && fields[i]; i++)
   {
-    for (i = 0; i < g_strv_length(aggregates); i++)
+    if (!sorted[i])
     {
-      const gchar *var = _next_var_id(builder);
-
-      if (!strcmp(aggregates[i], AGGREGATED_TYPE_CONCAT))
-      {
-        gchar *concat = _group_concat(var);
-
-        g_string_append_printf(sparql_select, " %s",concat);
-        g_free(concat);
-      }
-      else if (!strcmp(aggregates[i], AGGREGATED_TYPE_COUNT))
-      {
-        if (!strcmp(aggregate_fields[i], "*"))
-          g_string_append_printf(sparql_select, " %s(*)", aggregates[i]);
-        else
-        {
-          g_string_append_printf(
-                sparql_select, " %s(DISTINCT %s)", aggregates[i], var);
-        }
-      }
-      else
-        g_string_append_printf(sparql_select, " %s(%s)", aggregates[i], var);
-
-      if (strcmp(aggregates[i], AGGREGATED_TYPE_COUNT) ||
-          strcmp(aggregate_fields[i], "*"))
-      {
-        g_string_append_printf(sparql_where, " . %s %s",
-                               aggregate_fields[i], var);
-      }
+      g_string_append_printf(sparql_group, "%s ASC(?v%u)", ob,
+                             first_field_var + i);
+      ob = "";
     }
   }
 
@@ -539,23 +702,17 @@ mafw_tracker_source_sparql_create(MafwTrackerSourceSparqlBuilder *builder,
     g_string_append_printf(sparql_group, " LIMIT %u OFFSET %u", limit, offset);
 
   if (condition)
-    g_string_append_printf(sparql_where, "%s", condition);
-
-  sparql = g_strconcat(sparql_select->str, " ",
-                       sparql_where->str, " }",
-                       sparql_group->str, NULL);
+    g_string_append(sparql_where, condition);
 
-  g_string_free(sparql_select, TRUE);
-  g_string_free(sparql_where, TRUE);
-  g_string_free(sparql_group, TRUE);
-  g_hash_table_destroy(field_vars);
+  sparql = _build_query(builder, " ");
 
   g_debug("Created sparql '%s'", sparql);
 
   stmt = tracker_sparql_connection_query_statement(tc, sparql, NULL, NULL);
   _bind_values(builder, stmt);
 
-  g_free(sparql);
+  g_ptr_array_free(aggregate_exprs, TRUE);
+  g_free(sorted);
 
   return stmt;
 }
@@ -609,7 +766,6 @@ _get_expression(MafwTrackerSourceSparqlBuilder *builder,
                                                     filter->value);
 
   id = _next_val_id(builder);
-  _add_value(builder, id, tracker_value);
 
   if (is_cont)
     expr = g_strdup_printf("CONTAINS(%s,~%s)", var, id);
@@ -624,6 +780,7 @@ _get_expression(MafwTrackerSourceSparqlBuilder *builder,
       expr = g_strdup_printf("(%s%s~%s)", var, c, id);
   }
 
+  _add_value(builder, tracker_value);
   g_free(tracker_value);
 
   return expr;
@@ -20,7 +20,6 @@
 #ifndef __MAFW_TRACKER_SOURCE_SPARQL_BUILDER_H__
 #define __MAFW_TRACKER_SOURCE_SPARQL_BUILDER_H__
 
-#include <glib-object.h>
 #include <glib.h>
 #include <tracker-sparql.h>
 
@@ -29,25 +28,43 @@
 G_BEGIN_DECLS
 
 typedef struct _MafwTrackerSourceSparqlBuilder MafwTrackerSourceSparqlBuilder;
-typedef struct _MafwTrackerSourceSparqlBuilderClass MafwTrackerSourceSparqlBuilderClass;
 
-#define MAFW_TRACKER_SOURCE_TYPE_SPARQL_BUILDER (mafw_tracker_source_sparql_builder_get_type())
-
-#define MAFW_TRACKER_SOURCE_SPARQL_BUILDER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), MAFW_TRACKER_SOURCE_TYPE_HOME_SPARQL_BUILDER, MafwTrackerSourceSparqlBuilder))
-
-#define MAFW_TRACKER_SOURCE_SPARQL_BUILDER_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), MAFW_TRACKER_SOURCE_TYPE_HOME_SPARQL_BUILDER, MafwTrackerSourceSparqlBuilderClass))
-
-#define MAFW_TRACKER_SOURCE_IS_HOME_SPARQL_BUILDER(obj) (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MAFW_TRACKER_SOURCE_TYPE_HOME_SPARQL_BUILDER))
-
-#define MAFW_TRACKER_SOURCE_IS_HOME_SPARQL_BUILDER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), MAFW_TRACKER_SOURCE_TYPE_HOME_SPARQL_BUILDER))
-
-#define MAFW_TRACKER_SOURCE_SPARQL_BUILDER_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), MAFW_TRACKER_SOURCE_TYPE_HOME_SPARQL_BUILDER, MafwTrackerSourceSparqlBuilderClass))
-
-GType
-mafw_tracker_source_sparql_builder_get_type() G_GNUC_CONST;
-
-MafwTrackerSourceSparqlBuilder *
-mafw_tracker_source_sparql_builder_new();
+/* Values bound without allocating the overflow array */
+#define SPARQL_BUILDER_INLINE_VALUES 8
+
+/* Builds the queries of a request. It lives in the stack or inside the
+ * request closure: set it up with mafw_tracker_source_sparql_builder_init()
+ * and release it with mafw_tracker_source_sparql_builder_clear(). Its fields
+ * are private. */
+struct _MafwTrackerSourceSparqlBuilder
+{
+  /* Number of the next variable (?vN) and value (~_N) */
+  guint var_idx;
+  guint val_idx;
+  /* Name of the last variable and value given */
+  gchar var_buffer[16];
+  gchar val_buffer[16];
+  /* Values to bind, value N is bound to _N */
+  gchar *values[SPARQL_BUILDER_INLINE_VALUES];
+  GPtrArray *more_values;
+  /* Buffers reused by every query */
+  GString *select;
+  GString *where;
+  GString *tail;
+  GString *query;
+};
+
+void
+mafw_tracker_source_sparql_builder_init(
+    MafwTrackerSourceSparqlBuilder *builder);
+
+void
+mafw_tracker_source_sparql_builder_reset(
+    MafwTrackerSourceSparqlBuilder *builder);
+
+void
+mafw_tracker_source_sparql_builder_clear(
+    MafwTrackerSourceSparqlBuilder *builder);
 
 TrackerSparqlStatement *
 mafw_tracker_source_sparql_meta(MafwTrackerSourceSparqlBuilder *builder,
@@ -96,6 +113,11 @@ mafw_tracker_source_sparql_create_query_filter(
     MafwTrackerSourceSparqlBuilder *builder,
     const char *query,
     const char *value);
+gchar *
+mafw_tracker_source_sparql_create_query_filter_in(
+    MafwTrackerSourceSparqlBuilder *builder,
+    const char *query,
+    gchar **values);
 
 gboolean
 mafw_tracker_source_mafw_filter_to_sparql(
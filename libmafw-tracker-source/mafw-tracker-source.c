@@ -59,15 +59,15 @@ struct _destroy_object_closure
   gpointer user_data;
   /* Callback error */
   GError *error;
-  /* List of uris to destroy */
-  GList *uris;
+  /* Clips to destroy, as UtilResource */
+  GArray *clips;
   /* Some extra fields used to destroy the files */
   guint current_index;
   guint remaining_count;
   /* We may have to allocate memory for URI resolution */
   gchar **metadata_keys;
 
-  MafwTrackerSourceSparqlBuilder *builder;
+  MafwTrackerSourceSparqlBuilder builder;
 };
 
 /*________________________ Plugin init  ________________________*/
@@ -130,12 +130,8 @@ _destroy_object_closure_free(gpointer data)
   /* Free objectid of the destroyed item */
   g_free(dc->object_id);
 
-  /* Free list of uris */
-  if (dc->uris)
-  {
-    g_list_foreach(dc->uris, (GFunc)g_free, NULL);
-    g_list_free(dc->uris);
-  }
+  /* Free clips */
+  g_array_unref(dc->clips);
 
   /* Free metadata keys */
   g_strfreev(dc->metadata_keys);
@@ -144,18 +140,84 @@ _destroy_object_closure_free(gpointer data)
   if (dc->error)
     g_error_free(dc->error);
 
-  g_object_unref(dc->builder);
+  mafw_tracker_source_sparql_builder_clear(&dc->builder);
 
   g_free(dc);
 }
 
+/* Characters left as they are in object ids: the URI unreserved ones */
+static inline gboolean
+_is_object_id_char(guchar c)
+{
+  return g_ascii_isalnum(c) || (c == '-') || (c == '.') || (c == '_') ||
+         (c == '~');
+}
+
+/* Length of the valid UTF-8 character at p, 0 if it is not one */
+static inline gint
+_utf8_char_len(const gchar *p)
+{
+  gunichar c = g_utf8_get_char_validated(p, -1);
+
+  if ((c == (gunichar)-1) || (c == (gunichar)-2) || (c == 0))
+    return 0;
+
+  return g_utf8_skip[*(const guchar *)p];
+}
+
+/* Escapes like g_string_append_uri_escaped(string, original, NULL, TRUE),
+ * but copying the runs of characters that need no escaping at once instead
+ * of byte by byte. Most paths have few or none to escape. */
+void
+mafw_tracker_source_append_escaped_string(GString *string,
+                                          const gchar *original)
+{
+  static const gchar hex[] = "0123456789ABCDEF";
+  const gchar *run = original;
+  const gchar *p = original;
+
+  while (*p)
+  {
+    guchar c = *p;
+    gint len;
+
+    if (_is_object_id_char(c))
+    {
+      p++;
+      continue;
+    }
+
+    if ((c >= 0x80) && ((len = _utf8_char_len(p)) > 0))
+    {
+      p += len;
+      continue;
+    }
+
+    if (p > run)
+      g_string_append_len(string, run, p - run);
+
+    g_string_append_c(string, '%');
+    g_string_append_c(string, hex[c >> 4]);
+    g_string_append_c(string, hex[c & 0xf]);
+    run = ++p;
+  }
+
+  if (p > run)
+    g_string_append_len(string, run, p - run);
+}
+
 gchar *
 mafw_tracker_source_escape_string(const gchar *original)
 {
-  return g_uri_escape_string(original,
-                             "abcdefghijklmnopqrstuvwxyz"
-                             "ABCDEFGHIJKLMNOPQRSTUVWXYZ",
-                             TRUE);
+  GString *escaped;
+
+  if (!original)
+    return NULL;
+
+  escaped = g_string_sized_new(strlen(original) + 1);
+  mafw_tracker_source_append_escaped_string(escaped, original);
+
+  return g_string_free(escaped, FALSE);
 }
 
 /* ___________________ GObject private implementation __________________ */
@@ -164,19 +226,27 @@ static gboolean
 _destroy_object_idle(gpointer data)
 {
   GFile *file;
-  gchar *uri;
+  UtilResource *clip;
+  const gchar *filename;
 
   struct _destroy_object_closure *dc = (struct _destroy_object_closure *)data;
 
   if (dc->remaining_count == 0)
   {
+    mafw_tracker_source_invalidate_metadata(MAFW_TRACKER_SOURCE(dc->source),
+                                            NULL);
     dc->callback(dc->source, dc->object_id, dc->user_data, dc->error);
     return FALSE;
   }
   else
   {
-    uri = get_data(g_list_nth(dc->uris, dc->current_index));
-    file = g_file_new_for_uri(uri);
+    clip = &g_array_index(dc->clips, UtilResource, dc->current_index);
+    filename = util_resource_get_filename(clip);
+
+    if (filename)
+      file = g_file_new_for_path(filename);
+    else
+      file = g_file_new_for_uri(util_resource_get_uri(clip));
 
     if (!g_file_delete(file, NULL, NULL))
     {
@@ -198,11 +268,11 @@ _destroy_object_idle(gpointer data)
 }
 
 static void
-_get_uri(gpointer metadata, gpointer uris_list)
+_get_uri(gpointer metadata, gpointer clips_array)
 {
   GValue *gval = NULL;
   const gchar *uri;
-  GList **uris = (GList **)uris_list;
+  GArray *clips = (GArray *)clips_array;
 
   if (metadata)
     gval = mafw_metadata_first(metadata, MAFW_METADATA_KEY_URI);
@@ -212,30 +282,33 @@ _get_uri(gpointer metadata, gpointer uris_list)
     uri = g_value_get_string(gval);
 
     if (uri)
-      *uris = g_list_append(*uris, g_strdup(uri));
+    {
+      UtilResource clip = UTIL_RESOURCE_INIT;
+
+      util_resource_set_uri(&clip, uri);
+      g_array_append_val(clips, clip);
+    }
   }
 }
 
 static void
 _destroy_object_tracker_cb(MafwResult *clips, GError *error, gpointer user_data)
 {
-  GList *uris = NULL;
-
   struct _destroy_object_closure *dc = user_data;
 
   if (error == NULL)
   {
-    g_list_foreach(clips->metadata_values, _get_uri, &uris);
-    dc->uris = uris;
+    g_list_foreach(clips->metadata_values, _get_uri, dc->clips);
     dc->current_index = 0;
-    dc->remaining_count = g_list_length(dc->uris);
+    dc->remaining_count = dc->clips->len;
 
     g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
                     (GSourceFunc)_destroy_object_idle, dc,
                     (GDestroyNotify)_destroy_object_closure_free);
     g_list_free_full(clips->metadata_values,
                      (GDestroyNotify)mafw_metadata_release);
-    g_list_free_full(clips->ids, g_free);
+    g_list_free(clips->ids);
+    g_string_chunk_free(clips->strings);
     g_free(clips);
   }
   else
@@ -251,6 +324,80 @@ _destroy_object_tracker_cb(MafwResult *clips, GError *error, gpointer user_data)
   }
 }
 
+static void
+mafw_tracker_source_set_extension_property(MafwExtension *self,
+                                           const gchar *key,
+                                           const GValue *value)
+{
+  MafwTrackerSource *source = MAFW_TRACKER_SOURCE(self);
+
+  g_return_if_fail(key != NULL);
+
+  if (!strcmp(key, MAFW_TRACKER_SOURCE_PROPERTY_DEFERRED_ART))
+  {
+    gboolean deferred_art = g_value_get_boolean(value);
+
+    if (source->priv->deferred_art != deferred_art)
+    {
+      source->priv->deferred_art = deferred_art;
+      ti_set_deferred_art(deferred_art);
+      mafw_extension_emit_property_changed(self, key, value);
+    }
+  }
+  else if (!strcmp(key, MAFW_TRACKER_SOURCE_PROPERTY_METADATA_BATCHES))
+  {
+    guint metadata_batches = MAX(g_value_get_uint(value), 1);
+
+    if (source->priv->metadata_batches != metadata_batches)
+    {
+      source->priv->metadata_batches = metadata_batches;
+      ti_set_metadata_batches(metadata_batches);
+      mafw_extension_emit_property_changed(self, key, value);
+    }
+  }
+  else
+    g_warning("Unknown extension property: %s", key);
+}
+
+static void
+mafw_tracker_source_get_extension_property(
+  MafwExtension *self,
+  const gchar *key,
+  MafwExtensionPropertyCallback callback,
+  gpointer user_data)
+{
+  MafwTrackerSource *source = MAFW_TRACKER_SOURCE(self);
+  GValue *value = NULL;
+  GError *error = NULL;
+
+  g_return_if_fail(callback != NULL);
+  g_return_if_fail(key != NULL);
+
+  if (!strcmp(key, MAFW_TRACKER_SOURCE_PROPERTY_DEFERRED_ART))
+  {
+    value = g_new0(GValue, 1);
+    g_value_init(value, G_TYPE_BOOLEAN);
+    g_value_set_boolean(value, source->priv->deferred_art);
+  }
+  else if (!strcmp(key, MAFW_TRACKER_SOURCE_PROPERTY_METADATA_BATCHES))
+  {
+    value = g_new0(GValue, 1);
+    g_value_init(value, G_TYPE_UINT);
+    g_value_set_uint(value, source->priv->metadata_batches);
+  }
+  else
+  {
+    error = g_error_new(MAFW_EXTENSION_ERROR,
+                        MAFW_EXTENSION_ERROR_INVALID_PROPERTY,
+                        "Unknown extension property: %s", key);
+  }
+
+  callback(self, key, value, user_data, error);
+
+  if (error)
+    g_error_free(error);
+}
+
 /*_________________________ Tracker Source GObject ________________________*/
 
 G_DEFINE_TYPE_WITH_PRIVATE(MafwTrackerSource,
@@ -264,6 +411,12 @@ static void
 mafw_tracker_source_class_init(MafwTrackerSourceClass *klass)
 {
   MafwSourceClass *source_class = MAFW_SOURCE_CLASS(klass);
+  MafwExtensionClass *extension_class = MAFW_EXTENSION_CLASS(klass);
+
+  extension_class->set_extension_property =
+    mafw_tracker_source_set_extension_property;
+  extension_class->get_extension_property =
+    mafw_tracker_source_get_extension_property;
 
   source_class->browse = mafw_tracker_source_browse;
   source_class->cancel_browse = mafw_tracker_source_cancel_browse;
@@ -290,6 +443,8 @@ mafw_tracker_source_init(MafwTrackerSource *source_tracker)
 
   /* Initialize last progress; assume that tracker isn't indexing */
   source_tracker->priv->last_progress = 100;
+
+  source_tracker->priv->metadata_batches = TI_DEFAULT_METADATA_BATCHES;
 }
 
 /**
@@ -318,6 +473,13 @@ mafw_tracker_source_new(void)
                    "name", MAFW_TRACKER_SOURCE_NAME,
                    NULL));
 
+    mafw_extension_add_property(MAFW_EXTENSION(source),
+                                MAFW_TRACKER_SOURCE_PROPERTY_DEFERRED_ART,
+                                G_TYPE_BOOLEAN);
+    mafw_extension_add_property(MAFW_EXTENSION(source),
+                                MAFW_TRACKER_SOURCE_PROPERTY_METADATA_BATCHES,
+                                G_TYPE_UINT);
+
     /* Connect to notifications about changes on the filesystem */
     ti_init_watch(G_OBJECT(source));
   }
@@ -343,7 +505,8 @@ mafw_tracker_source_destroy_object(MafwSource *self,
                                    gpointer user_data)
 {
   CategoryType category;
-  gchar *genre, *artist, *album, *clip;
+  gchar *genre, *artist, *album;
+  UtilResource clip;
 
   g_return_if_fail(MAFW_IS_TRACKER_SOURCE(self));
   g_return_if_fail(object_id != NULL);
@@ -357,11 +520,12 @@ mafw_tracker_source_destroy_object(MafwSource *self,
   dc->callback = cb;
   dc->user_data = user_data;
   dc->error = NULL;
-  dc->uris = NULL;
+  dc->clips = g_array_new(FALSE, FALSE, sizeof(UtilResource));
+  g_array_set_clear_func(dc->clips, (GDestroyNotify)util_resource_clear);
   dc->current_index = 0;
   dc->remaining_count = 1;
   dc->metadata_keys = NULL;
-  dc->builder = mafw_tracker_source_sparql_builder_new();
+  mafw_tracker_source_sparql_builder_init(&dc->builder);
 
   category = util_extract_category_info(
         object_id, &genre, &artist, &album, &clip);
@@ -380,10 +544,10 @@ mafw_tracker_source_destroy_object(MafwSource *self,
   }
 
   /* Destroy operation */
-  if (clip)
+  if (util_resource_is_set(&clip))
   {
     /* Delete a video, a song or a playlist file */
-    dc->uris = g_list_append(dc->uris, g_strdup(clip));
+    g_array_append_val(dc->clips, clip);
     g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
                     _destroy_object_idle, dc,
                     (GDestroyNotify)_destroy_object_closure_free);
@@ -394,7 +558,7 @@ mafw_tracker_source_destroy_object(MafwSource *self,
     dc->metadata_keys =
       g_strdupv((gchar **)MAFW_SOURCE_LIST(MAFW_METADATA_KEY_URI));
 
-    ti_get_songs(dc->builder, genre, artist, album, dc->metadata_keys, NULL,
+    ti_get_songs(&dc->builder, genre, artist, album, dc->metadata_keys, NULL,
                  NULL, 0, 0, _destroy_object_tracker_cb, dc);
   }
   else
@@ -410,9 +574,6 @@ mafw_tracker_source_destroy_object(MafwSource *self,
   }
 
   /* Frees */
-  if (clip)
-    g_free(clip);
-
   if (genre)
     g_free(genre);
 
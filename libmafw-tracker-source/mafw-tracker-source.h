@@ -57,6 +57,16 @@ G_BEGIN_DECLS
 /* Tracker source UUID */
 #define MAFW_TRACKER_SOURCE_UUID "localtagfs"
 
+/* Extension property: if TRUE, browse results only include album-art and
+ * thumbnail keys already known, and "metadata-changed" is emitted for the
+ * items whose art is resolved afterwards */
+#define MAFW_TRACKER_SOURCE_PROPERTY_DEFERRED_ART "deferred-art"
+
+/* Extension property: how many queries a get_metadatas request for many
+ * clips may have running at the same time. Such requests are split in
+ * batches of a bounded number of clips. */
+#define MAFW_TRACKER_SOURCE_PROPERTY_METADATA_BATCHES "metadata-batches"
+
 typedef struct _MafwTrackerSource MafwTrackerSource;
 typedef struct _MafwTrackerSourceClass MafwTrackerSourceClass;
 
@@ -136,6 +146,29 @@ mafw_tracker_source_destroy_object(MafwSource *self,
 gchar *
 mafw_tracker_source_escape_string(const gchar *original);
 
+void
+mafw_tracker_source_append_escaped_string(GString *string,
+                                          const gchar *original);
+
+void
+mafw_tracker_source_cache_metadata(MafwTrackerSource *self,
+                                   gchar **metadata_keys,
+                                   GList *object_ids,
+                                   GList *metadata_values);
+GHashTable *
+mafw_tracker_source_lookup_metadata(MafwTrackerSource *self,
+                                    const gchar *object_id,
+                                    gchar **metadata_keys);
+void
+mafw_tracker_source_invalidate_metadata(MafwTrackerSource *self,
+                                        const gchar *object_id);
+void
+mafw_tracker_source_add_untracked(MafwTrackerSource *self,
+                                  const gchar *object_id);
+gboolean
+mafw_tracker_source_is_untracked(MafwTrackerSource *self,
+                                 const gchar *object_id);
+
 void
 mafw_tracker_source_get_playlist_duration(MafwSource *self,
                                           const gchar *object_id,
@@ -29,14 +29,13 @@
 #include "album-art.h"
 #include "key-mapping.h"
 #include "tracker-cache.h"
+#include "tracker-iface.h"
 #include "util.h"
 #include <libmafw/mafw.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define SEVERAL_VALUES_DELIMITER "|"
-
 /* ------------------------- Private API ------------------------- */
 
 static void
@@ -56,16 +55,13 @@ _replace_various_values(GValue *value)
 }
 
 static gboolean
-_value_is_allowed(GValue *value, const gchar *key)
+_value_is_allowed(const GValue *value, MetadataKey *metadata_key)
 {
-  MetadataKey *metadata_key;
   const gchar *str_value;
 
   if (!value)
     return FALSE;
 
-  metadata_key = keymap_get_metadata(key);
-
   if (!metadata_key)
     return FALSE;
 
@@ -95,252 +91,1322 @@ _value_is_allowed(GValue *value, const gchar *key)
   }
 }
 
-static int
-_get_childcount_level(const gchar *childcount_key)
+/* Metadata built from the results shares their interned strings: its GValues
+ * hold the GRefStrings of the results as static strings, and release them
+ * with the table. Every value of these tables is allocated here, so they are
+ * only filled through _metadata_add_val() and _metadata_add_shared(). */
+static void
+_metadata_value_free(GValue *value)
 {
-  gint level;
+  /* Copied strings never are static, see _metadata_add_val() */
+  if (G_VALUE_HOLDS_STRING(value) &&
+      (value->data[1].v_uint & G_VALUE_NOCOPY_CONTENTS))
+  {
+    g_ref_string_release(value->data[0].v_pointer);
+  }
+
+  g_value_unset(value);
+  g_free(value);
+}
+
+static GHashTable *
+_metadata_new(void)
+{
+  return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify)_metadata_value_free);
+}
+
+static void
+_metadata_add_val(GHashTable *metadata, const gchar *key,
+                  const GValue *value)
+{
+  GValue *copy = g_new0(GValue, 1);
+
+  g_value_init(copy, G_VALUE_TYPE(value));
+
+  if (G_VALUE_HOLDS_STRING(value))
+    g_value_set_string(copy, g_value_get_string(value));
+  else
+    g_value_copy(value, copy);
+
+  g_hash_table_replace(metadata, g_strdup(key), copy);
+}
+
+static void
+_metadata_add_shared(GHashTable *metadata, const gchar *key,
+                     const gchar *refstring)
+{
+  GValue *value = g_new0(GValue, 1);
+
+  g_value_init(value, G_TYPE_STRING);
+  g_value_set_static_string(value,
+                            g_ref_string_acquire((gchar *)refstring));
+  g_hash_table_replace(metadata, g_strdup(key), value);
+}
+
+/* Inserts a key in the cache. 'pos' only makes sense when type is
+ * TRACKER_CACHE_KEY_TYPE_TRACKER */
+static void
+_insert_key(TrackerCache *cache,
+            const gchar *key,
+            MetadataKey *metadata_key,
+            enum TrackerCacheKeyType type,
+            gboolean user_key,
+            gint pos)
+{
+  TrackerCacheValue *cached_value;
+
+  cached_value = g_new0(TrackerCacheValue, 1);
+  cached_value->user_key = user_key;
+  cached_value->key_type = type;
+  cached_value->metadata_key = metadata_key;
+
+  if (type == TRACKER_CACHE_KEY_TYPE_TRACKER)
+    cached_value->tracker_index = pos;
+
+  g_hash_table_insert(cache->cache, g_strdup(key), cached_value);
+}
+
+/* How a thumbnailer key is obtained */
+enum _thumbnailer_kind
+{
+  /* Thumbnail of the clip, from its URI */
+  THUMBNAILER_KIND_THUMBNAIL,
+  /* Album art, from the album */
+  THUMBNAILER_KIND_ALBUM_ART,
+  /* Thumbnail of the album art, from the album */
+  THUMBNAILER_KIND_ALBUM_ART_THUMBNAIL
+};
+
+/* Rows resolved by each job pushed to the thumbnails pool */
+#define THUMBNAILS_ROWS_PER_JOB 16
+
+/* Maximum number of resolved values remembered */
+#define RESOLVED_MAX_ENTRIES 4096
+
+/* Maximum number of representative albums remembered */
+#define REPRESENTATIVES_MAX_ENTRIES 1024
+
+/* Thumbnailer keys of a result set, resolved in a worker thread */
+struct TrackerCacheThumbnails
+{
+  TrackerCache *cache;
+  /* User keys to resolve and how to resolve them */
+  gchar **keys;
+  enum _thumbnailer_kind *kinds;
+  guint n_keys;
+  guint n_rows;
+  /* Input for each row, copied from the cache */
+  gchar **albums;
+  gchar **uris;
+  /* For rows of artists or genres, what _get_container() names them */
+  gchar **containers;
+  /* Resolved values, n_rows * n_keys */
+  gchar **values;
+  /* Rows given to the workers */
+  guint *rows;
+  guint n_resolve_rows;
+  /* In deferred mode, rows that were not fully resolved from previous
+   * results */
+  gboolean deferred;
+  gboolean *missing;
+  /* Jobs not finished yet */
+  gint pending;
+  /* All jobs have finished */
+  gboolean done;
+  TrackerCacheThumbnailsCB callback;
+  gpointer user_data;
+};
+
+struct _thumbnails_job
+{
+  TrackerCacheThumbnails *thumbnails;
+  /* Range in thumbnails->rows */
+  guint first;
+  guint last;
+};
+
+static GThreadPool *thumbnails_pool = NULL;
+
+/* A value already resolved for an input */
+struct _resolved_value
+{
+  gchar *key;
+  gchar *value;
+};
+
+/* "kind/input" -> link of its struct _resolved_value in resolved_lru, most
+ * recently used first. Only values found are stored, so a miss always goes
+ * through the thumbnailer again. */
+static GHashTable *resolved = NULL;
+static GQueue resolved_lru = G_QUEUE_INIT;
+G_LOCK_DEFINE_STATIC(resolved);
+
+/* Where the album art of an artist or a genre comes from */
+struct _representative
+{
+  gchar *container;
+  /* The album of the container found to have art, NULL if none had */
+  gchar *album;
+  /* Without album, albumart_get_album_art_generation() when looked for */
+  guint generation;
+};
+
+/* "key/value" of an artist or genre -> link of its struct _representative
+ * in representatives_lru, most recently used first */
+static GHashTable *representatives = NULL;
+static GQueue representatives_lru = G_QUEUE_INIT;
+G_LOCK_DEFINE_STATIC(representatives);
+
+static enum _thumbnailer_kind
+_get_thumbnailer_kind(const MetadataKey *metadata_key)
+{
+  if (metadata_key->key_type == THUMBNAIL_KEY)
+    return THUMBNAILER_KIND_THUMBNAIL;
+
+  /* In case of album-art-large-uri, album-art is used */
+  if ((metadata_key->id == KEY_ID_ALBUM_ART_URI) ||
+      (metadata_key->id == KEY_ID_ALBUM_ART_LARGE_URI))
+  {
+    return THUMBNAILER_KIND_ALBUM_ART;
+  }
+
+  return THUMBNAILER_KIND_ALBUM_ART_THUMBNAIL;
+}
+
+/* With the lock held */
+static void
+_remove_representative(GList *link)
+{
+  struct _representative *rep = link->data;
+
+  g_hash_table_remove(representatives, rep->container);
+  g_queue_delete_link(&representatives_lru, link);
+  g_free(rep->container);
+  g_free(rep->album);
+  g_free(rep);
+}
+
+static gboolean
+_lookup_representative(const gchar *container,
+                       gchar **album,
+                       guint *generation)
+{
+  struct _representative *rep;
+  GList *link = NULL;
+
+  G_LOCK(representatives);
+
+  if (representatives &&
+      (link = g_hash_table_lookup(representatives, container)))
+  {
+    rep = link->data;
+    *album = g_strdup(rep->album);
+    *generation = rep->generation;
+    g_queue_unlink(&representatives_lru, link);
+    g_queue_push_head_link(&representatives_lru, link);
+  }
+
+  G_UNLOCK(representatives);
+
+  return link != NULL;
+}
+
+static void
+_remember_representative(const gchar *container,
+                         const gchar *album,
+                         guint generation)
+{
+  struct _representative *rep;
+  GList *link;
+
+  G_LOCK(representatives);
+
+  if (!representatives)
+    representatives = g_hash_table_new(g_str_hash, g_str_equal);
+  else if ((link = g_hash_table_lookup(representatives, container)))
+    _remove_representative(link);
+
+  rep = g_new(struct _representative, 1);
+  rep->container = g_strdup(container);
+  rep->album = g_strdup(album);
+  rep->generation = generation;
+  g_queue_push_head(&representatives_lru, rep);
+  g_hash_table_insert(representatives, rep->container,
+                      representatives_lru.head);
+
+  while (representatives_lru.length > REPRESENTATIVES_MAX_ENTRIES)
+    _remove_representative(representatives_lru.tail);
+
+  G_UNLOCK(representatives);
+}
+
+/* Returns the album art of a row. For artists and genres, named by
+ * @container, @album is the one tracker sampled. The first of their albums
+ * found to have art is remembered and used from then on, so a row costs a
+ * single lookup in the index of the album-art directory. Only when that
+ * album loses its art, or art is added while none of them had any, are all
+ * the albums of the container got, if @may_query. */
+static gchar *
+_get_album_art(const gchar *container, const gchar *album, gboolean may_query)
+{
+  gchar *album_art_uri = NULL;
+  gchar *remembered = NULL;
+  gboolean several = FALSE;
+  gchar **albums;
+  gchar *key;
+  guint generation;
+  gint i;
+
+  if (!container)
+    return IS_STRING_EMPTY(album) ? NULL : albumart_get_album_art_uri(album);
+
+  if (_lookup_representative(container, &remembered, &generation))
+  {
+    if (!remembered)
+    {
+      if (generation == albumart_get_album_art_generation())
+        return NULL;
+    }
+    else
+    {
+      album_art_uri = albumart_get_album_art_uri(remembered);
+      g_free(remembered);
+
+      if (album_art_uri)
+        return album_art_uri;
+    }
+  }
+
+  generation = albumart_get_album_art_generation();
+
+  /* AGGREGATED_TYPE_REPRESENTATIVE tells several albums apart with a
+   * leading SEVERAL_VALUES_DELIMITER */
+  if (album && g_str_has_prefix(album, SEVERAL_VALUES_DELIMITER))
+  {
+    album += strlen(SEVERAL_VALUES_DELIMITER);
+    several = TRUE;
+  }
+
+  if (!IS_STRING_EMPTY(album))
+    album_art_uri = albumart_get_album_art_uri(album);
+
+  if (album_art_uri || !several)
+  {
+    _remember_representative(container, album_art_uri ? album : NULL,
+                             generation);
+    return album_art_uri;
+  }
+
+  if (!may_query)
+    return NULL;
+
+  /* Look for art in the other albums */
+  key = g_strndup(container, strcspn(container, "/"));
+  albums = ti_get_container_albums(key, container + strlen(key) + 1);
+  g_free(key);
+
+  if (!albums)
+    return NULL;
+
+  for (i = 0; albums[i] && !album_art_uri; i++)
+    album_art_uri = albumart_get_album_art_uri(albums[i]);
+
+  _remember_representative(container, album_art_uri ? albums[i - 1] : NULL,
+                           generation);
+  g_strfreev(albums);
+
+  return album_art_uri;
+}
+
+/* Computes a thumbnailer value. It does not use the cache, so it can run in
+ * any thread. Only worker threads, @may_query, can wait for tracker. */
+static gchar *
+_resolve_thumbnailer(enum _thumbnailer_kind kind,
+                     const gchar *container,
+                     const gchar *album,
+                     const gchar *uri,
+                     gboolean may_query)
+{
+  gchar *album_art_uri;
+  gchar *th_uri;
+
+  switch (kind)
+  {
+    case THUMBNAILER_KIND_THUMBNAIL:
+    {
+      if (!uri)
+        return NULL;
+
+      return albumart_get_thumbnail_uri(uri, THUMBNAIL_CROPPED);
+    }
+    case THUMBNAILER_KIND_ALBUM_ART:
+    {
+      return _get_album_art(container, album, may_query);
+    }
+    case THUMBNAILER_KIND_ALBUM_ART_THUMBNAIL:
+    {
+      album_art_uri = _get_album_art(container, album, may_query);
+
+      if (!album_art_uri)
+        return NULL;
+
+      th_uri = albumart_get_thumbnail_uri(album_art_uri, THUMBNAIL_CROPPED);
+      g_free(album_art_uri);
+
+      return th_uri;
+    }
+  }
+
+  return NULL;
+}
+
+/* Artists and genres, @container, get the art of any of their albums */
+static gchar *
+_resolved_key(enum _thumbnailer_kind kind,
+              const gchar *container,
+              const gchar *album,
+              const gchar *uri)
+{
+  const gchar *input;
+
+  if (kind == THUMBNAILER_KIND_THUMBNAIL)
+    input = uri;
+  else
+    input = container ? container : album;
+
+  if (IS_STRING_EMPTY(input))
+    return NULL;
+
+  return g_strdup_printf("%d/%s", kind, input);
+}
+
+/* With the lock held */
+static void
+_remove_resolved(GList *link)
+{
+  struct _resolved_value *rv = link->data;
+
+  g_hash_table_remove(resolved, rv->key);
+  g_queue_delete_link(&resolved_lru, link);
+  g_free(rv->key);
+  g_free(rv->value);
+  g_free(rv);
+}
+
+/* Returns a value previously resolved for the same input, or NULL. Values
+ * whose file was removed since are forgotten. */
+static gchar *
+_lookup_resolved(enum _thumbnailer_kind kind,
+                 const gchar *container,
+                 const gchar *album,
+                 const gchar *uri)
+{
+  gchar *key;
+  gchar *value = NULL;
+  GList *link;
+
+  key = _resolved_key(kind, container, album, uri);
+
+  if (!key)
+    return NULL;
+
+  G_LOCK(resolved);
+
+  if (resolved && (link = g_hash_table_lookup(resolved, key)))
+  {
+    value = g_strdup(((struct _resolved_value *)link->data)->value);
+    g_queue_unlink(&resolved_lru, link);
+    g_queue_push_head_link(&resolved_lru, link);
+  }
+
+  G_UNLOCK(resolved);
+
+  /* Cheap with the index of the thumbnail directories */
+  if (value && !albumart_file_uri_exists(value))
+  {
+    G_LOCK(resolved);
+
+    link = g_hash_table_lookup(resolved, key);
+
+    if (link && !strcmp(((struct _resolved_value *)link->data)->value, value))
+      _remove_resolved(link);
+
+    G_UNLOCK(resolved);
+
+    g_free(value);
+    value = NULL;
+  }
+
+  g_free(key);
+
+  return value;
+}
+
+static void
+_remember_resolved(enum _thumbnailer_kind kind,
+                   const gchar *container,
+                   const gchar *album,
+                   const gchar *uri,
+                   const gchar *value)
+{
+  struct _resolved_value *rv;
+  GList *link;
+  gchar *key;
+
+  if (IS_STRING_EMPTY(value))
+    return;
+
+  key = _resolved_key(kind, container, album, uri);
+
+  if (!key)
+    return;
+
+  G_LOCK(resolved);
+
+  if (!resolved)
+    resolved = g_hash_table_new(g_str_hash, g_str_equal);
+  else if ((link = g_hash_table_lookup(resolved, key)))
+    _remove_resolved(link);
+
+  rv = g_new(struct _resolved_value, 1);
+  rv->key = key;
+  rv->value = g_strdup(value);
+  g_queue_push_head(&resolved_lru, rv);
+  g_hash_table_insert(resolved, rv->key, resolved_lru.head);
+
+  while (resolved_lru.length > RESOLVED_MAX_ENTRIES)
+    _remove_resolved(resolved_lru.tail);
+
+  G_UNLOCK(resolved);
+}
+
+/* Returns the string value of a key, or NULL */
+static gchar *
+_get_string(TrackerCache *cache, const gchar *key, gint index)
+{
+  GValue value = G_VALUE_INIT;
+  gchar *str = NULL;
+
+  if (!tracker_cache_value_get_into(cache, key, index, &value))
+    return NULL;
+
+  if (G_VALUE_HOLDS_STRING(&value))
+    str = g_value_dup_string(&value);
+
+  g_value_unset(&value);
+
+  return str;
+}
+
+/* Returns "key/value" if the row is an artist or a genre, or NULL */
+static gchar *
+_get_container(TrackerCache *cache, gint index)
+{
+  gchar *value;
+  gchar *container = NULL;
+
+  if (!cache->unique_key ||
+      (strcmp(cache->unique_key, MAFW_METADATA_KEY_ARTIST) &&
+       strcmp(cache->unique_key, MAFW_METADATA_KEY_GENRE)))
+  {
+    return NULL;
+  }
+
+  value = _get_string(cache, cache->unique_key, index);
+
+  if (!IS_STRING_EMPTY(value))
+    container = g_strdup_printf("%s/%s", cache->unique_key, value);
+
+  g_free(value);
+
+  return container;
+}
+
+static gboolean
+_get_value_thumbnailer(TrackerCache *cache,
+                       const MetadataKey *metadata_key,
+                       gint index,
+                       GValue *value)
+{
+  enum _thumbnailer_kind kind;
+  gchar *container;
+  gchar *input;
+  gchar *th_uri;
+
+  kind = _get_thumbnailer_kind(metadata_key);
+
+  if (kind == THUMBNAILER_KIND_THUMBNAIL)
+  {
+    input = _get_string(cache, MAFW_METADATA_KEY_URI, index);
+    th_uri = _resolve_thumbnailer(kind, NULL, NULL, input, FALSE);
+  }
+  else
+  {
+    container = _get_container(cache, index);
+    input = _get_string(cache, MAFW_METADATA_KEY_ALBUM, index);
+    th_uri = _resolve_thumbnailer(kind, container, input, NULL, FALSE);
+    g_free(container);
+  }
+
+  g_free(input);
+
+  if (!th_uri)
+    return FALSE;
+
+  g_value_init(value, G_TYPE_STRING);
+  g_value_take_string(value, th_uri);
+
+  return TRUE;
+}
+
+static gboolean
+_thumbnails_done_idle(gpointer data)
+{
+  TrackerCacheThumbnails *thumbnails = data;
+
+  thumbnails->done = TRUE;
+  thumbnails->callback(thumbnails->cache, thumbnails->user_data);
+
+  return FALSE;
+}
+
+static void
+_thumbnails_job_run(gpointer data, gpointer user_data)
+{
+  struct _thumbnails_job *job = data;
+  TrackerCacheThumbnails *thumbnails = job->thumbnails;
+  gchar **value;
+  guint row;
+  guint i;
+  guint j;
+
+  for (j = job->first; j < job->last; j++)
+  {
+    row = thumbnails->rows[j];
+
+    for (i = 0; i < thumbnails->n_keys; i++)
+    {
+      value = &thumbnails->values[row * thumbnails->n_keys + i];
+
+      g_free(*value);
+      *value = _resolve_thumbnailer(thumbnails->kinds[i],
+                                    thumbnails->containers[row],
+                                    thumbnails->albums[row],
+                                    thumbnails->uris[row], TRUE);
+      _remember_resolved(thumbnails->kinds[i], thumbnails->containers[row],
+                         thumbnails->albums[row], thumbnails->uris[row],
+                         *value);
+    }
+  }
+
+  g_free(job);
+
+  /* Last job tells the main loop */
+  if (g_atomic_int_dec_and_test(&thumbnails->pending))
+    g_idle_add(_thumbnails_done_idle, thumbnails);
+}
+
+static void
+_thumbnails_free(TrackerCacheThumbnails *thumbnails)
+{
+  guint i;
+
+  for (i = 0; i < thumbnails->n_rows * thumbnails->n_keys; i++)
+    g_free(thumbnails->values[i]);
+
+  for (i = 0; i < thumbnails->n_rows; i++)
+  {
+    g_free(thumbnails->albums[i]);
+    g_free(thumbnails->uris[i]);
+    g_free(thumbnails->containers[i]);
+  }
+
+  g_free(thumbnails->values);
+  g_free(thumbnails->rows);
+  g_free(thumbnails->missing);
+  g_free(thumbnails->albums);
+  g_free(thumbnails->uris);
+  g_free(thumbnails->containers);
+  g_free(thumbnails->kinds);
+  g_strfreev(thumbnails->keys);
+  g_free(thumbnails);
+}
+
+static gint
+_compare_strings(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* How a column of the tracker results is stored */
+enum _column_type
+{
+  /* Copy in the strings chunk */
+  COLUMN_TYPE_STRING,
+  /* GRefString, shared by the rows with the same value and by the metadata
+   * built from them */
+  COLUMN_TYPE_INTERNED,
+  /* Integer or boolean */
+  COLUMN_TYPE_INTEGER,
+  COLUMN_TYPE_DOUBLE,
+  /* Date, as seconds since the epoch */
+  COLUMN_TYPE_EPOCH,
+  /* Date, as year */
+  COLUMN_TYPE_YEAR
+};
+
+/* Size of the blocks where string cells are stored */
+#define RESULTS_CHUNK_SIZE 4096
+
+typedef union
+{
+  gint64 integer;
+  gdouble real;
+  const gchar *string;
+} TrackerCacheCell;
+
+/* Results returned by tracker, stored by column and already converted to
+ * the type of the MAFW key */
+#define RESULTS_ROW_MISSING G_MAXUINT
+
+struct TrackerCacheResults
+{
+  guint n_columns;
+  enum _column_type *column_types;
+  /* One array of TrackerCacheCell per column */
+  GArray **columns;
+  /* Number of rows read from tracker */
+  guint n_stored;
+  /* Row -> stored row, NULL if rows are in the order they were read.
+   * RESULTS_ROW_MISSING if tracker returned nothing for the row. */
+  GArray *order;
+  /* Contents of the string cells, released all at once */
+  GStringChunk *strings;
+  /* GRefStrings of the interned cells, each one holding a reference */
+  GHashTable *refstrings;
+};
+
+static enum _column_type
+_get_column_type(TrackerCache *cache, MetadataKey *metadata_key)
+{
+  if (!metadata_key)
+    return COLUMN_TYPE_STRING;
+
+  switch (metadata_key->value_type)
+  {
+    case G_TYPE_INT:
+    case G_TYPE_LONG:
+    case G_TYPE_BOOLEAN:
+      return COLUMN_TYPE_INTEGER;
+    case G_TYPE_FLOAT:
+      return COLUMN_TYPE_DOUBLE;
+    default:
+    {
+      if (metadata_key->value_type == G_TYPE_DATE)
+      {
+        if (metadata_key->id == KEY_ID_YEAR)
+          return COLUMN_TYPE_YEAR;
+        else
+          return COLUMN_TYPE_EPOCH;
+      }
+
+      /* Values of 'unique' queries don't repeat among rows */
+      if (metadata_key->interned &&
+          (cache->result_type != TRACKER_CACHE_RESULT_TYPE_UNIQUE))
+      {
+        return COLUMN_TYPE_INTERNED;
+      }
+
+      return COLUMN_TYPE_STRING;
+    }
+  }
+}
+
+/* Returns the stored row for a result, or -1 if out of range or missing */
+static gint
+_results_get_row(const TrackerCacheResults *results, gint index)
+{
+  guint row;
+
+  if (!results || (index < 0) ||
+      (index >= tracker_cache_results_length(results)))
+  {
+    return -1;
+  }
+
+  if (results->order)
+  {
+    row = g_array_index(results->order, guint, index);
+    return row == RESULTS_ROW_MISSING ? -1 : (gint)row;
+  }
+
+  return index;
+}
+
+/* Whether tracker returned nothing for a result */
+static gboolean
+_results_row_missing(const TrackerCacheResults *results, gint index)
+{
+  if (!results || !results->order || (index < 0) ||
+      (index >= results->order->len))
+  {
+    return FALSE;
+  }
+
+  return g_array_index(results->order, guint, index) == RESULTS_ROW_MISSING;
+}
+
+static const TrackerCacheCell *
+_results_get_cell(const TrackerCacheResults *results, gint row, gint column)
+{
+  return &g_array_index(results->columns[column], TrackerCacheCell, row);
+}
+
+/* Returns the GRefString of the results holding @s, creating it if needed */
+static const gchar *
+_results_refstring(TrackerCacheResults *results, const gchar *s)
+{
+  gchar *refstring = g_hash_table_lookup(results->refstrings, s);
+
+  if (!refstring)
+  {
+    refstring = g_ref_string_new(s);
+    g_hash_table_add(results->refstrings, refstring);
+  }
+
+  return refstring;
+}
+
+static const gchar *
+_results_get_string(const TrackerCacheResults *results, gint row,
+                    gint column)
+{
+  const gchar *s = _results_get_cell(results, row, column)->string;
+
+  return s ? s : "";
+}
+
+static gint64
+_results_get_integer(const TrackerCacheResults *results, gint row,
+                     gint column)
+{
+  const TrackerCacheCell *cell = _results_get_cell(results, row, column);
+
+  switch (results->column_types[column])
+  {
+    case COLUMN_TYPE_STRING:
+    case COLUMN_TYPE_INTERNED:
+      return g_ascii_strtoll(_results_get_string(results, row, column),
+                             NULL, 10);
+    case COLUMN_TYPE_DOUBLE:
+      return (gint64)cell->real;
+    default:
+      return cell->integer;
+  }
+}
+
+static gdouble
+_results_get_double(const TrackerCacheResults *results, gint row,
+                    gint column)
+{
+  const TrackerCacheCell *cell = _results_get_cell(results, row, column);
+
+  switch (results->column_types[column])
+  {
+    case COLUMN_TYPE_STRING:
+    case COLUMN_TYPE_INTERNED:
+      return g_ascii_strtod(_results_get_string(results, row, column), NULL);
+    case COLUMN_TYPE_DOUBLE:
+      return cell->real;
+    default:
+      return cell->integer;
+  }
+}
+
+/* Converts a value returned by tracker to the type of the MAFW key, storing
+ * it in an unset GValue */
+static void
+_value_from_results(const TrackerCacheResults *results,
+                    gint row,
+                    gint column,
+                    GType value_type,
+                    GValue *value)
+{
+  switch (value_type)
+  {
+    case G_TYPE_INT:
+    {
+      g_value_init(value, G_TYPE_INT);
+      g_value_set_int(value, _results_get_integer(results, row, column));
+      break;
+    }
+
+    case G_TYPE_LONG:
+    {
+      g_value_init(value, G_TYPE_LONG);
+      g_value_set_long(value, _results_get_integer(results, row, column));
+      break;
+    }
+    case G_TYPE_FLOAT:
+    {
+      g_value_init(value, G_TYPE_FLOAT);
+      g_value_set_float(value, _results_get_double(results, row, column));
+      break;
+    }
+
+    case G_TYPE_BOOLEAN:
+    {
+      g_value_init(value, G_TYPE_BOOLEAN);
+      g_value_set_boolean(value,
+                          _results_get_integer(results, row, column) != 0);
+      break;
+    }
+
+    default:
+    {
+      if (value_type == G_TYPE_DATE)
+      {
+        if (results->column_types[column] == COLUMN_TYPE_YEAR)
+        {
+          g_value_init(value, G_TYPE_INT);
+          g_value_set_int(value, _results_get_integer(results, row, column));
+        }
+        else
+        {
+          g_value_init(value, G_TYPE_LONG);
+          g_value_set_long(value,
+                           _results_get_integer(results, row, column));
+        }
+
+        break;
+      }
+
+      g_value_init(value, G_TYPE_STRING);
+      g_value_set_string(value, _results_get_string(results, row, column));
+      break;
+    }
+  }
+}
+
+/* How a key of the plan gets its value */
+enum _plan_op
+{
+  /* There is no value */
+  PLAN_OP_NONE,
+  /* Converted from a column of the tracker results */
+  PLAN_OP_TRACKER,
+  /* Precomputed in the cache */
+  PLAN_OP_COMPUTED,
+  /* Album art or thumbnail */
+  PLAN_OP_THUMBNAILER
+};
+
+/* Access to a key, with derived keys already followed */
+struct _plan_entry
+{
+  /* Key the user asked for */
+  gchar *key;
+  MetadataKey *metadata_key;
+  enum _plan_op op;
+  /* Key that holds the value, after following derivations */
+  gchar *source_key;
+  /* Column in the tracker results, and how to convert it */
+  gint column;
+  GType value_type;
+  /* Use the filename when the title is empty */
+  gboolean title;
+};
+
+/* Flat list of keys to build metadata from a cache. It only depends on the
+ * keys in the cache, so it is shared by caches with the same keys. */
+typedef struct
+{
+  guint n_entries;
+  struct _plan_entry *entries;
+  /* Used for title fallback */
+  struct _plan_entry uri;
+  gboolean has_uri;
+} TrackerCachePlan;
+
+/* Maximum number of plans kept */
+#define PLANS_MAX_ENTRIES 64
+
+/* Cache signature -> TrackerCachePlan */
+static GHashTable *plans = NULL;
+
+static void
+_plan_free(TrackerCachePlan *plan)
+{
+  guint i;
+
+  for (i = 0; i < plan->n_entries; i++)
+  {
+    g_free(plan->entries[i].key);
+    g_free(plan->entries[i].source_key);
+  }
+
+  g_free(plan->uri.key);
+  g_free(plan->uri.source_key);
+  g_free(plan->entries);
+  g_free(plan);
+}
+
+static void
+_plan_entry_compile(TrackerCache *cache,
+                    const gchar *key,
+                    struct _plan_entry *entry)
+{
+  TrackerCacheValue *cached_value;
+  const gchar *source_key = key;
+  MetadataKey *source_metadata_key;
+
+  entry->key = g_strdup(key);
+  cached_value = g_hash_table_lookup(cache->cache, key);
+
+  if (cached_value)
+    entry->metadata_key = cached_value->metadata_key;
+
+  while (cached_value &&
+         (cached_value->key_type == TRACKER_CACHE_KEY_TYPE_DERIVED))
+  {
+    source_key = cached_value->key_derived_from;
+    cached_value = g_hash_table_lookup(cache->cache, source_key);
+  }
+
+  entry->source_key = g_strdup(source_key);
+
+  if (!cached_value)
+    return;
+
+  switch (cached_value->key_type)
+  {
+    case TRACKER_CACHE_KEY_TYPE_TRACKER:
+    {
+      source_metadata_key = cached_value->metadata_key;
+      entry->op = PLAN_OP_TRACKER;
+      entry->column = cached_value->tracker_index;
+      entry->value_type = source_metadata_key->value_type;
+      break;
+    }
+    case TRACKER_CACHE_KEY_TYPE_COMPUTED:
+    {
+      entry->op = PLAN_OP_COMPUTED;
+      break;
+    }
+    case TRACKER_CACHE_KEY_TYPE_THUMBNAILER:
+    {
+      entry->op = PLAN_OP_THUMBNAILER;
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+/* Builds a string identifying the keys of the cache and how they are
+ * obtained */
+static gchar *
+_plan_signature(TrackerCache *cache)
+{
+  GPtrArray *items;
+  GHashTableIter iter;
+  gchar *key;
+  TrackerCacheValue *value;
+  GString *signature;
+  guint i;
+
+  items = g_ptr_array_sized_new(g_hash_table_size(cache->cache));
+  g_hash_table_iter_init(&iter, cache->cache);
+
+  while (g_hash_table_iter_next(&iter, (gpointer *)&key, (gpointer *)&value))
+  {
+    g_ptr_array_add(
+      items,
+      g_strdup_printf("%s:%d:%d:%d:%s", key, value->key_type, value->user_key,
+                      value->key_type == TRACKER_CACHE_KEY_TYPE_TRACKER ?
+                      value->tracker_index : -1,
+                      value->key_type == TRACKER_CACHE_KEY_TYPE_DERIVED ?
+                      value->key_derived_from : ""));
+  }
+
+  g_ptr_array_sort(items, (GCompareFunc)_compare_strings);
+
+  signature = g_string_new(NULL);
+  g_string_append_printf(signature, "%d:%d", cache->result_type,
+                         cache->tracker_type);
+
+  for (i = 0; i < items->len; i++)
+  {
+    g_string_append_c(signature, '|');
+    g_string_append(signature, g_ptr_array_index(items, i));
+    g_free(g_ptr_array_index(items, i));
+  }
+
+  g_ptr_array_free(items, TRUE);
+
+  return g_string_free(signature, FALSE);
+}
+
+/* Returns the plan for the cache, compiling it if no cache with the same
+ * keys was seen before */
+static TrackerCachePlan *
+_plan_get(TrackerCache *cache)
+{
+  TrackerCachePlan *plan;
+  gchar *signature;
+  gchar **user_keys;
+  guint i;
+
+  signature = _plan_signature(cache);
+
+  if (!plans)
+  {
+    plans = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                  (GDestroyNotify)_plan_free);
+  }
+
+  plan = g_hash_table_lookup(plans, signature);
+
+  if (plan)
+  {
+    g_free(signature);
+    return plan;
+  }
+
+  if (g_hash_table_size(plans) >= PLANS_MAX_ENTRIES)
+    g_hash_table_remove_all(plans);
+
+  user_keys = tracker_cache_keys_get_user(cache);
+
+  plan = g_new0(TrackerCachePlan, 1);
+  plan->n_entries = g_strv_length(user_keys);
+  plan->entries = g_new0(struct _plan_entry, plan->n_entries);
+
+  for (i = 0; i < plan->n_entries; i++)
+  {
+    struct _plan_entry *entry = &plan->entries[i];
+
+    _plan_entry_compile(cache, user_keys[i], entry);
+
+    /* Special case: title must use filename if it doesn't contain title */
+    if ((cache->result_type != TRACKER_CACHE_RESULT_TYPE_UNIQUE) &&
+        (strcmp(user_keys[i], MAFW_METADATA_KEY_TITLE) == 0))
+    {
+      entry->title = TRUE;
+    }
+  }
+
+  _plan_entry_compile(cache, MAFW_METADATA_KEY_URI, &plan->uri);
+  plan->has_uri = plan->uri.op != PLAN_OP_NONE;
+
+  g_strfreev(user_keys);
+  g_hash_table_insert(plans, signature, plan);
+
+  return plan;
+}
+
+/* Returns the GRefString of a plan entry for a result, when the metadata can
+ * hold it as it is, or NULL if the value has to be converted */
+static const gchar *
+_plan_entry_refstring(TrackerCache *cache,
+                      const struct _plan_entry *entry,
+                      gint index)
+{
+  const TrackerCacheResults *results = cache->tracker_results;
+  const gchar *s;
+  gint row;
+
+  if ((entry->op != PLAN_OP_TRACKER) || entry->title ||
+      (entry->value_type != G_TYPE_STRING))
+  {
+    return NULL;
+  }
+
+  row = _results_get_row(results, index);
+
+  if ((row < 0) ||
+      (results->column_types[entry->column] != COLUMN_TYPE_INTERNED))
+  {
+    return NULL;
+  }
+
+  s = _results_get_cell(results, row, entry->column)->string;
 
-  sscanf(childcount_key, "childcount(%d)", &level);
+  /* Empty and several values are left to the regular path */
+  if (!s || strstr(s, SEVERAL_VALUES_DELIMITER))
+    return NULL;
 
-  return level;
+  return s;
 }
 
-static GValue *
-_get_title(TrackerCache *cache, gint index, const gchar *path)
+/* Stores in an unset GValue the value of a plan entry for a result.
+ * Returns FALSE if there is no value */
+static gboolean
+_plan_entry_value(TrackerCache *cache,
+                  const struct _plan_entry *entry,
+                  const GValue *computed,
+                  gint index,
+                  GValue *value)
 {
-  GValue *value_title;
-  GValue *value_uri;
-  gchar *uri_title;
-  gchar *filename;
-  gchar *pathname;
-  gchar *dot;
-  const gchar *value_title_str;
-
-  value_title = tracker_cache_value_get(cache,
-                                        MAFW_METADATA_KEY_TITLE,
-                                        index);
-
-  /* If it is empty, then use the URI */
-  value_title_str = value_title ? g_value_get_string(value_title) : NULL;
+  gint row;
 
-  if (IS_STRING_EMPTY(value_title_str) &&
-      (cache->result_type != TRACKER_CACHE_RESULT_TYPE_UNIQUE))
+  switch (entry->op)
   {
-    value_uri = tracker_cache_value_get(cache,
-                                        MAFW_METADATA_KEY_URI,
-                                        index);
-
-    if (!value_uri)
-      return value_title;
+    case PLAN_OP_TRACKER:
+    {
+      /* Verify that tracker found the metadata for the corresponding
+       * entry */
+      row = _results_get_row(cache->tracker_results, index);
 
-    uri_title = (gchar *)g_value_get_string(value_uri);
+      if (row < 0)
+        return FALSE;
 
-    if (IS_STRING_EMPTY(uri_title))
-    {
-      if (IS_STRING_EMPTY(path))
-        return value_title;
-      else
-        pathname = g_strdup(path);
+      _value_from_results(cache->tracker_results, row, entry->column,
+                          entry->value_type, value);
+      return TRUE;
     }
-    else
-      pathname = g_filename_from_uri(uri_title, NULL, NULL);
-
-    if (pathname)
+    case PLAN_OP_COMPUTED:
     {
-      /* Get filename */
-      filename = g_path_get_basename(pathname);
+      if (!computed)
+        return FALSE;
 
-      /* Remove extension */
-      dot = g_strrstr(filename, ".");
-
-      if (dot)
-        *dot = '\0';
-
-      /* Use filename as the value */
-      g_value_set_string(value_uri, filename);
-      g_free(filename);
+      g_value_init(value, G_VALUE_TYPE(computed));
+      g_value_copy(computed, value);
+      return TRUE;
     }
-    else
+    case PLAN_OP_THUMBNAILER:
     {
-      util_gvalue_free(value_uri);
-      value_uri = NULL;
+      return tracker_cache_value_get_into(cache, entry->source_key, index,
+                                          value);
     }
-
-    g_free(pathname);
-    util_gvalue_free(value_title);
-
-    return value_uri;
+    default:
+      return FALSE;
   }
-  else
-    return value_title;
 }
 
-/* Inserts a key in the cache. 'pos' only makes sense when type is
- * TRACKER_CACHE_KEY_TYPE_TRACKER */
-static void
-_insert_key(TrackerCache *cache,
-            const gchar *key,
-            enum TrackerCacheKeyType type,
-            gboolean user_key,
-            gint pos)
+/* Returns the precomputed value of the entry, if any */
+static const GValue *
+_plan_entry_computed(TrackerCache *cache, const struct _plan_entry *entry)
 {
   TrackerCacheValue *cached_value;
 
-  cached_value = g_new0(TrackerCacheValue, 1);
-  cached_value->user_key = user_key;
-  cached_value->key_type = type;
+  if (entry->op != PLAN_OP_COMPUTED)
+    return NULL;
 
-  if (type == TRACKER_CACHE_KEY_TYPE_TRACKER)
-    cached_value->tracker_index = pos;
+  cached_value = g_hash_table_lookup(cache->cache, entry->source_key);
 
-  g_hash_table_insert(cache->cache, g_strdup(key), cached_value);
+  return &cached_value->value;
 }
 
-static GValue *
-_get_value_album_art(TrackerCache *cache, gint index)
+/* Stores the title in an unset GValue, using the filename if the title is
+ * empty. Queries already fall back to the file name, so this is only left
+ * for clips tracker knows nothing about. Returns FALSE if there is no
+ * value */
+static gboolean
+_plan_get_title(TrackerCache *cache,
+                TrackerCachePlan *plan,
+                const struct _plan_entry *entry,
+                const GValue *computed,
+                const GValue *uri_computed,
+                gint index,
+                const gchar *path,
+                GValue *value)
 {
-  GValue *album_value;
-  GValue *return_value;
-  const gchar *album;
-  gchar *album_art_uri;
-  gchar **singles;
-  gint i;
+  GValue value_uri = G_VALUE_INIT;
+  gboolean has_title;
+  const gchar *uri_title;
+  gchar *filename;
+  gchar *pathname;
+  gchar *dot;
+  const gchar *value_title_str;
 
-  album_value = tracker_cache_value_get(cache, MAFW_METADATA_KEY_ALBUM, index);
+  has_title = _plan_entry_value(cache, entry, computed, index, value);
 
-  if (album_value)
-    album = g_value_get_string(album_value);
-  else
-    album = NULL;
+  /* If it is empty, then use the URI */
+  value_title_str = has_title ? g_value_get_string(value) : NULL;
 
-  if (IS_STRING_EMPTY(album))
-  {
-    util_gvalue_free(album_value);
-    return NULL;
-  }
+  if (!IS_STRING_EMPTY(value_title_str) || !plan->has_uri)
+    return has_title;
 
-  /* As album can be actually several albums, split them and
-   * show the first available cover */
-  singles = g_strsplit(album, SEVERAL_VALUES_DELIMITER, 0);
-  util_gvalue_free(album_value);
+  if (!_plan_entry_value(cache, &plan->uri, uri_computed, index, &value_uri))
+    return has_title;
 
-  i = 0;
-  album_art_uri = NULL;
+  uri_title = g_value_get_string(&value_uri);
 
-  while (singles[i] && album_art_uri == NULL)
+  if (IS_STRING_EMPTY(uri_title))
   {
-    album_art_uri = albumart_get_album_art_uri(singles[i]);
-    i++;
+    if (IS_STRING_EMPTY(path))
+    {
+      g_value_unset(&value_uri);
+      return has_title;
+    }
+    else
+      pathname = g_strdup(path);
   }
+  else
+    pathname = util_uri_to_filename(uri_title, NULL);
 
-  g_strfreev(singles);
+  g_value_unset(&value_uri);
 
-  if (album_art_uri)
-  {
-    return_value = g_new0(GValue, 1);
-    g_value_init(return_value, G_TYPE_STRING);
-    g_value_set_string(return_value, album_art_uri);
-    g_free(album_art_uri);
-    return return_value;
-  }
+  if (has_title)
+    g_value_unset(value);
 
-  return NULL;
-}
+  if (!pathname)
+    return FALSE;
 
-static GValue *
-_get_value_thumbnail(TrackerCache *cache, const gchar *key, gint index)
-{
-  GValue *uri_value;
-  GValue *return_value;
-  const gchar *uri;
-  gchar *th_uri;
-  enum thumbnail_size size;
+  /* Get filename */
+  filename = g_path_get_basename(pathname);
 
-  /* For thumbnails, uri is needed */
-  if (albumart_key_is_thumbnail(key))
-  {
-    uri_value = tracker_cache_value_get(cache,
-                                        MAFW_METADATA_KEY_URI,
-                                        index);
-  }
-  else
-  {
-    /* In case of album-art-large-uri, album-art is used */
-    if (strcmp(key, MAFW_METADATA_KEY_ALBUM_ART_LARGE_URI) == 0)
-      return _get_value_album_art(cache, index);
-    else
-    {
-      uri_value = tracker_cache_value_get(cache,
-                                          MAFW_METADATA_KEY_ALBUM_ART_URI,
-                                          index);
-    }
-  }
+  /* Remove extension */
+  dot = g_strrstr(filename, ".");
 
-  if (uri_value)
-    uri = g_value_get_string(uri_value);
-  else
-    uri = NULL;
+  if (dot)
+    *dot = '\0';
 
-  if (uri)
-  {
-    /* Compute size requested */
-    if ((strcmp(key, MAFW_METADATA_KEY_ALBUM_ART_SMALL_URI) == 0) ||
-        (strcmp(key, MAFW_METADATA_KEY_ALBUM_ART_MEDIUM_URI) == 0) ||
-        albumart_key_is_thumbnail(key))
-    {
-      size = THUMBNAIL_CROPPED;
-    }
-    else
-      size = THUMBNAIL_NORMAL;
+  /* Use filename as the value */
+  g_value_init(value, G_TYPE_STRING);
+  g_value_take_string(value, filename);
 
-    return_value = g_new0(GValue, 1);
-    g_value_init(return_value, G_TYPE_STRING);
-    th_uri = albumart_get_thumbnail_uri(uri, size);
-    g_value_set_string(return_value, th_uri);
-    g_free(th_uri);
-    util_gvalue_free(uri_value);
-    return return_value;
-  }
-  else
-  {
-    return NULL;
-  }
+  g_free(pathname);
+
+  return TRUE;
 }
 
-static GValue *
-_aggregate_key(TrackerCache *cache,
-               const gchar *key,
-               gboolean count_childcount)
+/* Stores in an unset GValue the sum of the values of all the results */
+static void
+_plan_aggregate(TrackerCache *cache,
+                const struct _plan_entry *entry,
+                const GValue *computed,
+                gboolean count_childcount,
+                GValue *result)
 {
-  GValue *result;
   gint total = 0;
-  GValue *value;
+  GValue value = G_VALUE_INIT;
   gint i;
   gint results_length;
 
-  results_length = cache->tracker_results ? cache->tracker_results->len : 0;
+  results_length = tracker_cache_results_length(cache->tracker_results);
 
-  if (count_childcount && (strcmp(key, MAFW_METADATA_KEY_CHILDCOUNT_1) == 0))
+  if (count_childcount &&
+      (strcmp(entry->key, MAFW_METADATA_KEY_CHILDCOUNT_1) == 0))
+  {
     total = results_length;
+  }
   else
   {
     for (i = 0; i < results_length; i++)
     {
-      value = tracker_cache_value_get(cache, key, i);
-
-      if (value)
+      if (_plan_entry_value(cache, entry, computed, i, &value))
       {
-        total += g_value_get_int(value);
-        util_gvalue_free(value);
+        total += g_value_get_int(&value);
+        g_value_unset(&value);
       }
     }
   }
 
-  result = g_new0(GValue, 1);
   g_value_init(result, G_TYPE_INT);
   g_value_set_int(result, total);
-
-  return result;
 }
 
 static void
@@ -395,10 +1461,12 @@ tracker_cache_free(TrackerCache *cache)
 {
   /* Free tracker results */
   if (cache->tracker_results)
-  {
-    g_ptr_array_foreach(cache->tracker_results, (GFunc)g_strfreev, NULL);
-    g_ptr_array_free(cache->tracker_results, TRUE);
-  }
+    tracker_cache_results_free(cache->tracker_results);
+
+  if (cache->thumbnails)
+    _thumbnails_free(cache->thumbnails);
+
+  g_free(cache->unique_key);
 
   /* Free cache */
   g_hash_table_unref(cache->cache);
@@ -407,6 +1475,39 @@ tracker_cache_free(TrackerCache *cache)
   g_free(cache);
 }
 
+/*
+ * tracker_cache_deinit:
+ *
+ * Waits for the threads resolving album art and thumbnails to finish their
+ * jobs, as they use the album-art indexes and the tracker connection.
+ */
+void
+tracker_cache_deinit(void)
+{
+  if (thumbnails_pool)
+  {
+    g_thread_pool_free(thumbnails_pool, FALSE, TRUE);
+    thumbnails_pool = NULL;
+  }
+}
+
+/*
+ * tracker_cache_forget_representatives:
+ *
+ * Forgets which album the art of each artist and genre was found in, as
+ * their albums may have changed.
+ */
+void
+tracker_cache_forget_representatives(void)
+{
+  G_LOCK(representatives);
+
+  while (representatives_lru.head)
+    _remove_representative(representatives_lru.head);
+
+  G_UNLOCK(representatives);
+}
+
 /*
  * tracker_cache_key_add_precomputed:
  * @cache: the cache
@@ -432,6 +1533,7 @@ tracker_cache_key_add_precomputed(TrackerCache *cache,
     cached_value = g_new0(TrackerCacheValue, 1);
     cached_value->key_type = TRACKER_CACHE_KEY_TYPE_COMPUTED;
     cached_value->user_key = user_key;
+    cached_value->metadata_key = keymap_get_metadata(key);
     g_value_init(&cached_value->value, G_VALUE_TYPE(value));
     g_value_copy(value, &cached_value->value);
 
@@ -513,6 +1615,7 @@ tracker_cache_key_add_derived(TrackerCache *cache,
     cached_value = g_new0(TrackerCacheValue, 1);
     cached_value->key_type = TRACKER_CACHE_KEY_TYPE_DERIVED;
     cached_value->user_key = user_key;
+    cached_value->metadata_key = keymap_get_metadata(key);
     cached_value->key_derived_from = g_strdup(source_key);
 
     /* Add to cache */
@@ -569,16 +1672,17 @@ tracker_cache_key_add(TrackerCache *cache,
   }
 
   /* Insert album-art and thumbnail keys */
-  if (albumart_key_is_album_art(key) || albumart_key_is_thumbnail(key))
+  if (metadata_key->key_type != TRACKER_KEY)
   {
-    _insert_key(cache, key, TRACKER_CACHE_KEY_TYPE_THUMBNAILER, user_key, -1);
+    _insert_key(cache, key, metadata_key, TRACKER_CACHE_KEY_TYPE_THUMBNAILER,
+                user_key, -1);
     return;
   }
 
   /* With childcount, check that fits in the allowed range */
   if (metadata_key->special == SPECIAL_KEY_CHILDCOUNT)
   {
-    level = _get_childcount_level(key);
+    level = metadata_key->childcount_level;
 
     if ((level < 1) || (level > maximum_level))
       return;
@@ -587,9 +1691,10 @@ tracker_cache_key_add(TrackerCache *cache,
   /* Within the current service, check if the key makes sense (CHILDCOUNT
    * always makes sense */
   if ((metadata_key->special != SPECIAL_KEY_CHILDCOUNT) &&
-      (keymap_get_tracker_info(key, cache->tracker_type) == NULL))
+      (keymap_get_tracker_info_by_id(metadata_key->id,
+                                     cache->tracker_type) == NULL))
   {
-    _insert_key(cache, key, TRACKER_CACHE_KEY_TYPE_VOID,
+    _insert_key(cache, key, metadata_key, TRACKER_CACHE_KEY_TYPE_VOID,
                 user_key, -1);
     return;
   }
@@ -599,10 +1704,10 @@ tracker_cache_key_add(TrackerCache *cache,
   if ((cache->result_type == TRACKER_CACHE_RESULT_TYPE_UNIQUE) &&
       (metadata_key->special != SPECIAL_KEY_CHILDCOUNT) &&
       (metadata_key->special != SPECIAL_KEY_DURATION) &&
-      (metadata_key->special != SPECIAL_KEY_MIME) &&
-      !albumart_key_is_album_art(key))
+      (metadata_key->special != SPECIAL_KEY_MIME))
   {
-    _insert_key(cache, key, TRACKER_CACHE_KEY_TYPE_VOID, user_key, -1);
+    _insert_key(cache, key, metadata_key, TRACKER_CACHE_KEY_TYPE_VOID,
+                user_key, -1);
     return;
   }
 
@@ -625,15 +1730,7 @@ tracker_cache_key_add(TrackerCache *cache,
     return;
   }
 
-  /* In case of title and non-unique, ask also for URI, as it
-   * could be used as title just if there it doesn't have one */
-  if ((cache->result_type != TRACKER_CACHE_RESULT_TYPE_UNIQUE) &&
-      (metadata_key->special == SPECIAL_KEY_TITLE))
-  {
-    tracker_cache_key_add(cache, MAFW_METADATA_KEY_URI, maximum_level, FALSE);
-  }
-
-  _insert_key(cache, key, TRACKER_CACHE_KEY_TYPE_TRACKER,
+  _insert_key(cache, key, metadata_key, TRACKER_CACHE_KEY_TYPE_TRACKER,
               user_key, cache->last_tracker_index + offset);
   cache->last_tracker_index++;
 }
@@ -685,6 +1782,10 @@ tracker_cache_key_add_unique(TrackerCache *cache,
   /* Skip unsupported keys */
   if (metadata_key)
   {
+    /* Results are grouped by the first one */
+    if (!cache->unique_key)
+      cache->unique_key = g_strdup(unique_key);
+
     /* Check the key doesn't exist */
     if (g_hash_table_lookup(cache->cache, unique_key) == NULL)
     {
@@ -706,6 +1807,7 @@ tracker_cache_key_add_unique(TrackerCache *cache,
         _insert_key(
           cache,
           unique_key,
+          metadata_key,
           TRACKER_CACHE_KEY_TYPE_TRACKER,
           FALSE,
           cache->last_tracker_index);
@@ -748,8 +1850,9 @@ tracker_cache_key_add_concat(TrackerCache *cache,
   else
     user_req = FALSE;
 
-  _insert_key(cache, concat_key, TRACKER_CACHE_KEY_TYPE_TRACKER,
-              user_req, cache->last_tracker_index);
+  _insert_key(cache, concat_key, keymap_get_metadata(concat_key),
+              TRACKER_CACHE_KEY_TYPE_TRACKER, user_req,
+              cache->last_tracker_index);
 
   cache->last_tracker_index++;
 }
@@ -825,216 +1928,480 @@ tracker_cache_keys_get_user(TrackerCache *cache)
 
   g_hash_table_iter_init(&cache_iter, cache->cache);
 
-  while (g_hash_table_iter_next(
-           &cache_iter, (gpointer *)&key, (gpointer *)&value))
-  {
-    if (value->user_key)
+  while (g_hash_table_iter_next(
+           &cache_iter, (gpointer *)&key, (gpointer *)&value))
+  {
+    if (value->user_key)
+    {
+      user_keys[index] = g_strdup(key);
+      index++;
+    }
+  }
+
+  return user_keys;
+}
+
+/*
+ * tracker_cache_values_add_results:
+ * @cache: tracker cache
+ * @tracker_results: results returned by tracker.
+ *
+ * Adds to the cache the results returned by a tracker query. The cache
+ * takes ownership of them.
+ */
+void
+tracker_cache_values_add_results(TrackerCache *cache,
+                                 TrackerCacheResults *tracker_results)
+{
+  cache->tracker_results = tracker_results;
+}
+
+/*
+ * tracker_cache_values_get_results:
+ * @cache: tracker cache
+ *
+ * Returns the results obtained by tracker.
+ *
+ * Returns: results from tracker.
+ */
+const TrackerCacheResults *
+tracker_cache_values_get_results(TrackerCache *cache)
+{
+  return cache->tracker_results;
+}
+
+/*
+ * tracker_cache_results_new:
+ * @cache: tracker cache the results are for
+ * @n_columns: number of columns returned by tracker
+ *
+ * Creates an empty set of results. The type of each column is taken
+ * from the tracker key of @cache using it.
+ *
+ * Returns: new results. Must be freed with tracker_cache_results_free()
+ */
+TrackerCacheResults *
+tracker_cache_results_new(TrackerCache *cache, guint n_columns)
+{
+  TrackerCacheResults *results;
+  GHashTableIter iter;
+  gchar *key;
+  TrackerCacheValue *value;
+  guint i;
+
+  results = g_new0(TrackerCacheResults, 1);
+  results->n_columns = n_columns;
+  results->column_types = g_new0(enum _column_type, n_columns);
+  results->columns = g_new(GArray *, n_columns);
+
+  for (i = 0; i < n_columns; i++)
+  {
+    results->columns[i] = g_array_new(FALSE, TRUE,
+                                      sizeof(TrackerCacheCell));
+  }
+
+  g_hash_table_iter_init(&iter, cache->cache);
+
+  while (g_hash_table_iter_next(&iter, (gpointer *)&key, (gpointer *)&value))
+  {
+    if ((value->key_type == TRACKER_CACHE_KEY_TYPE_TRACKER) &&
+        (value->tracker_index >= 0) &&
+        (value->tracker_index < n_columns))
+    {
+      results->column_types[value->tracker_index] =
+        _get_column_type(cache, value->metadata_key);
+    }
+  }
+
+  results->strings = g_string_chunk_new(RESULTS_CHUNK_SIZE);
+  results->refstrings = g_hash_table_new_full(
+    g_str_hash, g_str_equal, (GDestroyNotify)g_ref_string_release, NULL);
+
+  return results;
+}
+
+/*
+ * tracker_cache_results_new_from_cursor:
+ * @cache: tracker cache the results are for
+ * @cursor: cursor returned by tracker
+ *
+ * Reads all the rows of @cursor.
+ *
+ * Returns: new results. Must be freed with tracker_cache_results_free()
+ */
+TrackerCacheResults *
+tracker_cache_results_new_from_cursor(TrackerCache *cache,
+                                      TrackerSparqlCursor *cursor)
+{
+  TrackerCacheResults *results;
+  gint columns = tracker_sparql_cursor_get_n_columns(cursor);
+  guint row;
+  gint i;
+
+  results = tracker_cache_results_new(cache, columns);
+
+  while (tracker_sparql_cursor_next(cursor, NULL, NULL))
+  {
+    row = tracker_cache_results_add_row(results);
+
+    for (i = 0; i < columns; i++)
+      tracker_cache_results_read(results, row, i, cursor, i);
+  }
+
+  return results;
+}
+
+/*
+ * tracker_cache_results_free:
+ * @results: results to be freed
+ *
+ * Frees the results and their contents.
+ */
+void
+tracker_cache_results_free(TrackerCacheResults *results)
+{
+  guint i;
+
+  for (i = 0; i < results->n_columns; i++)
+    g_array_free(results->columns[i], TRUE);
+
+  if (results->order)
+    g_array_free(results->order, TRUE);
+
+  g_string_chunk_free(results->strings);
+  g_hash_table_unref(results->refstrings);
+  g_free(results->columns);
+  g_free(results->column_types);
+  g_free(results);
+}
+
+/*
+ * tracker_cache_results_add_row:
+ * @results: tracker results
+ *
+ * Adds an empty row at the end of the stored rows.
+ *
+ * Returns: the index of the new row.
+ */
+guint
+tracker_cache_results_add_row(TrackerCacheResults *results)
+{
+  guint i;
+
+  for (i = 0; i < results->n_columns; i++)
+    g_array_set_size(results->columns[i], results->n_stored + 1);
+
+  return results->n_stored++;
+}
+
+/*
+ * tracker_cache_results_read:
+ * @results: tracker results
+ * @row: stored row to fill
+ * @column: column to fill
+ * @cursor: cursor pointing to the row returned by tracker
+ * @cursor_column: column of @cursor to read
+ *
+ * Reads a cell of @cursor with the getter matching the type of @column,
+ * so values don't need to be parsed again when building metadata.
+ */
+void
+tracker_cache_results_read(TrackerCacheResults *results,
+                           guint row,
+                           guint column,
+                           TrackerSparqlCursor *cursor,
+                           gint cursor_column)
+{
+  TrackerCacheCell *cell;
+  TrackerSparqlValueType type;
+  const gchar *s;
+
+  g_return_if_fail(row < results->n_stored);
+
+  if (column >= results->n_columns)
+    return;
+
+  cell = &g_array_index(results->columns[column], TrackerCacheCell, row);
+  type = tracker_sparql_cursor_get_value_type(cursor, cursor_column);
+
+  if (type == TRACKER_SPARQL_VALUE_TYPE_UNBOUND)
+    return;
+
+  switch (results->column_types[column])
+  {
+    case COLUMN_TYPE_INTEGER:
+    {
+      if (type == TRACKER_SPARQL_VALUE_TYPE_BOOLEAN)
+      {
+        cell->integer = tracker_sparql_cursor_get_boolean(cursor,
+                                                          cursor_column);
+      }
+      else if (type == TRACKER_SPARQL_VALUE_TYPE_DOUBLE)
+      {
+        cell->integer = tracker_sparql_cursor_get_double(cursor,
+                                                         cursor_column);
+      }
+      else if (type == TRACKER_SPARQL_VALUE_TYPE_INTEGER)
+      {
+        cell->integer = tracker_sparql_cursor_get_integer(cursor,
+                                                          cursor_column);
+      }
+      else
+      {
+        s = tracker_sparql_cursor_get_string(cursor, cursor_column, NULL);
+        cell->integer = s ? g_ascii_strtoll(s, NULL, 10) : 0;
+      }
+
+      break;
+    }
+    case COLUMN_TYPE_DOUBLE:
+    {
+      if ((type == TRACKER_SPARQL_VALUE_TYPE_DOUBLE) ||
+          (type == TRACKER_SPARQL_VALUE_TYPE_INTEGER))
+      {
+        cell->real = tracker_sparql_cursor_get_double(cursor, cursor_column);
+      }
+      else
+      {
+        s = tracker_sparql_cursor_get_string(cursor, cursor_column, NULL);
+        cell->real = s ? g_ascii_strtod(s, NULL) : 0;
+      }
+
+      break;
+    }
+    case COLUMN_TYPE_EPOCH:
+    case COLUMN_TYPE_YEAR:
+    {
+      gboolean year = results->column_types[column] == COLUMN_TYPE_YEAR;
+
+      /* Already computed by the query */
+      if (type == TRACKER_SPARQL_VALUE_TYPE_INTEGER)
+      {
+        cell->integer = tracker_sparql_cursor_get_integer(cursor,
+                                                          cursor_column);
+        break;
+      }
+
+      s = tracker_sparql_cursor_get_string(cursor, cursor_column, NULL);
+
+      if (!s)
+        s = "";
+
+      if (year)
+        cell->integer = util_iso8601_to_year(s);
+      else
+        cell->integer = util_iso8601_to_epoch(s);
+
+      break;
+    }
+    default:
     {
-      user_keys[index] = g_strdup(key);
-      index++;
+      glong length = 0;
+
+      s = tracker_sparql_cursor_get_string(cursor, cursor_column, &length);
+
+      /* Empty strings are left unset */
+      if (s && (length > 0))
+      {
+        /* Released with the results and the metadata holding them,
+         * unlike g_intern_string() */
+        if (results->column_types[column] == COLUMN_TYPE_INTERNED)
+          cell->string = _results_refstring(results, s);
+        else
+          cell->string = g_string_chunk_insert_len(results->strings, s,
+                                                   length);
+      }
+
+      break;
     }
   }
-
-  return user_keys;
 }
 
 /*
- * tracker_cache_values_add_results:
- * @cache: tracker cache
- * @tracker_results: results returned by tracker.
+ * tracker_cache_results_add_order:
+ * @results: tracker results
+ * @row: stored row
  *
- * Adds to the cache the results returned by a tracker query.
+ * Appends @row to the order in which results are returned. Once used,
+ * only the rows added this way are returned, so rows can be reordered
+ * and repeated without copying them.
  */
 void
-tracker_cache_values_add_results(TrackerCache *cache,
-                                 GPtrArray *tracker_results)
+tracker_cache_results_add_order(TrackerCacheResults *results, guint row)
 {
-  cache->tracker_results = tracker_results;
+  g_return_if_fail(row < results->n_stored);
+
+  if (!results->order)
+    results->order = g_array_new(FALSE, FALSE, sizeof(guint));
+
+  g_array_append_val(results->order, row);
 }
 
 /*
- * tracker_cache_values_add_result:
- * @cache: tracker cache
- * @tracker_result: result returned by tracker with tracker_get_metadata
+ * tracker_cache_results_add_missing:
+ * @results: tracker results
  *
- * Adds to the cache the result returned by getting metadata from
- * tracker. Warning! Only works if cache was created with
- * TRACKER_CACHE_RESULT_TYPE_GET_METADATA.
+ * Appends a result tracker returned nothing for, see
+ * tracker_cache_results_add_order(). tracker_cache_build_metadata() gives
+ * NULL for it.
  */
 void
-tracker_cache_values_add_result(TrackerCache *cache,
-                                gchar **tracker_result)
+tracker_cache_results_add_missing(TrackerCacheResults *results)
 {
-  g_return_if_fail(
-    cache->result_type == TRACKER_CACHE_RESULT_TYPE_GET_METADATA);
+  guint row = RESULTS_ROW_MISSING;
 
-  /* Wrap the result around a gptrarray */
-  cache->tracker_results = g_ptr_array_sized_new(1);
-  g_ptr_array_add(cache->tracker_results, tracker_result);
+  if (!results->order)
+    results->order = g_array_new(FALSE, FALSE, sizeof(guint));
+
+  g_array_append_val(results->order, row);
 }
 
 /*
- * tracker_cache_values_get_results:
- * @cache: tracker cache
- *
- * Returns the results obtained by tracker.
+ * tracker_cache_results_length:
+ * @results: tracker results, or NULL
  *
- * Returns: results from tracker.
+ * Returns: the number of results.
  */
-const GPtrArray *
-tracker_cache_values_get_results(TrackerCache *cache)
+gint
+tracker_cache_results_length(const TrackerCacheResults *results)
 {
-  return cache->tracker_results;
+  if (!results)
+    return 0;
+
+  if (results->order)
+    return results->order->len;
+
+  return results->n_stored;
 }
 
 /*
- * tracker_cache_value_get:
+ * tracker_cache_value_get_into:
  * @cache: tracker cache
  * @key: key to query
  * @index: which result should be used (from tracker), or -1 if none.
+ * @value: an unset GValue where to store the value
  *
- * Returns  the  value  associated  with  the key,  or  @NULL  if  not
- * present. If  -1 is used  as index, then  it doesn't use  any result
- * from tracker, but those that were precomputed.
+ * Like tracker_cache_value_get(), but stores the value in @value instead of
+ * allocating a new one. If there is no value, @value is left unset.
  *
- * Returns: the value for the queried key. Must be freed.
+ * Returns: @TRUE if @value was set. Then it must be unset.
  */
-GValue *
-tracker_cache_value_get(TrackerCache *cache,
-                        const gchar *key,
-                        gint index)
+gboolean
+tracker_cache_value_get_into(TrackerCache *cache,
+                             const gchar *key,
+                             gint index,
+                             GValue *value)
 {
-  GValue *return_value = NULL;
   TrackerCacheValue *cached_value = NULL;
-  gchar **queried_result = NULL;
-  float float_val = 0;
   MetadataKey *metadata_key;
+  gint row;
 
   cached_value = g_hash_table_lookup(cache->cache, key);
 
   /* Check if key is present */
   if (!cached_value)
   {
-    return NULL;
+    return FALSE;
   }
 
   /* If the value was precomputed */
   if (cached_value->key_type == TRACKER_CACHE_KEY_TYPE_COMPUTED)
   {
     /* Precalculated value */
-    return_value = g_new0(GValue, 1);
-    g_value_init(return_value, G_VALUE_TYPE(&cached_value->value));
-    g_value_copy(&cached_value->value, return_value);
-    return return_value;
+    g_value_init(value, G_VALUE_TYPE(&cached_value->value));
+    g_value_copy(&cached_value->value, value);
+    return TRUE;
   }
 
   /* if the value is derived */
   if (cached_value->key_type == TRACKER_CACHE_KEY_TYPE_DERIVED)
   {
-    return tracker_cache_value_get(cache,
-                                   cached_value->key_derived_from,
-                                   index);
+    return tracker_cache_value_get_into(cache,
+                                        cached_value->key_derived_from,
+                                        index,
+                                        value);
   }
 
   /* If the value must be obtained from hildon-thumbnailer */
   if (cached_value->key_type == TRACKER_CACHE_KEY_TYPE_THUMBNAILER)
   {
-    if (strcmp(key, MAFW_METADATA_KEY_ALBUM_ART_URI) == 0)
-      return _get_value_album_art(cache, index);
-    else
-      return _get_value_thumbnail(cache, key, index);
-  }
+    TrackerCacheThumbnails *thumbnails = cache->thumbnails;
 
-  /* If the value must be obtained from tracker */
-  if (cached_value->key_type == TRACKER_CACHE_KEY_TYPE_TRACKER)
-  {
-    /* Check if the value can be obtained from tracker */
-    if (index < 0)
-      return NULL;
+    /* Use the value resolved in background, if any */
+    if (thumbnails && thumbnails->done && (index >= 0) &&
+        (index < thumbnails->n_rows))
+    {
+      guint i;
 
-    /* Verify there is data, and index is within the range */
-    if (!cache->tracker_results || (cache->tracker_results->len <= index))
-      return NULL;
+      for (i = 0; i < thumbnails->n_keys; i++)
+      {
+        if (strcmp(thumbnails->keys[i], key) == 0)
+        {
+          const gchar *th_uri = thumbnails->values[index *
+                                                   thumbnails->n_keys + i];
 
-    queried_result = (gchar **)g_ptr_array_index(cache->tracker_results, index);
+          if (!th_uri)
+            return FALSE;
 
-    /* Verify that tracked found the metadata for the corresponding
-     * entry */
-    if (!queried_result[0])
-      return NULL;
+          g_value_init(value, G_TYPE_STRING);
+          g_value_set_string(value, th_uri);
+          return TRUE;
+        }
+      }
+    }
 
-    return_value = g_new0(GValue, 1);
-    metadata_key = keymap_get_metadata(key);
+    return _get_value_thumbnailer(cache, cached_value->metadata_key, index,
+                                  value);
+  }
 
-    switch (metadata_key->value_type)
-    {
-      case G_TYPE_INT:
-      {
-        g_value_init(return_value, G_TYPE_INT);
-        g_value_set_int(return_value,
-                        atoi(queried_result[cached_value->tracker_index]));
-        break;
-      }
+  /* If the value must be obtained from tracker */
+  if (cached_value->key_type == TRACKER_CACHE_KEY_TYPE_TRACKER)
+  {
+    /* Verify there is data, and index is within the range */
+    row = _results_get_row(cache->tracker_results, index);
 
-      case G_TYPE_LONG:
-      {
-        g_value_init(return_value, G_TYPE_LONG);
-        g_value_set_long(return_value,
-                         atol(queried_result[cached_value->tracker_index]));
-        break;
-      }
-      case G_TYPE_FLOAT:
-      {
-        g_value_init(return_value, G_TYPE_FLOAT);
-        sscanf(queried_result[cached_value->tracker_index], "%f", &float_val);
-        g_value_set_float(return_value, float_val);
-        break;
-      }
+    if (row < 0)
+      return FALSE;
 
-      case G_TYPE_BOOLEAN:
-      {
-        g_value_init(return_value, G_TYPE_BOOLEAN);
+    metadata_key = cached_value->metadata_key;
 
-        if (queried_result[cached_value->tracker_index][0] == '0')
-          g_value_set_boolean(return_value, FALSE);
-        else
-          g_value_set_boolean(return_value, TRUE);
+    _value_from_results(cache->tracker_results, row,
+                        cached_value->tracker_index,
+                        metadata_key->value_type, value);
+    return TRUE;
+  }
 
-        break;
-      }
+  return FALSE;
+}
 
-      default:
-      {
-        if (metadata_key->value_type == G_TYPE_DATE)
-        {
-          const gchar *iso_date = queried_result[cached_value->tracker_index];
-
-          if (!strcmp(key, MAFW_METADATA_KEY_YEAR))
-          {
-            g_value_init(return_value, G_TYPE_INT);
-            g_value_set_int(return_value, util_iso8601_to_year(iso_date));
-          }
-          else
-          {
-            g_value_init(return_value, G_TYPE_LONG);
-            g_value_set_long(return_value, util_iso8601_to_epoch(iso_date));
-          }
-
-          break;
-        }
+/*
+ * tracker_cache_value_get:
+ * @cache: tracker cache
+ * @key: key to query
+ * @index: which result should be used (from tracker), or -1 if none.
+ *
+ * Returns  the  value  associated  with  the key,  or  @NULL  if  not
+ * present. If  -1 is used  as index, then  it doesn't use  any result
+ * from tracker, but those that were precomputed.
+ *
+ * Returns: the value for the queried key. Must be freed.
+ */
+GValue *
+tracker_cache_value_get(TrackerCache *cache,
+                        const gchar *key,
+                        gint index)
+{
+  GValue *return_value;
 
-        g_value_init(return_value, G_TYPE_STRING);
-        /* Special case: convert pathname to URI */
-        g_value_set_string(return_value,
-                           queried_result[cached_value->tracker_index]);
-        break;
-      }
-    }
+  return_value = g_new0(GValue, 1);
 
-    return return_value;
+  if (!tracker_cache_value_get_into(cache, key, index, return_value))
+  {
+    g_free(return_value);
+    return NULL;
   }
 
-  return NULL;
+  return return_value;
 }
 
 /*
@@ -1043,39 +2410,99 @@ tracker_cache_value_get(TrackerCache *cache,
  *
  * Builds a list of MAFW-metadata from cached results.
  *
- * Returns: list of MAFW-metadata
+ * Returns: list of MAFW-metadata, one per result. It is NULL for the
+ * results without metadata. When getting metadata, it is only NULL for the
+ * clips tracker does not have, the others get at least an empty one. Values
+ * are added to them with tracker_cache_metadata_add_int().
  */
 GList *
 tracker_cache_build_metadata(TrackerCache *cache, const gchar **path_list)
 {
   GList *mafw_list = NULL;
-  gchar **user_keys;
-  GValue *value;
+  TrackerCachePlan *plan;
+  const GValue **computed;
+  const GValue *uri_computed;
+  GValue *shared;
+  GValue value = G_VALUE_INIT;
+  gboolean has_value;
   gint result_index;
-  gint key_index;
+  guint key_index;
   gint requested_metadatas;
   GHashTable *metadata = NULL;
 
-  /* Get the list of keys user requested */
-  user_keys = tracker_cache_keys_get_user(cache);
+  /* Get how to obtain the keys user requested */
+  plan = _plan_get(cache);
+
+  /* Precomputed values are the same for all the results, so they are
+   * checked and converted only once, and added as they are */
+  computed = g_new(const GValue *, plan->n_entries);
+  shared = g_new0(GValue, plan->n_entries);
+
+  for (key_index = 0; key_index < plan->n_entries; key_index++)
+  {
+    const struct _plan_entry *entry = &plan->entries[key_index];
+
+    computed[key_index] = _plan_entry_computed(cache, entry);
+
+    if (computed[key_index] && !entry->title &&
+        _value_is_allowed(computed[key_index], entry->metadata_key))
+    {
+      g_value_init(&shared[key_index], G_VALUE_TYPE(computed[key_index]));
+      g_value_copy(computed[key_index], &shared[key_index]);
+      _replace_various_values(&shared[key_index]);
+    }
+  }
+
+  uri_computed = _plan_entry_computed(cache, &plan->uri);
 
   /* If there aren't results from tracker, there is even a chance of being
    * able to build metadata with precomputed values */
-  if (!cache->tracker_results || (cache->tracker_results->len == 0))
+  requested_metadatas = tracker_cache_results_length(cache->tracker_results);
+
+  if (requested_metadatas == 0)
     requested_metadatas = 1;
-  else
-    requested_metadatas = cache->tracker_results->len;
 
   /* Create metadata */
   for (result_index = 0; result_index < requested_metadatas; result_index++)
   {
-    metadata = mafw_metadata_new();
+    /* Not even precomputed values for what tracker does not have */
+    if (_results_row_missing(cache->tracker_results, result_index))
+    {
+      mafw_list = g_list_prepend(mafw_list, NULL);
+      continue;
+    }
+
+    metadata = _metadata_new();
 
-    for (key_index = 0; user_keys[key_index]; key_index++)
+    for (key_index = 0; key_index < plan->n_entries; key_index++)
     {
+      const struct _plan_entry *entry = &plan->entries[key_index];
+      const gchar *refstring;
+
+      /* Thumbnailer keys are added by tracker_cache_thumbnails_merge() */
+      if (cache->thumbnails && (entry->op == PLAN_OP_THUMBNAILER))
+        continue;
+
+      if ((entry->op == PLAN_OP_COMPUTED) && !entry->title)
+      {
+        if (G_IS_VALUE(&shared[key_index]))
+          _metadata_add_val(metadata, entry->key, &shared[key_index]);
+
+        continue;
+      }
+
+      /* Interned strings are not copied */
+      refstring = _plan_entry_refstring(cache, entry, result_index);
+
+      if (refstring)
+      {
+        _metadata_add_shared(metadata, entry->key, refstring);
+        continue;
+      }
+
       /* Special cache: title must use filename if
        * it doesn't contain title */
-      if (strcmp(user_keys[key_index], MAFW_METADATA_KEY_TITLE) == 0)
+      if (entry->title)
       {
         const gchar *cur_path;
 
@@ -1084,26 +2511,31 @@ tracker_cache_build_metadata(TrackerCache *cache, const gchar **path_list)
         else
           cur_path = NULL;
 
-        value = _get_title(cache, result_index, cur_path);
+        has_value = _plan_get_title(cache, plan, entry, computed[key_index],
+                                    uri_computed, result_index, cur_path,
+                                    &value);
       }
       else
       {
-        value = tracker_cache_value_get(cache,
-                                        user_keys[key_index],
-                                        result_index);
+        has_value = _plan_entry_value(cache, entry, computed[key_index],
+                                      result_index, &value);
       }
 
-      if (_value_is_allowed(value, user_keys[key_index]))
+      if (!has_value)
+        continue;
+
+      if (_value_is_allowed(&value, entry->metadata_key))
       {
-        _replace_various_values(value);
-        mafw_metadata_add_val(metadata, user_keys[key_index], value);
+        _replace_various_values(&value);
+        _metadata_add_val(metadata, entry->key, &value);
       }
 
-      util_gvalue_free(value);
+      g_value_unset(&value);
     }
 
     /* If we didn't get any metadata, add a NULL */
-    if (g_hash_table_size(metadata) == 0)
+    if ((g_hash_table_size(metadata) == 0) &&
+        (cache->result_type != TRACKER_CACHE_RESULT_TYPE_GET_METADATA))
     {
       mafw_metadata_release(metadata);
       mafw_list = g_list_prepend(mafw_list, NULL);
@@ -1116,11 +2548,39 @@ tracker_cache_build_metadata(TrackerCache *cache, const gchar **path_list)
   mafw_list = g_list_reverse(mafw_list);
 
   /* Free unneeded data */
-  g_strfreev(user_keys);
+  for (key_index = 0; key_index < plan->n_entries; key_index++)
+  {
+    if (G_IS_VALUE(&shared[key_index]))
+      g_value_unset(&shared[key_index]);
+  }
+
+  g_free(shared);
+  g_free(computed);
 
   return mafw_list;
 }
 
+/*
+ * tracker_cache_metadata_add_int:
+ * @metadata: MAFW-metadata returned by tracker_cache_build_metadata()
+ * @key: key to set
+ * @value: value of @key
+ *
+ * Sets an integer in metadata built by the cache. These tables own
+ * references to the strings of the cache, so they are not filled with
+ * mafw_metadata_add_int().
+ */
+void
+tracker_cache_metadata_add_int(GHashTable *metadata, const gchar *key,
+                               gint value)
+{
+  GValue gvalue = G_VALUE_INIT;
+
+  g_value_init(&gvalue, G_TYPE_INT);
+  g_value_set_int(&gvalue, value);
+  _metadata_add_val(metadata, key, &gvalue);
+}
+
 /*
  * tracker_cache_build_metadata_aggregated:
  * @cache: tracker cache
@@ -1135,46 +2595,292 @@ GHashTable *
 tracker_cache_build_metadata_aggregated(TrackerCache *cache,
                                         gboolean count_childcount)
 {
-  gchar **user_keys;
-  gint key_index;
-  GValue *value;
+  TrackerCachePlan *plan;
+  guint key_index;
+  GValue value = G_VALUE_INIT;
+  gboolean has_value;
   GHashTable *metadata;
-  MetadataKey *metadata_key;
 
-  /* Get the list of user-requested keys */
-  user_keys = tracker_cache_keys_get_user(cache);
+  /* Get how to obtain the keys user requested */
+  plan = _plan_get(cache);
 
   /* Create metadata */
   metadata = mafw_metadata_new();
 
-  for (key_index = 0; user_keys[key_index]; key_index++)
+  for (key_index = 0; key_index < plan->n_entries; key_index++)
   {
-    metadata_key = keymap_get_metadata(user_keys[key_index]);
+    const struct _plan_entry *entry = &plan->entries[key_index];
+    const GValue *computed = _plan_entry_computed(cache, entry);
 
     /* Special cases */
-    if ((metadata_key->special == SPECIAL_KEY_CHILDCOUNT) ||
-        (metadata_key->special == SPECIAL_KEY_DURATION))
+    if ((entry->metadata_key->special == SPECIAL_KEY_CHILDCOUNT) ||
+        (entry->metadata_key->special == SPECIAL_KEY_DURATION))
     {
-      value = _aggregate_key(cache, user_keys[key_index],
-                             count_childcount);
+      _plan_aggregate(cache, entry, computed, count_childcount, &value);
+      has_value = TRUE;
     }
     else
-      value = tracker_cache_value_get(cache, user_keys[key_index], 0);
+      has_value = _plan_entry_value(cache, entry, computed, 0, &value);
 
-    if (_value_is_allowed(value, user_keys[key_index]))
+    if (!has_value)
+      continue;
+
+    if (_value_is_allowed(&value, entry->metadata_key))
     {
-      _replace_various_values(value);
-      mafw_metadata_add_val(metadata, user_keys[key_index], value);
+      _replace_various_values(&value);
+      mafw_metadata_add_val(metadata, entry->key, &value);
     }
 
-    util_gvalue_free(value);
+    g_value_unset(&value);
   }
 
-  g_strfreev(user_keys);
-
   return metadata;
 }
 
+/*
+ * tracker_cache_thumbnails_resolve:
+ * @cache: tracker cache, with the results already added
+ * @deferred: @TRUE to only wait for values not resolved before
+ * @callback: function to call when all the values are resolved
+ * @user_data: data to pass to @callback
+ *
+ * Starts resolving, in a pool of worker threads, the album-art and thumbnail
+ * keys requested by the user for all the results. While this is going on,
+ * tracker_cache_build_metadata() skips those keys; once @callback has been
+ * called, use tracker_cache_thumbnails_merge() to add them.
+ *
+ * With @deferred, values already resolved for the same album or URI in
+ * previous requests are available at once through
+ * tracker_cache_thumbnails_merge(), and only the remaining rows are given to
+ * the workers. Use tracker_cache_thumbnails_row_deferred() from @callback to
+ * know which rows got new values.
+ *
+ * Returns: @TRUE if @callback will be called, @FALSE if there is nothing to
+ * resolve.
+ */
+gboolean
+tracker_cache_thumbnails_resolve(TrackerCache *cache,
+                                 gboolean deferred,
+                                 TrackerCacheThumbnailsCB callback,
+                                 gpointer user_data)
+{
+  TrackerCacheThumbnails *thumbnails;
+  GPtrArray *keys;
+  GHashTableIter iter;
+  gchar *key;
+  TrackerCacheValue *value;
+  gboolean need_album = FALSE;
+  gboolean need_uri = FALSE;
+  guint row;
+  guint i;
+
+  g_return_val_if_fail(cache->thumbnails == NULL, FALSE);
+
+  keys = g_ptr_array_new();
+  g_hash_table_iter_init(&iter, cache->cache);
+
+  while (g_hash_table_iter_next(&iter, (gpointer *)&key, (gpointer *)&value))
+  {
+    if (value->user_key &&
+        (value->key_type == TRACKER_CACHE_KEY_TYPE_THUMBNAILER))
+    {
+      g_ptr_array_add(keys, g_strdup(key));
+    }
+  }
+
+  if (keys->len == 0)
+  {
+    g_ptr_array_free(keys, TRUE);
+    return FALSE;
+  }
+
+  if (!thumbnails_pool)
+  {
+    thumbnails_pool = g_thread_pool_new(_thumbnails_job_run, NULL,
+                                        g_get_num_processors(), FALSE, NULL);
+  }
+
+  thumbnails = g_new0(TrackerCacheThumbnails, 1);
+  thumbnails->cache = cache;
+  thumbnails->deferred = deferred;
+  thumbnails->callback = callback;
+  thumbnails->user_data = user_data;
+  thumbnails->n_keys = keys->len;
+  g_ptr_array_add(keys, NULL);
+  thumbnails->keys = (gchar **)g_ptr_array_free(keys, FALSE);
+  thumbnails->kinds = g_new(enum _thumbnailer_kind, thumbnails->n_keys);
+
+  for (i = 0; i < thumbnails->n_keys; i++)
+  {
+    thumbnails->kinds[i] =
+      _get_thumbnailer_kind(keymap_get_metadata(thumbnails->keys[i]));
+
+    if (thumbnails->kinds[i] == THUMBNAILER_KIND_THUMBNAIL)
+      need_uri = TRUE;
+    else
+      need_album = TRUE;
+  }
+
+  /* Same number of rows tracker_cache_build_metadata() creates */
+  thumbnails->n_rows = tracker_cache_results_length(cache->tracker_results);
+
+  if (thumbnails->n_rows == 0)
+    thumbnails->n_rows = 1;
+
+  /* Workers must not touch the cache, so copy what they need */
+  thumbnails->albums = g_new0(gchar *, thumbnails->n_rows);
+  thumbnails->uris = g_new0(gchar *, thumbnails->n_rows);
+  thumbnails->containers = g_new0(gchar *, thumbnails->n_rows);
+  thumbnails->values = g_new0(gchar *,
+                              thumbnails->n_rows * thumbnails->n_keys);
+  thumbnails->rows = g_new(guint, thumbnails->n_rows);
+  thumbnails->missing = g_new0(gboolean, thumbnails->n_rows);
+
+  for (row = 0; row < thumbnails->n_rows; row++)
+  {
+    /* Its metadata is NULL, nothing to add to */
+    if (_results_row_missing(cache->tracker_results, row))
+      continue;
+
+    if (need_album)
+    {
+      thumbnails->containers[row] = _get_container(cache, row);
+      thumbnails->albums[row] = _get_string(cache, MAFW_METADATA_KEY_ALBUM,
+                                            row);
+    }
+
+    if (need_uri)
+    {
+      thumbnails->uris[row] = _get_string(cache, MAFW_METADATA_KEY_URI,
+                                          row);
+    }
+
+    if (deferred)
+    {
+      for (i = 0; i < thumbnails->n_keys; i++)
+      {
+        gchar *value = _lookup_resolved(thumbnails->kinds[i],
+                                        thumbnails->containers[row],
+                                        thumbnails->albums[row],
+                                        thumbnails->uris[row]);
+
+        if (!value)
+          thumbnails->missing[row] = TRUE;
+
+        thumbnails->values[row * thumbnails->n_keys + i] = value;
+      }
+
+      if (!thumbnails->missing[row])
+        continue;
+    }
+
+    thumbnails->rows[thumbnails->n_resolve_rows++] = row;
+  }
+
+  cache->thumbnails = thumbnails;
+
+  if (thumbnails->n_resolve_rows == 0)
+  {
+    thumbnails->done = TRUE;
+    return FALSE;
+  }
+
+  thumbnails->pending =
+    (thumbnails->n_resolve_rows + THUMBNAILS_ROWS_PER_JOB - 1) /
+    THUMBNAILS_ROWS_PER_JOB;
+
+  for (row = 0; row < thumbnails->n_resolve_rows;
+       row += THUMBNAILS_ROWS_PER_JOB)
+  {
+    struct _thumbnails_job *job = g_new(struct _thumbnails_job, 1);
+
+    job->thumbnails = thumbnails;
+    job->first = row;
+    job->last = MIN(row + THUMBNAILS_ROWS_PER_JOB,
+                    thumbnails->n_resolve_rows);
+    g_thread_pool_push(thumbnails_pool, job, NULL);
+  }
+
+  return TRUE;
+}
+
+/*
+ * tracker_cache_thumbnails_merge:
+ * @cache: tracker cache
+ * @metadata_list: list returned by tracker_cache_build_metadata()
+ *
+ * Adds the values resolved by tracker_cache_thumbnails_resolve() to the
+ * metadata built from the same cache. Rows without metadata get a new one if
+ * some value was resolved. In deferred mode it can be used before the
+ * workers finish, and rows still being resolved are skipped.
+ */
+void
+tracker_cache_thumbnails_merge(TrackerCache *cache, GList *metadata_list)
+{
+  TrackerCacheThumbnails *thumbnails = cache->thumbnails;
+  GList *iter;
+  guint row;
+  guint i;
+
+  g_return_if_fail(thumbnails && (thumbnails->done || thumbnails->deferred));
+
+  for (iter = metadata_list, row = 0;
+       iter && row < thumbnails->n_rows;
+       iter = iter->next, row++)
+  {
+    if (!thumbnails->done && thumbnails->missing[row])
+      continue;
+
+    for (i = 0; i < thumbnails->n_keys; i++)
+    {
+      const gchar *th_uri = thumbnails->values[row * thumbnails->n_keys + i];
+      GValue value = G_VALUE_INIT;
+
+      if (IS_STRING_EMPTY(th_uri))
+        continue;
+
+      if (!iter->data)
+        iter->data = _metadata_new();
+
+      g_value_init(&value, G_TYPE_STRING);
+      g_value_set_static_string(&value, th_uri);
+      _metadata_add_val(iter->data, thumbnails->keys[i], &value);
+      g_value_unset(&value);
+    }
+  }
+}
+
+/*
+ * tracker_cache_thumbnails_row_deferred:
+ * @cache: tracker cache
+ * @row: index of the result
+ *
+ * Tells whether the values of a row were left out when resolving in deferred
+ * mode, and have been resolved since then.
+ *
+ * Returns: @TRUE if @row has new values
+ */
+gboolean
+tracker_cache_thumbnails_row_deferred(TrackerCache *cache, guint row)
+{
+  TrackerCacheThumbnails *thumbnails = cache->thumbnails;
+  guint i;
+
+  if (!thumbnails || !thumbnails->done || (row >= thumbnails->n_rows) ||
+      !thumbnails->missing[row])
+  {
+    return FALSE;
+  }
+
+  for (i = 0; i < thumbnails->n_keys; i++)
+  {
+    if (!IS_STRING_EMPTY(thumbnails->values[row * thumbnails->n_keys + i]))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
 /*
  * tracker_cache_key_exists:
  * @cache: tracker cache
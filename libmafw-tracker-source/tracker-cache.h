@@ -27,6 +27,9 @@
 
 #include <glib-object.h>
 #include <glib.h>
+#include <tracker-sparql.h>
+
+#include "key-mapping.h"
 
 /* How the key should be managed in the cache */
 enum TrackerCacheKeyType
@@ -62,6 +65,8 @@ typedef struct TrackerCacheValue
   enum TrackerCacheKeyType key_type;
   /* Has the user asked for this key? */
   gboolean user_key;
+  /* Description of the key, NULL if unknown */
+  MetadataKey *metadata_key;
   union
   {
     /* Pre-computed/fixed keys */
@@ -73,6 +78,12 @@ typedef struct TrackerCacheValue
   };
 } TrackerCacheValue;
 
+/* Typed results returned by tracker */
+typedef struct TrackerCacheResults TrackerCacheResults;
+
+/* Album-art and thumbnail keys resolved in background */
+typedef struct TrackerCacheThumbnails TrackerCacheThumbnails;
+
 /* The cache where to store the values */
 typedef struct TrackerCache
 {
@@ -82,12 +93,19 @@ typedef struct TrackerCache
   enum TrackerCacheResultType result_type;
   /* The service used with tracker */
   TrackerObjectType tracker_type;
+  /* The key results are grouped by, with TRACKER_CACHE_RESULT_TYPE_UNIQUE */
+  gchar *unique_key;
   /* Values returned by tracker */
-  GPtrArray *tracker_results;
+  TrackerCacheResults *tracker_results;
   /* The list of keys */
   GHashTable *cache;
+  /* Thumbnailer keys being resolved in background, if any */
+  TrackerCacheThumbnails *thumbnails;
 } TrackerCache;
 
+typedef void (*TrackerCacheThumbnailsCB)(TrackerCache *cache,
+                                         gpointer user_data);
+
 TrackerCache *
 tracker_cache_new(TrackerObjectType tracker_type,
                   enum TrackerCacheResultType result_type);
@@ -95,6 +113,12 @@ tracker_cache_new(TrackerObjectType tracker_type,
 void
 tracker_cache_free(TrackerCache *cache);
 
+void
+tracker_cache_deinit(void);
+
+void
+tracker_cache_forget_representatives(void);
+
 void
 tracker_cache_key_add_precomputed(TrackerCache *cache,
                                   const gchar *key,
@@ -150,27 +174,74 @@ tracker_cache_keys_get_user(TrackerCache *cache);
 
 void
 tracker_cache_values_add_results(TrackerCache *cache,
-                                 GPtrArray *tracker_results);
+                                 TrackerCacheResults *tracker_results);
+
+const TrackerCacheResults *
+tracker_cache_values_get_results(TrackerCache *cache);
+
+TrackerCacheResults *
+tracker_cache_results_new(TrackerCache *cache, guint n_columns);
+
+TrackerCacheResults *
+tracker_cache_results_new_from_cursor(TrackerCache *cache,
+                                      TrackerSparqlCursor *cursor);
 
 void
-tracker_cache_values_add_result(TrackerCache *cache,
-                                gchar **tracker_result);
+tracker_cache_results_free(TrackerCacheResults *results);
 
-const GPtrArray *
-tracker_cache_values_get_results(TrackerCache *cache);
+guint
+tracker_cache_results_add_row(TrackerCacheResults *results);
+
+void
+tracker_cache_results_read(TrackerCacheResults *results,
+                           guint row,
+                           guint column,
+                           TrackerSparqlCursor *cursor,
+                           gint cursor_column);
+
+void
+tracker_cache_results_add_order(TrackerCacheResults *results, guint row);
+
+void
+tracker_cache_results_add_missing(TrackerCacheResults *results);
+
+gint
+tracker_cache_results_length(const TrackerCacheResults *results);
 
 GValue *
 tracker_cache_value_get(TrackerCache *cache,
                         const gchar *key,
                         gint index);
 
+gboolean
+tracker_cache_value_get_into(TrackerCache *cache,
+                             const gchar *key,
+                             gint index,
+                             GValue *value);
+
 GList *
 tracker_cache_build_metadata(TrackerCache *cache, const gchar **path_list);
 
+void
+tracker_cache_metadata_add_int(GHashTable *metadata, const gchar *key,
+                               gint value);
+
 GHashTable *
 tracker_cache_build_metadata_aggregated(TrackerCache *cache,
                                         gboolean count_childcount);
 
+gboolean
+tracker_cache_thumbnails_resolve(TrackerCache *cache,
+                                 gboolean deferred,
+                                 TrackerCacheThumbnailsCB callback,
+                                 gpointer user_data);
+
+void
+tracker_cache_thumbnails_merge(TrackerCache *cache, GList *metadata_list);
+
+gboolean
+tracker_cache_thumbnails_row_deferred(TrackerCache *cache, guint row);
+
 gboolean
 tracker_cache_key_exists(TrackerCache *cache,
                          const gchar *key);
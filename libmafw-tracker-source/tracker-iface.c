@@ -54,7 +54,8 @@
 #define TRACKER_SERVICE "org.freedesktop.Tracker3.Miner.Files"
 
 /* Stores information needed to invoke MAFW's callback after getting
-   results from tracker */
+   results from tracker. It is freed after the callback, or once the
+   thumbnails are resolved, so it is not taken from the request pool. */
 struct _mafw_query_closure
 {
   /* Mafw callback */
@@ -63,6 +64,16 @@ struct _mafw_query_closure
   gpointer user_data;
   /* Cache to store keys and values */
   TrackerCache *cache;
+  /* Result waiting for the thumbnails */
+  MafwResult *result;
+  /* Result was emitted without the thumbnails not resolved yet */
+  gboolean deferred;
+  /* Where to tell about rows completed later, see ti_watch_deferred_art() */
+  GObject *source;
+  gchar **object_ids;
+  guint n_object_ids;
+  /* Storage of the strings in object_ids */
+  GStringChunk *object_id_strings;
 };
 
 struct _mafw_metadata_closure
@@ -87,9 +98,48 @@ struct _mafw_metadata_closure
   /* List of keys to the asked items */
   gchar **tracker_keys;
   gchar **uris;
-  GPtrArray *results;
-  /* uri->row in results */
+  TrackerCacheResults *results;
+  /* Number of columns read so far */
+  guint columns;
+  /* uri->row in results, plus one */
   GHashTable *rows;
+  /* Metadata waiting for the thumbnails */
+  GList *metadata_list;
+  /* Builder of the queries, reused for every chunk */
+  MafwTrackerSourceSparqlBuilder builder;
+  /* Unique key and aggregates of a container query */
+  gchar *unique_keys[2];
+  gchar *aggregate_types[7];
+  gchar **aggregate_keys;
+};
+
+struct _metadata_batches;
+
+/* One batch of a get_metadatas request */
+struct _metadata_batch
+{
+  struct _metadata_batches *batches;
+  /* The clips of this batch, in request order */
+  gchar **uris;
+  gchar **path_list;
+  /* Metadata received for them */
+  GList *results;
+};
+
+/* A get_metadatas request split in batches, see METADATA_BATCH_SIZE */
+struct _metadata_batches
+{
+  MafwTrackerMetadatasResultCB callback;
+  gpointer user_data;
+  TrackerObjectType tracker_type;
+  gchar **keys;
+  struct _metadata_batch *batch;
+  guint n_batches;
+  /* Next batch to be queried */
+  guint next;
+  guint in_flight;
+  /* First error received, no more batches are started after it */
+  GError *error;
 };
 
 /* ---------------------------- Globals -------------------------- */
@@ -100,28 +150,35 @@ static TrackerNotifier *tn = NULL;
 static gulong miner_progress_id = 0;
 static gulong events_id = 0;
 
-static InfoKeyTable *info_keys = NULL;
+/* Emit browse results without waiting for album-art and thumbnails */
+static gboolean deferred_art = FALSE;
+
+/* How many get_metadatas batches may be queried at the same time */
+static guint metadata_batches = TI_DEFAULT_METADATA_BATCHES;
 
 /* ------------------------- Private API ------------------------- */
 static GList *
-_build_objectids_from_pathname(TrackerCache *cache)
+_build_objectids_from_pathname(TrackerCache *cache, GStringChunk *strings)
 {
   GList *objectid_list = NULL;
-  const GPtrArray *results;
-  GValue *value;
-  const gchar *uri;
+  const TrackerCacheResults *results;
+  GValue value = G_VALUE_INIT;
   gchar *pathname;
   gint i;
 
   results = tracker_cache_values_get_results(cache);
 
-  for (i = 0; i < results->len; i++)
+  for (i = 0; i < tracker_cache_results_length(results); i++)
   {
     GError *error = NULL;
 
-    value = tracker_cache_value_get(cache, MAFW_METADATA_KEY_URI, i);
-    uri = g_value_get_string(value);
-    pathname = g_filename_from_uri(uri, NULL, &error);
+    if (tracker_cache_value_get_into(cache, MAFW_METADATA_KEY_URI, i, &value))
+    {
+      pathname = util_uri_to_filename(g_value_get_string(&value), &error);
+      g_value_unset(&value);
+    }
+    else
+      pathname = NULL;
 
     if (error)
     {
@@ -129,8 +186,10 @@ _build_objectids_from_pathname(TrackerCache *cache)
       g_error_free(error);
     }
 
-    objectid_list = g_list_prepend(objectid_list, pathname);
-    util_gvalue_free(value);
+    objectid_list = g_list_prepend(
+      objectid_list,
+      pathname ? g_string_chunk_insert(strings, pathname) : NULL);
+    g_free(pathname);
   }
 
   objectid_list = g_list_reverse(objectid_list);
@@ -139,31 +198,39 @@ _build_objectids_from_pathname(TrackerCache *cache)
 }
 
 static GList *
-_build_objectids_from_unique_key(TrackerCache *cache)
+_build_objectids_from_unique_key(TrackerCache *cache, GStringChunk *strings)
 {
   GList *objectid_list = NULL;
-  const GPtrArray *results;
+  const TrackerCacheResults *results;
   gchar **tracker_keys;
   gchar *unique_value;
+  gchar number[16];
   gint i;
-  GValue *value;
+  GValue value = G_VALUE_INIT;
 
   results = tracker_cache_values_get_results(cache);
   tracker_keys = tracker_cache_keys_get_tracker(cache);
 
-  for (i = 0; i < results->len; i++)
+  for (i = 0; i < tracker_cache_results_length(results); i++)
   {
     /* Unique key is the first key */
-    value = tracker_cache_value_get(cache, tracker_keys[0], i);
+    tracker_cache_value_get_into(cache, tracker_keys[0], i, &value);
 
-    if (G_VALUE_HOLDS_STRING(value))
-      unique_value = g_strdup(g_value_get_string(value));
-    else if (G_VALUE_HOLDS_INT(value))
-      unique_value = g_strdup_printf("%d", g_value_get_int(value));
+    if (G_VALUE_HOLDS_STRING(&value))
+    {
+      unique_value = g_string_chunk_insert(strings,
+                                           g_value_get_string(&value));
+    }
+    else if (G_VALUE_HOLDS_INT(&value))
+    {
+      g_snprintf(number, sizeof(number), "%d", g_value_get_int(&value));
+      unique_value = g_string_chunk_insert(strings, number);
+    }
     else
-      unique_value = g_strdup("");
+      unique_value = g_string_chunk_insert_const(strings, "");
 
-    util_gvalue_free(value);
+    if (G_IS_VALUE(&value))
+      g_value_unset(&value);
     objectid_list = g_list_prepend(objectid_list, unique_value);
   }
 
@@ -173,33 +240,78 @@ _build_objectids_from_unique_key(TrackerCache *cache)
   return objectid_list;
 }
 
-static GPtrArray *
-_get_sparql_tracker_result(TrackerSparqlCursor *cursor)
+static void
+_mafw_query_closure_free(struct _mafw_query_closure *mc)
 {
-  GPtrArray *result = g_ptr_array_new();
-  gint columns = tracker_sparql_cursor_get_n_columns(cursor);
+  g_free(mc->object_ids);
 
-  while (tracker_sparql_cursor_next(cursor, NULL, NULL))
-  {
-    int i;
-    gchar **row = g_new0(gchar *, columns + 1);
+  if (mc->object_id_strings)
+    g_string_chunk_free(mc->object_id_strings);
 
-    g_ptr_array_add(result, row);
+  if (mc->source)
+    g_object_unref(mc->source);
 
-    for (i = 0; i < columns; i++)
+  tracker_cache_free(mc->cache);
+  g_free(mc);
+}
+
+static void
+_tracker_query_thumbnails_cb(TrackerCache *cache, gpointer user_data)
+{
+  struct _mafw_query_closure *mc = user_data;
+  guint i;
+
+  if (mc->deferred)
+  {
+    /* Results were already emitted, tell about the rows completed now */
+    for (i = 0; i < mc->n_object_ids; i++)
     {
-      const gchar *s;
+      if (mc->object_ids[i] &&
+          tracker_cache_thumbnails_row_deferred(cache, i))
+      {
+        g_signal_emit_by_name(mc->source, "metadata-changed",
+                              mc->object_ids[i]);
+      }
+    }
+  }
+  else
+  {
+    tracker_cache_thumbnails_merge(cache, mc->result->metadata_values);
+
+    /* Invoke callback */
+    mc->callback(mc->result, NULL, mc->user_data);
+  }
 
-      s = tracker_sparql_cursor_get_string(cursor, i, NULL);
+  _mafw_query_closure_free(mc);
+}
 
-      if (!s)
-        s = "";
+/* Invokes the callback with the result, unless it must wait for the
+ * thumbnails being resolved */
+static void
+_tracker_query_result_ready(struct _mafw_query_closure *mc,
+                            MafwResult *mafw_result,
+                            gboolean resolving)
+{
+  if (resolving && !mc->deferred)
+  {
+    mc->result = mafw_result;
+    return;
+  }
 
-      row[i] = g_strdup(s);
-    }
+  if (mc->deferred && mc->cache->thumbnails)
+  {
+    /* Add the values known so far */
+    tracker_cache_thumbnails_merge(mc->cache, mafw_result->metadata_values);
+
+    if (resolving)
+      mafw_result->deferred = mc;
   }
 
-  return result;
+  /* Invoke callback */
+  mc->callback(mafw_result, NULL, mc->user_data);
+
+  if (!resolving)
+    _mafw_query_closure_free(mc);
 }
 
 static void
@@ -210,6 +322,7 @@ _tracker_sparql_query_cb(GObject *object, GAsyncResult *res,
   struct _mafw_query_closure *mc;
   GError *error = NULL;
   TrackerSparqlCursor *cursor = NULL;
+  gboolean resolving;
 
   mc = (struct _mafw_query_closure *)user_data;
 
@@ -219,27 +332,30 @@ _tracker_sparql_query_cb(GObject *object, GAsyncResult *res,
   if (!error)
   {
     mafw_result = g_new0(MafwResult, 1);
-    tracker_cache_values_add_results(mc->cache,
-                                     _get_sparql_tracker_result(cursor));
+    tracker_cache_values_add_results(
+      mc->cache, tracker_cache_results_new_from_cursor(mc->cache, cursor));
+    g_object_unref(cursor);
+
+    /* Thumbnails are resolved while the rest of metadata is built */
+    mc->deferred = deferred_art;
+    resolving = tracker_cache_thumbnails_resolve(
+        mc->cache, mc->deferred, _tracker_query_thumbnails_cb, mc);
     mafw_result->metadata_values = tracker_cache_build_metadata(mc->cache,
                                                                 NULL);
-    mafw_result->ids = _build_objectids_from_pathname(mc->cache);
+    mafw_result->strings = g_string_chunk_new(RESULT_STRINGS_CHUNK_SIZE);
+    mafw_result->ids = _build_objectids_from_pathname(mc->cache,
+                                                      mafw_result->strings);
+    mafw_result->clips = TRUE;
 
-    /* Invoke callback */
-    mc->callback(mafw_result, NULL, mc->user_data);
+    _tracker_query_result_ready(mc, mafw_result, resolving);
   }
   else
   {
     g_warning("Error while querying: %s\n", error->message);
     mc->callback(NULL, error, mc->user_data);
     g_error_free(error);
+    _mafw_query_closure_free(mc);
   }
-
-  if (cursor)
-    g_object_unref(cursor);
-
-  tracker_cache_free(mc->cache);
-  g_free(mc);
 }
 
 static void
@@ -251,6 +367,7 @@ _tracker_sparql_unique_values_cb(GObject *object,
   TrackerSparqlCursor *cursor = NULL;
   MafwResult *mafw_result = NULL;
   struct _mafw_query_closure *mc;
+  gboolean resolving;
 
   mc = (struct _mafw_query_closure *)user_data;
 
@@ -261,27 +378,28 @@ _tracker_sparql_unique_values_cb(GObject *object,
   {
     mafw_result = g_new0(MafwResult, 1);
 
-    tracker_cache_values_add_results(mc->cache,
-                                     _get_sparql_tracker_result(cursor));
+    tracker_cache_values_add_results(
+      mc->cache, tracker_cache_results_new_from_cursor(mc->cache, cursor));
+    g_object_unref(cursor);
+
+    mc->deferred = deferred_art;
+    resolving = tracker_cache_thumbnails_resolve(
+        mc->cache, mc->deferred, _tracker_query_thumbnails_cb, mc);
     mafw_result->metadata_values =
       tracker_cache_build_metadata(mc->cache, NULL);
-    mafw_result->ids = _build_objectids_from_unique_key(mc->cache);
+    mafw_result->strings = g_string_chunk_new(RESULT_STRINGS_CHUNK_SIZE);
+    mafw_result->ids = _build_objectids_from_unique_key(mc->cache,
+                                                        mafw_result->strings);
 
-    /* Invoke callback */
-    mc->callback(mafw_result, NULL, mc->user_data);
+    _tracker_query_result_ready(mc, mafw_result, resolving);
   }
   else
   {
     g_warning("Error while querying: %s\n", error->message);
     mc->callback(NULL, error, mc->user_data);
     g_error_free(error);
+    _mafw_query_closure_free(mc);
   }
-
-  if (cursor)
-    g_object_unref(cursor);
-
-  tracker_cache_free(mc->cache);
-  g_free(mc);
 }
 
 static void
@@ -290,6 +408,7 @@ _do_tracker_get_unique_values(MafwTrackerSourceSparqlBuilder *builder,
                               gchar **aggregated_keys,
                               gchar **aggregated_types,
                               char **filters,
+                              gchar **sort_keys,
                               guint offset,
                               guint count,
                               struct _mafw_query_closure *mc)
@@ -313,7 +432,7 @@ _do_tracker_get_unique_values(MafwTrackerSourceSparqlBuilder *builder,
                                            aggregated_keys,
                                            offset,
                                            count,
-                                           NULL);
+                                           sort_keys);
 
   tracker_sparql_statement_execute_async(stmt,
                                          NULL,
@@ -330,29 +449,19 @@ _append_sparql_tracker_result(TrackerSparqlCursor *cursor,
   guint keys_len = g_strv_length(mc->tracker_keys);
   gint columns = tracker_sparql_cursor_get_n_columns(cursor);
   guint coffset = mc->uris ? 1 : 0;
-  guint offset;
+  guint offset = mc->columns;
   guint row_idx = 0;
-  gchar **row;
+  guint row;
+  gint i;
 
   if (!mc->results)
-  {
-    mc->results = g_ptr_array_new();
-    offset = 0;
-  }
-  else
-  {
-    row = g_ptr_array_index(mc->results, 0);
-    offset = g_strv_length(row);
-  }
+    mc->results = tracker_cache_results_new(mc->cache, keys_len);
 
   while (tracker_sparql_cursor_next(cursor, NULL, NULL))
   {
-    int i;
-
     if (!offset)
     {
-      row = g_new(gchar *, keys_len + 1);
-      g_ptr_array_add(mc->results, row);
+      row = tracker_cache_results_add_row(mc->results);
 
       if (mc->uris)
       {
@@ -366,40 +475,51 @@ _append_sparql_tracker_result(TrackerSparqlCursor *cursor,
 
         g_assert(!g_hash_table_contains(mc->rows, uri));
 
-        g_hash_table_insert(mc->rows, g_strdup(uri), row);
+        g_hash_table_insert(mc->rows, g_strdup(uri),
+                            GUINT_TO_POINTER(row + 1));
       }
     }
     else
-      row = g_ptr_array_index(mc->results, row_idx++);
+      row = row_idx++;
 
     for (i = coffset; i < columns; i++)
     {
-      const gchar *s;
-
-      s = tracker_sparql_cursor_get_string(cursor, i, NULL);
-
-      if (!s)
-        s = "";
-
-      row[i + offset - coffset] = g_strdup(s);
+      tracker_cache_results_read(mc->results, row, i + offset - coffset,
+                                 cursor, i);
     }
-
-    row[offset + i - coffset] = NULL;
   }
+
+  if (tracker_cache_results_length(mc->results))
+    mc->columns = offset + columns - coffset;
 }
 
-static gchar **
-_results_row_dup(gchar **row)
+static void
+_mafw_metadata_closure_free(struct _mafw_metadata_closure *mc)
 {
-  gchar **row_copy = g_new(gchar *, g_strv_length(row) + 1);
-  gchar **p = row_copy;
+  tracker_cache_free(mc->cache);
+
+  if (mc->results)
+    tracker_cache_results_free(mc->results);
 
-  while (*row)
-    *p++ = g_strdup(*row++);
+  if (mc->rows)
+    g_hash_table_destroy(mc->rows);
+
+  g_strfreev(mc->path_list);
+  g_strfreev(mc->tracker_keys);
+  g_strfreev(mc->uris);
+  mafw_tracker_source_sparql_builder_clear(&mc->builder);
+  g_free(mc);
+}
 
-  *p = NULL;
+static void
+_tracker_metadata_thumbnails_cb(TrackerCache *cache, gpointer user_data)
+{
+  struct _mafw_metadata_closure *mc = user_data;
 
-  return row_copy;
+  tracker_cache_thumbnails_merge(cache, mc->metadata_list);
+  mc->mult_callback(mc->metadata_list, NULL, mc->user_data);
+  g_list_free_full(mc->metadata_list, (GDestroyNotify)mafw_metadata_release);
+  _mafw_metadata_closure_free(mc);
 }
 
 static void
@@ -420,60 +540,62 @@ _tracker_sparql_metadata_cb(GObject *object, GAsyncResult *res,
   if (!error)
   {
     guint keys_len = g_strv_length(mc->tracker_keys);
-    guint columns = 0;
+    guint columns;
 
     if (object)
     {
-      gchar **row;
-
       _append_sparql_tracker_result(cursor, mc);
 
       g_object_unref(cursor);
-
-      if (mc->results->len)
-      {
-        row = g_ptr_array_index(mc->results, 0);
-        columns = g_strv_length(row);
-      }
     }
 
-    if (!mc->results || !mc->results->len || (keys_len == columns))
+    columns = mc->columns;
+
+    if (!tracker_cache_results_length(mc->results) || (keys_len == columns))
     {
       /* we have all the chunks */
       /* we might have duplicated uris, however, our query returns distinct
-         results. Lets account for that */
-      if (mc->uris && mc->results && mc->results->len)
+         results. Lets account for that. The caller matches the results
+         with its uris by position, so there is one for each of them. */
+      if (mc->uris && mc->results)
       {
-        GPtrArray *results = g_ptr_array_new();
         gchar **uri;
-        GHashTable *used =
-            g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, NULL);
 
         for (uri = mc->uris; *uri; uri++)
         {
-          gchar **row = g_hash_table_lookup(mc->rows, *uri);
+          guint row = 0;
 
-          if (!row)
-            continue;
+          if (mc->rows)
+            row = GPOINTER_TO_UINT(g_hash_table_lookup(mc->rows, *uri));
 
-          if (g_hash_table_contains(used, row))
-            row = _results_row_dup(row);
+          if (row)
+            tracker_cache_results_add_order(mc->results, row - 1);
           else
-            g_hash_table_add(used, row);
-
-          g_ptr_array_add(results, row);
+            tracker_cache_results_add_missing(mc->results);
         }
+      }
+      else if (mc->uris)
+      {
+        gchar **uri;
 
-        g_assert(g_hash_table_size(used) == mc->results->len);
-
-        g_hash_table_destroy(used);
+        /* Nothing to ask tracker, only precomputed values for each */
+        mc->results = tracker_cache_results_new(mc->cache, 0);
 
-        g_ptr_array_free(mc->results, TRUE);
-        mc->results = results;
+        for (uri = mc->uris; *uri; uri++)
+          tracker_cache_results_add_row(mc->results);
       }
 
       tracker_cache_values_add_results(mc->cache, mc->results);
       mc->results = NULL;
+
+      if (tracker_cache_thumbnails_resolve(
+            mc->cache, FALSE, _tracker_metadata_thumbnails_cb, mc))
+      {
+        mc->metadata_list = tracker_cache_build_metadata(
+            mc->cache, (const gchar **)mc->path_list);
+        return;
+      }
+
       metadata_list = tracker_cache_build_metadata(
           mc->cache, (const gchar **)mc->path_list);
       mc->mult_callback(metadata_list, NULL, mc->user_data);
@@ -482,12 +604,11 @@ _tracker_sparql_metadata_cb(GObject *object, GAsyncResult *res,
     else
     {
       /* get another chunk of data */
-      MafwTrackerSourceSparqlBuilder *builder;
       TrackerSparqlStatement *stmt;
       gchar **keys = &mc->tracker_keys[columns];
 
-      builder = mafw_tracker_source_sparql_builder_new();
-      stmt = mafw_tracker_source_sparql_meta(builder, tc,
+      mafw_tracker_source_sparql_builder_reset(&mc->builder);
+      stmt = mafw_tracker_source_sparql_meta(&mc->builder, tc,
                                              mc->cache->tracker_type,
                                              mc->uris, keys,
                                              MAX_SPARQL_OPTIONALS);
@@ -496,7 +617,6 @@ _tracker_sparql_metadata_cb(GObject *object, GAsyncResult *res,
             stmt, NULL, _tracker_sparql_metadata_cb, mc);
 
       g_object_unref(stmt);
-      g_object_unref(builder);
       return;
     }
   }
@@ -508,21 +628,7 @@ _tracker_sparql_metadata_cb(GObject *object, GAsyncResult *res,
     g_error_free(error);
   }
 
-  tracker_cache_free(mc->cache);
-
-  if (mc->results)
-  {
-    g_ptr_array_foreach(mc->results, (GFunc)g_strfreev, NULL);
-    g_ptr_array_free(mc->results, TRUE);
-  }
-
-  if (mc->rows)
-    g_hash_table_destroy(mc->rows);
-
-  g_strfreev(mc->path_list);
-  g_strfreev(mc->tracker_keys);
-  g_strfreev(mc->uris);
-  g_free(mc);
+  _mafw_metadata_closure_free(mc);
 }
 
 static gboolean
@@ -533,30 +639,17 @@ _run_tracker_metadata_cb(gpointer data)
   return FALSE;
 }
 
-static gchar **
-_uris_to_filenames(gchar **uris)
-{
-  gchar **filenames;
-  gint i;
-
-  filenames = g_new0(gchar *, g_strv_length(uris) + 1);
-
-  for (i = 0; uris[i]; i++)
-    filenames[i] = g_filename_from_uri(uris[i], NULL, NULL);
-
-  return filenames;
-}
-
+/* Takes uris and path_list */
 static void
-_do_tracker_get_metadata(gchar **uris,
-                         gchar **keys,
-                         TrackerObjectType tracker_obj_type,
-                         MafwTrackerMetadatasResultCB callback,
-                         gpointer user_data)
+_do_tracker_get_metadata_batch(gchar **uris,
+                               gchar **path_list,
+                               gchar **keys,
+                               TrackerObjectType tracker_obj_type,
+                               MafwTrackerMetadatasResultCB callback,
+                               gpointer user_data)
 {
   struct _mafw_metadata_closure *mc = NULL;
   gchar **user_keys;
-  gchar **pathnames;
 
   /* Save required information */
   mc = g_new0(struct _mafw_metadata_closure, 1);
@@ -564,6 +657,8 @@ _do_tracker_get_metadata(gchar **uris,
   mc->user_data = user_data;
   mc->cache = tracker_cache_new(tracker_obj_type,
                                 TRACKER_CACHE_RESULT_TYPE_GET_METADATA);
+  mc->uris = uris;
+  mc->path_list = path_list;
 
   /* If we have only a URI, add it as a predefined value */
   if (!uris[1])
@@ -581,18 +676,12 @@ _do_tracker_get_metadata(gchar **uris,
   mc->tracker_keys = keymap_mafw_keys_to_tracker_keys(user_keys,
                                                       tracker_obj_type);
   tracker_cache_keys_free_tracker(mc->cache, user_keys);
-  mc->uris = g_strdupv(uris);
 
   if (g_strv_length(mc->tracker_keys) > 0)
   {
-    MafwTrackerSourceSparqlBuilder *builder;
     TrackerSparqlStatement *stmt;
 
-    pathnames = _uris_to_filenames(uris);
-    mc->path_list = pathnames;
-
-    builder = mafw_tracker_source_sparql_builder_new();
-    stmt = mafw_tracker_source_sparql_meta(builder, tc, tracker_obj_type,
+    stmt = mafw_tracker_source_sparql_meta(&mc->builder, tc, tracker_obj_type,
                                            uris, mc->tracker_keys,
                                            MAX_SPARQL_OPTIONALS);
 
@@ -600,12 +689,164 @@ _do_tracker_get_metadata(gchar **uris,
           stmt, NULL, _tracker_sparql_metadata_cb, mc);
 
     g_object_unref(stmt);
-    g_object_unref(builder);
   }
   else
     g_idle_add(_run_tracker_metadata_cb, mc);
 }
 
+static void _metadata_batch_cb(GList *results, GError *error,
+                               gpointer user_data);
+
+static void
+_metadata_batches_start_next(struct _metadata_batches *mb)
+{
+  struct _metadata_batch *batch = &mb->batch[mb->next++];
+
+  mb->in_flight++;
+
+  /* The query owns the lists from now on */
+  _do_tracker_get_metadata_batch(batch->uris, batch->path_list, mb->keys,
+                                 mb->tracker_type, _metadata_batch_cb, batch);
+  batch->uris = NULL;
+  batch->path_list = NULL;
+}
+
+static void
+_metadata_batches_free(struct _metadata_batches *mb)
+{
+  guint i;
+
+  for (i = 0; i < mb->n_batches; i++)
+  {
+    g_strfreev(mb->batch[i].uris);
+    g_strfreev(mb->batch[i].path_list);
+    g_list_free_full(mb->batch[i].results,
+                     (GDestroyNotify)mafw_metadata_release);
+  }
+
+  if (mb->error)
+    g_error_free(mb->error);
+
+  g_strfreev(mb->keys);
+  g_free(mb->batch);
+  g_free(mb);
+}
+
+/* Batch results have NULL for the clips without metadata */
+static gpointer
+_metadata_copy(gconstpointer src, gpointer data)
+{
+  return src ? g_hash_table_ref((GHashTable *)src) : NULL;
+}
+
+static void
+_metadata_batch_cb(GList *results, GError *error, gpointer user_data)
+{
+  struct _metadata_batch *batch = user_data;
+  struct _metadata_batches *mb = batch->batches;
+  GList *merged = NULL;
+  guint i;
+
+  mb->in_flight--;
+
+  if (error)
+  {
+    if (!mb->error)
+      mb->error = g_error_copy(error);
+  }
+  else
+  {
+    /* The caller releases the list once we return */
+    batch->results = g_list_copy_deep(results, _metadata_copy, NULL);
+  }
+
+  if (!mb->error && (mb->next < mb->n_batches))
+  {
+    _metadata_batches_start_next(mb);
+    return;
+  }
+
+  if (mb->in_flight)
+    return;
+
+  if (mb->error)
+    mb->callback(NULL, mb->error, mb->user_data);
+  else
+  {
+    /* Merge back in request order */
+    for (i = mb->n_batches; i > 0; i--)
+    {
+      merged = g_list_concat(mb->batch[i - 1].results, merged);
+      mb->batch[i - 1].results = NULL;
+    }
+
+    mb->callback(merged, NULL, mb->user_data);
+    g_list_free_full(merged, (GDestroyNotify)mafw_metadata_release);
+  }
+
+  _metadata_batches_free(mb);
+}
+
+static void
+_do_tracker_get_metadata(GArray *clips,
+                         gchar **keys,
+                         TrackerObjectType tracker_obj_type,
+                         MafwTrackerMetadatasResultCB callback,
+                         gpointer user_data)
+{
+  struct _metadata_batches *mb;
+  guint n_batches;
+  guint b, i;
+
+  n_batches = (clips->len + METADATA_BATCH_SIZE - 1) / METADATA_BATCH_SIZE;
+
+  mb = g_new0(struct _metadata_batches, 1);
+  mb->callback = callback;
+  mb->user_data = user_data;
+  mb->tracker_type = tracker_obj_type;
+  mb->batch = g_new0(struct _metadata_batch, n_batches);
+  mb->n_batches = n_batches;
+
+  /* Both forms of each clip are used, get them at once */
+  for (b = 0; b < n_batches; b++)
+  {
+    struct _metadata_batch *batch = &mb->batch[b];
+    guint first = b * METADATA_BATCH_SIZE;
+    guint len = MIN(clips->len - first, METADATA_BATCH_SIZE);
+
+    batch->batches = mb;
+    batch->uris = g_new(gchar *, len + 1);
+    batch->path_list = g_new(gchar *, len + 1);
+
+    for (i = 0; i < len; i++)
+    {
+      UtilResource *clip = &g_array_index(clips, UtilResource, first + i);
+
+      batch->uris[i] = g_strdup(util_resource_get_uri(clip));
+      batch->path_list[i] = g_strdup(util_resource_get_filename(clip));
+    }
+
+    batch->uris[len] = NULL;
+    batch->path_list[len] = NULL;
+  }
+
+  /* A single batch goes straight to the caller */
+  if (n_batches == 1)
+  {
+    _do_tracker_get_metadata_batch(mb->batch[0].uris, mb->batch[0].path_list,
+                                   keys, tracker_obj_type, callback,
+                                   user_data);
+    g_free(mb->batch);
+    g_free(mb);
+    return;
+  }
+
+  mb->keys = g_strdupv(keys);
+
+  while ((mb->next < mb->n_batches) && (mb->in_flight < metadata_batches))
+    _metadata_batches_start_next(mb);
+}
+
 /* ------------------------- Public API ------------------------- */
 
 gchar *
@@ -637,9 +878,6 @@ ti_init(void)
 {
   GError *error = NULL;
 
-  if (info_keys == NULL)
-    info_keys = keymap_get_info_key_table();
-
   tc = tracker_sparql_connection_bus_new(TRACKER_SERVICE, NULL, NULL, &error);
 
   if (tc == NULL)
@@ -725,6 +963,12 @@ connection_notifier_events_cb(TrackerNotifier* self,
   else if (!strcmp(graph, TRACKER_PREFIX_TRACKER "Video"))
     video_changed = TRUE;
 #endif
+  if (music_changed || video_changed || playlist_changed)
+    mafw_tracker_source_invalidate_metadata(source, NULL);
+
+  if (music_changed)
+    tracker_cache_forget_representatives();
+
   if (music_changed)
   {
     g_debug("Container " MUSIC_OBJECT_ID " changed");
@@ -780,6 +1024,9 @@ ti_init_watch (GObject *source)
 void
 ti_deinit()
 {
+  /* Workers resolving art use the connection and the album-art indexes */
+  tracker_cache_deinit();
+
   if (events_id)
   {
     g_signal_handler_disconnect(tn, events_id);
@@ -809,6 +1056,44 @@ ti_deinit()
     g_object_unref(tc);
     tc = NULL;
   }
+
+  albumart_deinit();
+}
+
+void
+ti_set_deferred_art(gboolean enabled)
+{
+  deferred_art = enabled;
+}
+
+void
+ti_set_metadata_batches(guint max_in_flight)
+{
+  metadata_batches = MAX(max_in_flight, 1);
+}
+
+void
+ti_watch_deferred_art(MafwResult *result,
+                      GObject *source,
+                      GList *object_ids)
+{
+  struct _mafw_query_closure *mc = result->deferred;
+  GList *iter;
+  guint i;
+
+  if (!mc || mc->source)
+    return;
+
+  mc->source = g_object_ref(source);
+  mc->n_object_ids = g_list_length(object_ids);
+  mc->object_ids = g_new(gchar *, mc->n_object_ids);
+  mc->object_id_strings = g_string_chunk_new(RESULT_STRINGS_CHUNK_SIZE);
+
+  for (iter = object_ids, i = 0; iter; iter = iter->next, i++)
+  {
+    mc->object_ids[i] = iter->data ?
+      g_string_chunk_insert(mc->object_id_strings, iter->data) : NULL;
+  }
 }
 
 void
@@ -998,6 +1283,125 @@ ti_get_songs(MafwTrackerSourceSparqlBuilder *builder,
   g_strfreev(tracker_sort_keys);
 }
 
+/*
+ * Aggregate for the values of @key among the clips of a container. Only
+ * whether they are all the same matters, unless they are albums whose art
+ * is requested: one of them is needed to look for it, see
+ * ti_get_container_albums() for the others.
+ */
+static gchar *
+_get_values_aggregate_type(TrackerCache *cache, const gchar *key)
+{
+  static const gchar *album_art_keys[] = {
+    MAFW_METADATA_KEY_ALBUM_ART_URI,
+    MAFW_METADATA_KEY_ALBUM_ART_SMALL_URI,
+    MAFW_METADATA_KEY_ALBUM_ART_MEDIUM_URI,
+    MAFW_METADATA_KEY_ALBUM_ART_LARGE_URI
+  };
+  guint i;
+
+  if (!strcmp(key, MAFW_METADATA_KEY_ALBUM))
+  {
+    for (i = 0; i < G_N_ELEMENTS(album_art_keys); i++)
+    {
+      if (tracker_cache_key_exists(cache, album_art_keys[i]))
+        return AGGREGATED_TYPE_REPRESENTATIVE;
+    }
+  }
+
+  return AGGREGATED_TYPE_SAMPLE;
+}
+
+/* Adds the keys of @sort_fields containers can be sorted by, though they
+ * were not requested */
+static void
+_add_unique_sort_keys(TrackerCache *cache, gchar **sort_fields, gint max_level)
+{
+  MetadataKey *metadata_key;
+  const gchar *key;
+  gint i;
+
+  for (i = 0; sort_fields && sort_fields[i]; i++)
+  {
+    key = sort_fields[i];
+
+    if ((*key == '+') || (*key == '-'))
+      key++;
+
+    metadata_key = keymap_get_metadata(key);
+
+    if (metadata_key &&
+        ((metadata_key->special == SPECIAL_KEY_DURATION) ||
+         (metadata_key->special == SPECIAL_KEY_CHILDCOUNT)))
+    {
+      tracker_cache_key_add(cache, key, max_level, FALSE);
+    }
+  }
+}
+
+/*
+ * Sort keys of a unique query. The unique key, and the keys derived from
+ * it, sort by @unique_key. Other keys sort by their aggregate, given as
+ * "AGGREGATE(field)". Keys without a column are skipped.
+ */
+static gchar **
+_get_unique_sort_keys(TrackerCache *cache,
+                      gchar **sort_fields,
+                      const gchar *unique_key,
+                      gchar **tracker_keys,
+                      gchar **aggregate_keys,
+                      gchar **aggregate_types)
+{
+  GPtrArray *sort_keys;
+  TrackerCacheValue *value;
+  const gchar *key;
+  gchar sort_type;
+  gint i;
+  gint j;
+
+  if (!sort_fields)
+    return NULL;
+
+  sort_keys = g_ptr_array_new();
+
+  for (i = 0; sort_fields[i]; i++)
+  {
+    key = sort_fields[i];
+    sort_type = '+';
+
+    if ((*key == '+') || (*key == '-'))
+      sort_type = *key++;
+
+    value = g_hash_table_lookup(cache->cache, key);
+
+    if (value && (value->key_type == TRACKER_CACHE_KEY_TYPE_DERIVED))
+      key = value->key_derived_from;
+
+    if (!strcmp(key, tracker_keys[0]))
+    {
+      g_ptr_array_add(sort_keys,
+                      g_strdup_printf("%c%s", sort_type, unique_key));
+      continue;
+    }
+
+    for (j = 1; tracker_keys[j]; j++)
+    {
+      if (!strcmp(key, tracker_keys[j]))
+      {
+        g_ptr_array_add(sort_keys,
+                        g_strdup_printf("%c%s(%s)", sort_type,
+                                        aggregate_types[j - 1],
+                                        aggregate_keys[j - 1]));
+        break;
+      }
+    }
+  }
+
+  g_ptr_array_add(sort_keys, NULL);
+
+  return (gchar **)g_ptr_array_free(sort_keys, FALSE);
+}
+
 void
 ti_get_artists(MafwTrackerSourceSparqlBuilder *builder,
                const gchar *genre,
@@ -1016,6 +1420,7 @@ ti_get_artists(MafwTrackerSourceSparqlBuilder *builder,
   gchar *tracker_unique_keys[] = { TRACKER_AKEY_ARTIST, NULL };
   gchar **tracker_keys;
   gchar **aggregate_keys;
+  gchar **sort_keys;
   gchar *aggregate_types[5] = { 0 };
   gint i;
   MetadataKey *metadata_key;
@@ -1057,6 +1462,7 @@ ti_get_artists(MafwTrackerSourceSparqlBuilder *builder,
   tracker_cache_key_add_unique(mc->cache, MAFW_METADATA_KEY_ARTIST);
 
   tracker_cache_key_add_several(mc->cache, keys, MAXLEVEL, TRUE);
+  _add_unique_sort_keys(mc->cache, sort_fields, MAXLEVEL);
 
   /* Concat albums if requested */
   if (tracker_cache_key_exists(mc->cache, MAFW_METADATA_KEY_ALBUM))
@@ -1086,7 +1492,7 @@ ti_get_artists(MafwTrackerSourceSparqlBuilder *builder,
       case SPECIAL_KEY_CHILDCOUNT:
       {
         /* What is the level requested? */
-        if (tracker_keys[i][11] == '1')
+        if (metadata_key->childcount_level == 1)
           aggregate_keys[i-1] = g_strdup(TRACKER_AKEY_ALBUM);
         else
           aggregate_keys[i-1] = g_strdup("*");
@@ -1098,10 +1504,14 @@ ti_get_artists(MafwTrackerSourceSparqlBuilder *builder,
       default:
         aggregate_keys[i-1] =
           keymap_mafw_key_to_tracker_key(tracker_keys[i], TRACKER_TYPE_MUSIC);
-        aggregate_types[i-1] = AGGREGATED_TYPE_CONCAT;
+        aggregate_types[i-1] =
+          _get_values_aggregate_type(mc->cache, tracker_keys[i]);
     }
   }
 
+  sort_keys = _get_unique_sort_keys(mc->cache, sort_fields,
+                                    tracker_unique_keys[0], tracker_keys,
+                                    aggregate_keys, aggregate_types);
   tracker_cache_keys_free_tracker(mc->cache, tracker_keys);
 
   _do_tracker_get_unique_values(builder,
@@ -1109,12 +1519,14 @@ ti_get_artists(MafwTrackerSourceSparqlBuilder *builder,
                                 aggregate_keys,
                                 aggregate_types,
                                 filters,
+                                sort_keys,
                                 offset,
                                 count,
                                 mc);
 
   g_strfreev(filters);
   g_strfreev(aggregate_keys);
+  g_strfreev(sort_keys);
 }
 
 void
@@ -1133,6 +1545,7 @@ ti_get_genres(MafwTrackerSourceSparqlBuilder *builder,
   gchar *tracker_unique_keys[] = { TRACKER_AKEY_GENRE, NULL };
   gchar **tracker_keys;
   gchar **aggregate_keys;
+  gchar **sort_keys;
   gchar *aggregate_types[6] = { 0 };
   gint i;
   MetadataKey *metadata_key;
@@ -1153,6 +1566,7 @@ ti_get_genres(MafwTrackerSourceSparqlBuilder *builder,
   /* Insert unique key */
   tracker_cache_key_add_unique(mc->cache, MAFW_METADATA_KEY_GENRE);
   tracker_cache_key_add_several(mc->cache, keys, MAXLEVEL, TRUE);
+  _add_unique_sort_keys(mc->cache, sort_fields, MAXLEVEL);
 
   /* Concat artists if requested */
   if (tracker_cache_key_exists(mc->cache, MAFW_METADATA_KEY_ARTIST))
@@ -1185,9 +1599,9 @@ ti_get_genres(MafwTrackerSourceSparqlBuilder *builder,
       case SPECIAL_KEY_CHILDCOUNT:
       {
         /* What is the level requested? */
-        if (tracker_keys[i][11] == '1')
+        if (metadata_key->childcount_level == 1)
           aggregate_keys[i-1] = g_strdup(TRACKER_AKEY_ARTIST);
-        else if (tracker_keys[i][11] == '2')
+        else if (metadata_key->childcount_level == 2)
           aggregate_keys[i-1] = g_strdup(TRACKER_AKEY_ALBUM);
         else
           aggregate_keys[i-1] = g_strdup("*");
@@ -1199,10 +1613,14 @@ ti_get_genres(MafwTrackerSourceSparqlBuilder *builder,
       default:
         aggregate_keys[i-1] =
           keymap_mafw_key_to_tracker_key(tracker_keys[i], TRACKER_TYPE_MUSIC);
-        aggregate_types[i-1] = AGGREGATED_TYPE_CONCAT;
+        aggregate_types[i-1] =
+          _get_values_aggregate_type(mc->cache, tracker_keys[i]);
     }
   }
 
+  sort_keys = _get_unique_sort_keys(mc->cache, sort_fields,
+                                    tracker_unique_keys[0], tracker_keys,
+                                    aggregate_keys, aggregate_types);
   tracker_cache_keys_free_tracker(mc->cache, tracker_keys);
 
   /* Query tracker */
@@ -1211,12 +1629,14 @@ ti_get_genres(MafwTrackerSourceSparqlBuilder *builder,
                                 aggregate_keys,
                                 aggregate_types,
                                 filters,
+                                sort_keys,
                                 offset,
                                 count,
                                 mc);
 
   g_strfreev(filters);
   g_strfreev(aggregate_keys);
+  g_strfreev(sort_keys);
 }
 
 void
@@ -1315,13 +1735,12 @@ ti_get_albums(MafwTrackerSourceSparqlBuilder *builder,
   gchar *tracker_unique_keys[] = { TRACKER_AKEY_ALBUM, NULL };
   gchar **tracker_keys;
   gchar **aggregate_keys;
+  gchar **sort_keys;
   gchar *aggregate_types[4] = { 0 };
   gint i;
   MetadataKey *metadata_key;
   struct _mafw_query_closure *mc;
 
-  builder = mafw_tracker_source_sparql_builder_new();
-
   /* Prepare mafw closure struct */
   mc = g_new0(struct _mafw_query_closure, 1);
   mc->callback = callback;
@@ -1379,6 +1798,7 @@ ti_get_albums(MafwTrackerSourceSparqlBuilder *builder,
 
   /* Add user keys */
   tracker_cache_key_add_several(mc->cache, keys, MAXLEVEL, TRUE);
+  _add_unique_sort_keys(mc->cache, sort_fields, MAXLEVEL);
 
   /* Concat artists, if requested */
   if (!artist &&
@@ -1419,10 +1839,14 @@ ti_get_albums(MafwTrackerSourceSparqlBuilder *builder,
       default:
         aggregate_keys[i-1] =
           keymap_mafw_key_to_tracker_key(tracker_keys[i], TRACKER_TYPE_MUSIC);
-        aggregate_types[i-1] = AGGREGATED_TYPE_CONCAT;
+        aggregate_types[i-1] =
+          _get_values_aggregate_type(mc->cache, tracker_keys[i]);
     }
   }
 
+  sort_keys = _get_unique_sort_keys(mc->cache, sort_fields,
+                                    tracker_unique_keys[0], tracker_keys,
+                                    aggregate_keys, aggregate_types);
   tracker_cache_keys_free_tracker(mc->cache, tracker_keys);
 
   _do_tracker_get_unique_values(builder,
@@ -1430,16 +1854,89 @@ ti_get_albums(MafwTrackerSourceSparqlBuilder *builder,
                                 aggregate_keys,
                                 aggregate_types,
                                 filters,
+                                sort_keys,
                                 offset,
                                 count,
                                 mc);
 
   g_strfreev(filters);
   g_strfreev(aggregate_keys);
+  g_strfreev(sort_keys);
+}
+
+/*
+ * ti_get_container_albums:
+ * @key: MAFW_METADATA_KEY_ARTIST or MAFW_METADATA_KEY_GENRE
+ * @value: the artist or genre
+ *
+ * Gets the albums of an artist or a genre. It blocks, so it is meant for
+ * the threads resolving album art.
+ *
+ * Returns: NULL-terminated array of albums, or NULL
+ */
+gchar **
+ti_get_container_albums(const gchar *key, const gchar *value)
+{
+  MafwTrackerSourceSparqlBuilder builder;
+  gchar *fields[] = { TRACKER_AKEY_ALBUM, NULL };
+  TrackerSparqlStatement *stmt;
+  TrackerSparqlCursor *cursor;
+  GPtrArray *albums;
+  gchar *escaped;
+  gchar *filter;
+
+  if (!tc)
+    return NULL;
+
+  mafw_tracker_source_sparql_builder_init(&builder);
+
+  escaped = util_get_tracker_value_for_filter(key, TRACKER_TYPE_MUSIC, value);
+  filter = mafw_tracker_source_sparql_create_query_filter(
+        &builder,
+        strcmp(key, MAFW_METADATA_KEY_GENRE) ?
+        SPARQL_QUERY_BY_ARTIST : SPARQL_QUERY_BY_GENRE,
+        escaped);
+  g_free(escaped);
+
+  stmt = mafw_tracker_source_sparql_create(&builder, tc, TRACKER_TYPE_MUSIC,
+                                           TRUE, fields, filter, NULL, NULL,
+                                           0, 0, NULL);
+  g_free(filter);
+
+  cursor = tracker_sparql_statement_execute(stmt, NULL, NULL);
+  g_object_unref(stmt);
+  mafw_tracker_source_sparql_builder_clear(&builder);
+
+  if (!cursor)
+    return NULL;
+
+  albums = g_ptr_array_new();
+
+  while (tracker_sparql_cursor_next(cursor, NULL, NULL))
+  {
+    const gchar *album = tracker_sparql_cursor_get_string(cursor, 0, NULL);
+
+    if (!IS_STRING_EMPTY(album))
+      g_ptr_array_add(albums, g_strdup(album));
+  }
+
+  g_object_unref(cursor);
+  g_ptr_array_add(albums, NULL);
+
+  return (gchar **)g_ptr_array_free(albums, FALSE);
+}
+
+static void
+_container_closure_free(struct _mafw_metadata_closure *mc)
+{
+  tracker_cache_free(mc->cache);
+  g_free(mc->unique_keys[0]);
+  g_strfreev(mc->aggregate_keys);
+  g_free(mc);
 }
 
 static void
-_tracker_metadata_from_container_cb(GPtrArray *tracker_result,
+_tracker_metadata_from_container_cb(TrackerCacheResults *tracker_result,
                                     GError *error,
                                     gpointer user_data)
 {
@@ -1456,8 +1953,7 @@ _tracker_metadata_from_container_cb(GPtrArray *tracker_result,
   else
     mc->callback(NULL, error, mc->user_data);
 
-  tracker_cache_free(mc->cache);
-  g_free(mc);
+  _container_closure_free(mc);
 }
 
 static void
@@ -1477,8 +1973,8 @@ _tracker_sparql_metadata_from_container_cb(GObject *object,
   {
     GHashTable *metadata;
 
-    tracker_cache_values_add_results(mc->cache,
-                                     _get_sparql_tracker_result(cursor));
+    tracker_cache_values_add_results(
+      mc->cache, tracker_cache_results_new_from_cursor(mc->cache, cursor));
     metadata = tracker_cache_build_metadata_aggregated(mc->cache,
                                                        mc->count_childcount);
     mc->callback(metadata, NULL, mc->user_data);
@@ -1492,14 +1988,14 @@ _tracker_sparql_metadata_from_container_cb(GObject *object,
   if (cursor)
     g_object_unref(cursor);
 
-  tracker_cache_free(mc->cache);
-  g_free(mc);
+  _container_closure_free(mc);
 }
 
 static gboolean
 _run_tracker_metadata_from_container_cb(gpointer data)
 {
-  GPtrArray *results = g_ptr_array_sized_new(0);
+  struct _mafw_metadata_closure *mc = data;
+  TrackerCacheResults *results = tracker_cache_results_new(mc->cache, 0);
 
   _tracker_metadata_from_container_cb(results, NULL, data);
 
@@ -1573,7 +2069,8 @@ _do_tracker_get_metadata_from_service(gchar **keys,
       {
         aggregate_keys[i-1] =
           keymap_mafw_key_to_tracker_key(tracker_keys[i], tracker_type);
-        aggregate_types[i-1] = AGGREGATED_TYPE_CONCAT;
+        aggregate_types[i-1] =
+          _get_values_aggregate_type(mc->cache, tracker_keys[i]);
         break;
       }
     }
@@ -1583,11 +2080,11 @@ _do_tracker_get_metadata_from_service(gchar **keys,
 
   if (aggregate_keys[0])
   {
-    MafwTrackerSourceSparqlBuilder *builder;
+    MafwTrackerSourceSparqlBuilder builder;
     TrackerSparqlStatement *stmt;
 
-    builder = mafw_tracker_source_sparql_builder_new();
-    stmt = mafw_tracker_source_sparql_create(builder,
+    mafw_tracker_source_sparql_builder_init(&builder);
+    stmt = mafw_tracker_source_sparql_create(&builder,
                                              tc,
                                              tracker_type,
                                              TRUE,
@@ -1603,7 +2100,7 @@ _do_tracker_get_metadata_from_service(gchar **keys,
           stmt, NULL, _tracker_sparql_metadata_from_container_cb, mc);
 
     g_object_unref(stmt);
-    g_object_unref(builder);
+    mafw_tracker_source_sparql_builder_clear(&builder);
   }
   else
     g_idle_add(_run_tracker_metadata_from_container_cb, mc);
@@ -1645,34 +2142,28 @@ ti_get_metadata_from_playlists(gchar **keys,
                                         callback, user_data);
 }
 
-void
-ti_get_metadata_from_category(const gchar *genre,
-                              const gchar *artist,
-                              const gchar *album,
-                              const gchar *default_count_key,
-                              const gchar *title,
-                              gchar **keys,
-                              MafwTrackerMetadataResultCB callback,
-                              gpointer user_data)
+/* Sets up the cache and the aggregates to get the metadata of a container */
+static struct _mafw_metadata_closure *
+_category_closure_new(const gchar *genre,
+                      const gchar *artist,
+                      const gchar *album,
+                      const gchar *default_count_key,
+                      const gchar *title,
+                      gchar **keys,
+                      MafwTrackerMetadataResultCB callback,
+                      gpointer user_data)
 {
-  gchar *filter;
   gint MAXLEVEL;
   struct _mafw_metadata_closure *mc;
   const gchar *ukey;
-  gchar *tracker_ukeys[2] = { 0 };
-  gchar *aggregate_types[7] = { 0 };
-  gchar **aggregate_keys;
   gchar **tracker_keys;
   gint i;
   MetadataKey *metadata_key;
-  MafwTrackerSourceSparqlBuilder *builder;
   const gchar *count_keys[] = { TRACKER_AKEY_GENRE, TRACKER_AKEY_ARTIST,
                                 TRACKER_AKEY_ALBUM, "*" };
   gint level;
   gint start_to_look;
 
-  builder = mafw_tracker_source_sparql_builder_new();
-
   mc = g_new0(struct _mafw_metadata_closure, 1);
   mc->callback = callback;
   mc->user_data = user_data;
@@ -1804,18 +2295,15 @@ ti_get_metadata_from_category(const gchar *genre,
     tracker_cache_key_add_concat(mc->cache, MAFW_METADATA_KEY_ARTIST);
   }
 
-  /* Compute tracker filter and tracker keys */
-  filter = mafw_tracker_source_sparql_create_filter_from_category(
-        builder, genre, artist, album, NULL);
-
-  tracker_ukeys[0] = keymap_mafw_key_to_tracker_key(ukey, TRACKER_TYPE_MUSIC);
+  mc->unique_keys[0] = keymap_mafw_key_to_tracker_key(ukey,
+                                                      TRACKER_TYPE_MUSIC);
 
   /* Get the list of keys to use with tracker */
   tracker_keys = tracker_cache_keys_get_tracker(mc->cache);
 
   /* Create the array for aggregate keys and their types; skip unique
    * key */
-  aggregate_keys = g_new0(gchar *, 7);
+  mc->aggregate_keys = g_new0(gchar *, 7);
 
   for (i = 1; tracker_keys[i]; i++)
   {
@@ -1825,85 +2313,295 @@ ti_get_metadata_from_category(const gchar *genre,
     {
       case SPECIAL_KEY_DURATION:
       {
-        aggregate_keys[i-1] =
+        mc->aggregate_keys[i-1] =
           keymap_mafw_key_to_tracker_key(tracker_keys[i], TRACKER_TYPE_MUSIC);
-        aggregate_types[i-1] = AGGREGATED_TYPE_SUM;
+        mc->aggregate_types[i-1] = AGGREGATED_TYPE_SUM;
         break;
       }
 
       case SPECIAL_KEY_CHILDCOUNT:
       {
-        level = g_ascii_digit_value(tracker_keys[i][11]);
-        aggregate_keys[i-1] = g_strdup(count_keys[start_to_look + level - 1]);
-        aggregate_types[i-1] = AGGREGATED_TYPE_COUNT;
+        level = metadata_key->childcount_level;
+        mc->aggregate_keys[i-1] =
+          g_strdup(count_keys[start_to_look + level - 1]);
+        mc->aggregate_types[i-1] = AGGREGATED_TYPE_COUNT;
         break;
       }
 
       default:
-        aggregate_keys[i-1] =
+        mc->aggregate_keys[i-1] =
           keymap_mafw_key_to_tracker_key(tracker_keys[i], TRACKER_TYPE_MUSIC);
-        aggregate_types[i-1] = AGGREGATED_TYPE_CONCAT;
+        mc->aggregate_types[i-1] =
+          _get_values_aggregate_type(mc->cache, tracker_keys[i]);
     }
   }
 
   tracker_cache_keys_free_tracker(mc->cache, tracker_keys);
 
-  if (aggregate_keys[0])
-  {
-    TrackerSparqlStatement *stmt;
+  return mc;
+}
 
-    stmt = mafw_tracker_source_sparql_create(builder,
-                                             tc,
-                                             TRACKER_TYPE_MUSIC,
-                                             TRUE,
-                                             tracker_ukeys,
-                                             filter,
-                                             aggregate_types,
-                                             aggregate_keys,
-                                             0,
-                                             0,
-                                             NULL);
+static void
+_run_category_query(struct _mafw_metadata_closure *mc,
+                    MafwTrackerSourceSparqlBuilder *builder,
+                    const gchar *filter,
+                    GAsyncReadyCallback callback,
+                    gpointer user_data)
+{
+  TrackerSparqlStatement *stmt;
 
-    tracker_sparql_statement_execute_async(
-      stmt, NULL, _tracker_sparql_metadata_from_container_cb, mc);
+  stmt = mafw_tracker_source_sparql_create(builder,
+                                           tc,
+                                           TRACKER_TYPE_MUSIC,
+                                           TRUE,
+                                           mc->unique_keys,
+                                           filter,
+                                           mc->aggregate_types,
+                                           mc->aggregate_keys,
+                                           0,
+                                           0,
+                                           NULL);
 
-    g_object_unref(stmt);
+  tracker_sparql_statement_execute_async(stmt, NULL, callback, user_data);
+
+  g_object_unref(stmt);
+}
+
+void
+ti_get_metadata_from_category(const gchar *genre,
+                              const gchar *artist,
+                              const gchar *album,
+                              const gchar *default_count_key,
+                              const gchar *title,
+                              gchar **keys,
+                              MafwTrackerMetadataResultCB callback,
+                              gpointer user_data)
+{
+  struct _mafw_metadata_closure *mc;
+  MafwTrackerSourceSparqlBuilder builder;
+  gchar *filter;
+
+  mc = _category_closure_new(genre, artist, album, default_count_key, title,
+                             keys, callback, user_data);
+
+  if (mc->aggregate_keys[0])
+  {
+    mafw_tracker_source_sparql_builder_init(&builder);
+    filter = mafw_tracker_source_sparql_create_filter_from_category(
+          &builder, genre, artist, album, NULL);
+    _run_category_query(mc, &builder, filter,
+                        _tracker_sparql_metadata_from_container_cb, mc);
+    mafw_tracker_source_sparql_builder_clear(&builder);
+    g_free(filter);
   }
   else
     g_idle_add(_run_tracker_metadata_from_container_cb, mc);
+}
+
+/* Containers of the same kind, their metadata got with a single query */
+struct _category_batch
+{
+  struct _mafw_metadata_closure **containers;
+  guint n_containers;
+  /* Value of the container -> index in containers, plus one */
+  GHashTable *index;
+};
+
+static void
+_category_batch_free(struct _category_batch *batch)
+{
+  g_hash_table_destroy(batch->index);
+  g_free(batch->containers);
+  g_free(batch);
+}
+
+static void
+_tracker_sparql_metadata_from_categories_cb(GObject *object,
+                                            GAsyncResult *res,
+                                            gpointer user_data)
+{
+  struct _category_batch *batch = user_data;
+  TrackerCacheResults **results;
+  TrackerSparqlCursor *cursor;
+  GError *error = NULL;
+  gint columns;
+  guint i;
+
+  cursor = tracker_sparql_statement_execute_finish(
+      TRACKER_SPARQL_STATEMENT(object), res, &error);
+
+  if (error)
+  {
+    for (i = 0; i < batch->n_containers; i++)
+      _tracker_metadata_from_container_cb(NULL, error, batch->containers[i]);
+
+    g_error_free(error);
+    _category_batch_free(batch);
+    return;
+  }
+
+  /* Rows are grouped by the value of the container, hand each one to
+   * the container it belongs to */
+  results = g_new0(TrackerCacheResults *, batch->n_containers);
+  columns = tracker_sparql_cursor_get_n_columns(cursor);
+
+  while (tracker_sparql_cursor_next(cursor, NULL, NULL))
+  {
+    const gchar *value = tracker_sparql_cursor_get_string(cursor, 0, NULL);
+    guint row;
+    gint col;
+
+    i = GPOINTER_TO_UINT(value ? g_hash_table_lookup(batch->index, value) :
+                                 NULL);
+
+    if (!i--)
+      continue;
+
+    if (!results[i])
+    {
+      results[i] = tracker_cache_results_new(batch->containers[i]->cache,
+                                             columns);
+    }
+
+    row = tracker_cache_results_add_row(results[i]);
+
+    for (col = 0; col < columns; col++)
+      tracker_cache_results_read(results[i], row, col, cursor, col);
+  }
+
+  g_object_unref(cursor);
+
+  for (i = 0; i < batch->n_containers; i++)
+  {
+    struct _mafw_metadata_closure *mc = batch->containers[i];
+
+    if (!results[i])
+      results[i] = tracker_cache_results_new(mc->cache, columns);
+
+    _tracker_metadata_from_container_cb(results[i], NULL, mc);
+  }
 
+  g_free(results);
+  _category_batch_free(batch);
+}
+
+/*
+ * Same as calling ti_get_metadata_from_category() for each of @values, which
+ * are containers below @genre and @artist, of the kind given by @leaf_key
+ * (artist, album or genre). One query gets them all.
+ */
+void
+ti_get_metadata_from_categories(const gchar *genre,
+                                const gchar *artist,
+                                const gchar *leaf_key,
+                                gchar **values,
+                                gchar **keys,
+                                MafwTrackerMetadataResultCB callback,
+                                gpointer *user_data)
+{
+  struct _category_batch *batch;
+  MafwTrackerSourceSparqlBuilder builder;
+  const gchar *leaf_query;
+  gboolean by_genre;
+  gboolean by_artist;
+  gboolean by_album;
+  gchar *in_filter;
+  gchar *filter;
+  guint n;
+  guint i;
+
+  by_genre = !strcmp(leaf_key, MAFW_METADATA_KEY_GENRE);
+  by_artist = !strcmp(leaf_key, MAFW_METADATA_KEY_ARTIST);
+  by_album = !strcmp(leaf_key, MAFW_METADATA_KEY_ALBUM);
+
+  if (by_genre)
+    leaf_query = SPARQL_QUERY_BY_GENRE;
+  else if (by_artist)
+    leaf_query = SPARQL_QUERY_BY_ARTIST;
+  else
+    leaf_query = SPARQL_QUERY_BY_ALBUM;
+
+  n = g_strv_length(values);
+  batch = g_new0(struct _category_batch, 1);
+  batch->containers = g_new(struct _mafw_metadata_closure *, n);
+  batch->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       NULL);
+
+  for (i = 0; i < n; i++)
+  {
+    /* A repeated container is asked for on its own */
+    if (g_hash_table_contains(batch->index, values[i]))
+    {
+      ti_get_metadata_from_category(by_genre ? values[i] : genre,
+                                    by_artist ? values[i] : artist,
+                                    by_album ? values[i] : NULL,
+                                    NULL, NULL, keys, callback, user_data[i]);
+      continue;
+    }
+
+    batch->containers[batch->n_containers] =
+      _category_closure_new(by_genre ? values[i] : genre,
+                            by_artist ? values[i] : artist,
+                            by_album ? values[i] : NULL,
+                            NULL, NULL, keys, callback, user_data[i]);
+    g_hash_table_insert(batch->index, g_strdup(values[i]),
+                        GUINT_TO_POINTER(++batch->n_containers));
+  }
+
+  /* All containers ask for the same aggregates */
+  if (!batch->n_containers || !batch->containers[0]->aggregate_keys[0])
+  {
+    for (i = 0; i < batch->n_containers; i++)
+      g_idle_add(_run_tracker_metadata_from_container_cb,
+                 batch->containers[i]);
+
+    _category_batch_free(batch);
+    return;
+  }
+
+  mafw_tracker_source_sparql_builder_init(&builder);
+  in_filter = mafw_tracker_source_sparql_create_query_filter_in(
+        &builder, leaf_query, values);
+  filter = mafw_tracker_source_sparql_create_filter_from_category(
+        &builder, by_genre ? NULL : genre, by_album ? artist : NULL, NULL,
+        in_filter);
+
+  _run_category_query(batch->containers[0], &builder, filter,
+                      _tracker_sparql_metadata_from_categories_cb, batch);
+
+  mafw_tracker_source_sparql_builder_clear(&builder);
   g_free(filter);
-  g_free(tracker_ukeys[0]);
-  g_strfreev(aggregate_keys);
-  g_object_unref(builder);
+  g_free(in_filter);
 }
 
 void
-ti_get_metadata_from_videoclip(gchar **uris,
+ti_get_metadata_from_videoclip(GArray *clips,
                                gchar **keys,
                                MafwTrackerMetadatasResultCB callback,
                                gpointer user_data)
 {
-  _do_tracker_get_metadata(uris, keys, TRACKER_TYPE_VIDEO, callback, user_data);
+  _do_tracker_get_metadata(clips, keys, TRACKER_TYPE_VIDEO, callback,
+                           user_data);
 }
 
 void
-ti_get_metadata_from_audioclip(gchar **uris,
+ti_get_metadata_from_audioclip(GArray *clips,
                                gchar **keys,
                                MafwTrackerMetadatasResultCB callback,
                                gpointer user_data)
 {
-  _do_tracker_get_metadata(uris, keys, TRACKER_TYPE_MUSIC, callback, user_data);
+  _do_tracker_get_metadata(clips, keys, TRACKER_TYPE_MUSIC, callback,
+                           user_data);
 }
 
 void
-ti_get_metadata_from_playlist(gchar **uris,
+ti_get_metadata_from_playlist(GArray *clips,
                               gchar **keys,
                               MafwTrackerMetadatasResultCB callback,
                               gpointer user_data)
 {
   _do_tracker_get_metadata(
-    uris, keys, TRACKER_TYPE_PLAYLIST, callback, user_data);
+    clips, keys, TRACKER_TYPE_PLAYLIST, callback, user_data);
 }
 
 gchar **
@@ -1921,14 +2619,10 @@ ti_set_metadata(const gchar *uri, GHashTable *metadata, CategoryType category,
   GValue *value;
   gboolean updatable;
   TrackerObjectType tracker_type;
-  static InfoKeyTable *t = NULL;
   TrackerKey *tracker_key;
 
   *error = NULL;
 
-  if (!t)
-    t = keymap_get_info_key_table();
-
   /* We have not updated anything yet */
   if (updated)
     *updated = FALSE;
@@ -2020,18 +2714,17 @@ ti_set_metadata(const gchar *uri, GHashTable *metadata, CategoryType category,
   /* If there are some updatable keys, call tracker to update them */
   if (keys_array[0] != NULL)
   {
-    MafwTrackerSourceSparqlBuilder *builder;
+    MafwTrackerSourceSparqlBuilder builder;
     TrackerSparqlCursor *cursor;
     TrackerSparqlStatement *stmt;
     gboolean object_exists = FALSE;
 
-    builder = mafw_tracker_source_sparql_builder_new();
-    stmt = mafw_tracker_source_sparql_select(builder, tc, tracker_type, uri);
+    mafw_tracker_source_sparql_builder_init(&builder);
+    stmt = mafw_tracker_source_sparql_select(&builder, tc, tracker_type, uri);
 
     cursor = tracker_sparql_statement_execute(stmt, NULL, error);
 
     g_object_unref(stmt);
-    g_object_unref(builder);
 
     if (!*error)
     {
@@ -2044,13 +2737,12 @@ ti_set_metadata(const gchar *uri, GHashTable *metadata, CategoryType category,
       {
         gchar *sparql;
 
-        builder = mafw_tracker_source_sparql_builder_new();
-        sparql = mafw_tracker_source_sparql_update(builder, tracker_type,
+        mafw_tracker_source_sparql_builder_reset(&builder);
+        sparql = mafw_tracker_source_sparql_update(&builder, tracker_type,
                                                    uri, keys_array,
                                                    values_array);
         tracker_sparql_connection_update(tc, sparql, NULL, error);
         g_free(sparql);
-        g_object_unref(builder);
       }
       else if (!*error)
       {
@@ -2081,6 +2773,8 @@ ti_set_metadata(const gchar *uri, GHashTable *metadata, CategoryType category,
       /* We successfully updated some keys at least */
       *updated = TRUE;
     }
+
+    mafw_tracker_source_sparql_builder_clear(&builder);
   }
 
   g_strfreev(keys_array);
@@ -30,10 +30,29 @@
 
 #include <libmafw/mafw.h>
 
+/* Size of the blocks used to store the strings of a result */
+#define RESULT_STRINGS_CHUNK_SIZE 4096
+
+/* Default for ti_set_metadata_batches() */
+#define TI_DEFAULT_METADATA_BATCHES 4
+
+/* How many clips to ask for in one get_metadatas query. Longer lists are
+ * split into batches of this size, see ti_set_metadata_batches() */
+#ifndef METADATA_BATCH_SIZE
+#define METADATA_BATCH_SIZE 200
+#endif
+
 typedef struct
 {
   GList *ids;
+  /* Storage of the strings in ids, released with g_string_chunk_free() */
+  GStringChunk *strings;
   GList *metadata_values;
+  /* Set when album-art keys of some rows are still being resolved, see
+   * ti_watch_deferred_art() */
+  gpointer deferred;
+  /* Set when ids are clips rather than containers */
+  gboolean clips;
 } MafwResult;
 
 typedef void (*MafwTrackerSongsResultCB)(MafwResult *result,
@@ -55,6 +74,15 @@ ti_init_watch(GObject *source);
 void
 ti_deinit(void);
 
+void
+ti_set_deferred_art(gboolean enabled);
+void
+ti_set_metadata_batches(guint max_in_flight);
+void
+ti_watch_deferred_art(MafwResult *result,
+                      GObject *source,
+                      GList *object_ids);
+
 gchar *
 ti_create_filter(MafwTrackerSourceSparqlBuilder *builder,
                  const MafwFilter *filter);
@@ -120,19 +148,19 @@ ti_get_playlists(MafwTrackerSourceSparqlBuilder *builder,
                  MafwTrackerSongsResultCB callback, gpointer user_data);
 
 void
-ti_get_metadata_from_videoclip(gchar **uris,
+ti_get_metadata_from_videoclip(GArray *clips,
                                gchar **keys,
                                MafwTrackerMetadatasResultCB callback,
                                gpointer user_data);
 
 void
-ti_get_metadata_from_audioclip(gchar **uris,
+ti_get_metadata_from_audioclip(GArray *clips,
                                gchar **keys,
                                MafwTrackerMetadatasResultCB callback,
                                gpointer user_data);
 
 void
-ti_get_metadata_from_playlist(gchar **uris,
+ti_get_metadata_from_playlist(GArray *clips,
                               gchar **keys,
                               MafwTrackerMetadatasResultCB callback,
                               gpointer user_data);
@@ -146,6 +174,14 @@ ti_get_metadata_from_category(const gchar *genre,
                               gchar **keys,
                               MafwTrackerMetadataResultCB callback,
                               gpointer user_data);
+void
+ti_get_metadata_from_categories(const gchar *genre,
+                                const gchar *artist,
+                                const gchar *leaf_key,
+                                gchar **values,
+                                gchar **keys,
+                                MafwTrackerMetadataResultCB callback,
+                                gpointer *user_data);
 
 void
 ti_get_metadata_from_videos(gchar **keys,
@@ -164,6 +200,9 @@ ti_get_metadata_from_playlists(gchar **keys,
                                const gchar *title,
                                MafwTrackerMetadataResultCB callback,
                                gpointer user_data);
+gchar **
+ti_get_container_albums(const gchar *key, const gchar *value);
+
 void
 ti_set_playlist_duration(const gchar *uri, guint duration);
 
@@ -100,53 +100,64 @@ util_str_replace(gchar *str, gchar *old, gchar *new)
 }
 
 /*
- * Splits a path-like string coming from an objectid (/itemA/itemB/itemC/...)
- * into its components
+ * Unescapes the segment between start and end (or the end of the string if
+ * end is NULL) as g_uri_unescape_segment(start, end, NULL) does, returning
+ * NULL on a malformed escape or an escaped '\0'. The parts between escapes
+ * are located with memchr() and copied at once.
  */
-GList *
-util_itemid_to_path(const gchar *item_id)
+gchar *
+util_unescape_segment(const gchar *start, const gchar *end)
 {
-  GList *path = NULL;
-  gchar **tokens;
-  gchar *str;
-  int i = 0;
+  const gchar *percent;
+  gchar *unescaped;
+  gchar *out;
 
-  if (!item_id || (item_id[0] == '\0'))
-    return path;
+  if (!start)
+    return NULL;
 
-  /* Split using '/' as separator */
-  tokens = g_strsplit(item_id, "/", -1);
+  if (!end)
+    end = start + strlen(start);
 
-  /* We will unescape all the elements. This is because our object ids
-     include filename paths (which are escaped because we want to know
-     if a '/' comes from a library category (i.e. music/artists) or it
-     is part of the file URI */
+  percent = memchr(start, '%', end - start);
 
-  /* If there is only one element, put it alone in the GList */
-  if (!tokens[0])
-  {
-    str = util_unescape_string(item_id);
-    path = g_list_append(path, str);
-  }
-  else
+  if (!percent)
+    return g_strndup(start, end - start);
+
+  /* Unescaping never makes the string longer */
+  unescaped = g_malloc(end - start + 1);
+  out = unescaped;
+
+  while (percent)
   {
-    /* Add each token to the GList */
-    for (i = 0; tokens[i]; i++)
+    gint hi, lo;
+
+    memcpy(out, start, percent - start);
+    out += percent - start;
+
+    if ((end - percent < 3) ||
+        ((hi = g_ascii_xdigit_value(percent[1])) < 0) ||
+        ((lo = g_ascii_xdigit_value(percent[2])) < 0) ||
+        ((hi | lo) == 0))
     {
-      str = util_unescape_string(tokens[i]);
-      path = g_list_append(path, str);
+      g_free(unescaped);
+      return NULL;
     }
+
+    *out++ = (hi << 4) | lo;
+    start = percent + 3;
+    percent = memchr(start, '%', end - start);
   }
 
-  g_strfreev(tokens);
+  memcpy(out, start, end - start);
+  out[end - start] = '\0';
 
-  return path;
+  return unescaped;
 }
 
 gchar *
 util_unescape_string(const gchar *original)
 {
-  return g_uri_unescape_string(original, NULL);
+  return util_unescape_segment(original, NULL);
 }
 
 #ifndef G_DEBUG_DISABLE
@@ -183,6 +194,149 @@ perf_elapsed_time_checkpoint(gchar *event)
 
 #endif  /* G_DEBUG_DISABLE */
 
+/* Size of the blocks of a pool. It is enough for the closures and keys of
+ * most requests, so they need a single allocation */
+#define POOL_BLOCK_SIZE 1024
+
+/* Bigger allocations get a block on their own */
+#define POOL_MAX_CHUNK_SIZE (POOL_BLOCK_SIZE / 4)
+
+#define POOL_ALIGN(size) \
+  (((size) + 2 * sizeof(gpointer) - 1) & ~(2 * sizeof(gpointer) - 1))
+
+/* Each extra block starts with a pointer to the previous one */
+#define POOL_BLOCK_HEADER POOL_ALIGN(sizeof(gpointer))
+
+struct UtilPool
+{
+  /* Last block allocated, apart from the one holding the pool */
+  gpointer blocks;
+  /* Free space in the current block */
+  gchar *next;
+  gsize left;
+#ifndef G_DEBUG_DISABLE
+  /* Allocations served and blocks used, for debugging */
+  guint allocations;
+  guint n_blocks;
+#endif
+};
+
+static gpointer
+_pool_add_block(UtilPool *pool, gsize size)
+{
+  gchar *block;
+
+  block = g_malloc(POOL_BLOCK_HEADER + size);
+  *(gpointer *)block = pool->blocks;
+  pool->blocks = block;
+
+#ifndef G_DEBUG_DISABLE
+  pool->n_blocks++;
+#endif
+
+  return block + POOL_BLOCK_HEADER;
+}
+
+UtilPool *
+util_pool_new(void)
+{
+  UtilPool *pool;
+
+  /* The first block goes with the pool itself */
+  pool = g_malloc(POOL_ALIGN(sizeof(UtilPool)) + POOL_BLOCK_SIZE);
+  pool->blocks = NULL;
+  pool->next = (gchar *)pool + POOL_ALIGN(sizeof(UtilPool));
+  pool->left = POOL_BLOCK_SIZE;
+
+#ifndef G_DEBUG_DISABLE
+  pool->allocations = 0;
+  pool->n_blocks = 1;
+#endif
+
+  return pool;
+}
+
+gpointer
+util_pool_alloc0(UtilPool *pool, gsize size)
+{
+  gpointer mem;
+
+  size = POOL_ALIGN(size);
+
+#ifndef G_DEBUG_DISABLE
+  pool->allocations++;
+#endif
+
+  if (size > pool->left)
+  {
+    if (size > POOL_MAX_CHUNK_SIZE)
+      return memset(_pool_add_block(pool, size), 0, size);
+
+    pool->next = _pool_add_block(pool, POOL_BLOCK_SIZE);
+    pool->left = POOL_BLOCK_SIZE;
+  }
+
+  mem = pool->next;
+  pool->next += size;
+  pool->left -= size;
+
+  return memset(mem, 0, size);
+}
+
+gchar *
+util_pool_strdup(UtilPool *pool, const gchar *str)
+{
+  gsize len;
+
+  if (!str)
+    return NULL;
+
+  len = strlen(str) + 1;
+
+  return memcpy(util_pool_alloc0(pool, len), str, len);
+}
+
+gchar **
+util_pool_strdupv(UtilPool *pool, gchar **str_array)
+{
+  gchar **copy;
+  guint i;
+
+  if (!str_array)
+    return NULL;
+
+  copy = util_pool_alloc0(pool, (g_strv_length(str_array) + 1) *
+                          sizeof(gchar *));
+
+  for (i = 0; str_array[i]; i++)
+    copy[i] = util_pool_strdup(pool, str_array[i]);
+
+  return copy;
+}
+
+void
+util_pool_free(UtilPool *pool)
+{
+  gpointer block;
+  gpointer prev;
+
+  if (!pool)
+    return;
+
+#ifndef G_DEBUG_DISABLE
+  g_debug("[POOL] %u allocations in %u blocks", pool->allocations,
+          pool->n_blocks);
+#endif
+
+  for (block = pool->blocks; block; block = prev)
+  {
+    prev = *(gpointer *)block;
+    g_free(block);
+  }
+
+  g_free(pool);
+}
+
 gchar *
 util_epoch_to_iso8601(glong epoch)
 {
@@ -194,24 +348,149 @@ util_epoch_to_iso8601(glong epoch)
   return g_time_val_to_iso8601(&timeval);
 }
 
-glong
+/* Value of @n digits at @s, -1 if some is not a digit */
+static gint
+_iso8601_digits(const gchar *s, gint n)
+{
+  gint value = 0;
+
+  while (n--)
+  {
+    if (!g_ascii_isdigit(*s))
+      return -1;
+
+    value = value * 10 + (*s++ - '0');
+  }
+
+  return value;
+}
+
+/*
+ * Decodes dates in the format tracker gives them, YYYY-MM-DDThh:mm:ss with
+ * optional fraction of second and a Z or +-hh:mm zone, without allocating
+ * anything. Returns FALSE for anything else, which is left to GLib.
+ */
+static gboolean
+_iso8601_decode(const gchar *iso_date, gint *year, gint64 *epoch)
+{
+  static const gint days_in_month[] = {
+    31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+  };
+  const gchar *s = iso_date;
+  gint y, m, d, hh, mm, ss;
+  gint offset = 0;
+  gint64 era, yoe, doy, doe;
+
+  if ((strlen(s) < 20) || (s[4] != '-') || (s[7] != '-') ||
+      (s[10] != 'T') || (s[13] != ':') || (s[16] != ':'))
+  {
+    return FALSE;
+  }
+
+  y = _iso8601_digits(s, 4);
+  m = _iso8601_digits(s + 5, 2);
+  d = _iso8601_digits(s + 8, 2);
+  hh = _iso8601_digits(s + 11, 2);
+  mm = _iso8601_digits(s + 14, 2);
+  ss = _iso8601_digits(s + 17, 2);
+
+  if ((y < 1) || (m < 1) || (m > 12) || (d < 1) || (hh < 0) || (hh > 23) ||
+      (mm < 0) || (mm > 59) || (ss < 0) || (ss > 59))
+  {
+    return FALSE;
+  }
+
+  if (d > days_in_month[m - 1] +
+      ((m == 2) && (y % 4 == 0) && ((y % 100 != 0) || (y % 400 == 0))))
+  {
+    return FALSE;
+  }
+
+  s += 19;
+
+  if (*s == '.')
+  {
+    do
+      s++;
+    while (g_ascii_isdigit(*s));
+
+    if (!g_ascii_isdigit(s[-1]))
+      return FALSE;
+  }
+
+  if ((*s == '+') || (*s == '-'))
+  {
+    gint oh = _iso8601_digits(s + 1, 2);
+    gint om = (s[1] && s[2] && (s[3] == ':')) ?
+      _iso8601_digits(s + 4, 2) : -1;
+
+    if ((oh < 0) || (oh > 23) || (om < 0) || (om > 59) || s[6])
+      return FALSE;
+
+    offset = (oh * 60 + om) * 60;
+
+    if (*s == '-')
+      offset = -offset;
+  }
+  else if ((*s != 'Z') || s[1])
+    return FALSE;
+
+  if (year)
+    *year = y;
+
+  if (epoch)
+  {
+    /* Days since the epoch of the civil date */
+    era = (m <= 2 ? y - 1 : y) / 400;
+    yoe = (m <= 2 ? y - 1 : y) - era * 400;
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    *epoch = (era * 146097 + doe - 719468) * 86400 +
+      hh * 3600 + mm * 60 + ss - offset;
+  }
+
+  return TRUE;
+}
+
+gint64
 util_iso8601_to_epoch(const gchar *iso_date)
 {
-  GTimeVal timeval;
+  GDateTime *dt;
+  gint64 epoch;
+
+  if (_iso8601_decode(iso_date, NULL, &epoch))
+    return epoch;
+
+  dt = g_date_time_new_from_iso8601(iso_date, NULL);
+
+  if (!dt)
+    return 0;
 
-  g_time_val_from_iso8601(iso_date, &timeval);
-  return timeval.tv_sec;
+  epoch = g_date_time_to_unix(dt);
+  g_date_time_unref(dt);
+
+  return epoch;
 }
 
 gint
 util_iso8601_to_year(const gchar *iso_date)
 {
-  g_autoptr(GDateTime) dt = g_date_time_new_from_iso8601(iso_date, NULL);
+  GDateTime *dt;
+  gint year;
+
+  if (_iso8601_decode(iso_date, &year, NULL))
+    return year;
+
+  dt = g_date_time_new_from_iso8601(iso_date, NULL);
 
-  if (dt)
-    return g_date_time_get_year(dt);
+  if (!dt)
+    return 0;
 
-  return 0;
+  year = g_date_time_get_year(dt);
+  g_date_time_unref(dt);
+
+  return year;
 }
 
 gboolean
@@ -333,17 +612,133 @@ filename_to_uri(const gchar *filename)
   return uri;
 }
 
+static gboolean
+_has_escaped_slash(const gchar *uri)
+{
+  const gchar *p;
+
+  for (p = strchr(uri, '%'); p; p = strchr(p + 1, '%'))
+  {
+    if ((p[1] == '2') && ((p[2] == 'F') || (p[2] == 'f')))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Same as g_filename_from_uri(uri, NULL, error), with a shortcut for the
+ * plain local URIs Tracker gives us */
+gchar *
+util_uri_to_filename(const gchar *uri, GError **error)
+{
+  if (g_str_has_prefix(uri, "file:///") && !strchr(uri, '#') &&
+      !_has_escaped_slash(uri))
+  {
+    gchar *filename = util_unescape_string(uri + strlen("file://"));
+
+    if (filename)
+      return filename;
+  }
+
+  /* Let GLib deal with (and report) anything else */
+  return g_filename_from_uri(uri, NULL, error);
+}
+
+void
+util_resource_set_uri(UtilResource *resource, const gchar *uri)
+{
+  util_resource_clear(resource);
+
+  resource->uri = g_strdup(uri);
+  resource->uri_known = (uri != NULL);
+}
+
+void
+util_resource_take_filename(UtilResource *resource, gchar *filename)
+{
+  util_resource_clear(resource);
+
+  resource->filename = filename;
+  resource->filename_known = (filename != NULL);
+}
+
+gboolean
+util_resource_is_set(const UtilResource *resource)
+{
+  return resource->uri_known || resource->filename_known;
+}
+
+const gchar *
+util_resource_get_uri(UtilResource *resource)
+{
+  if (!resource->uri_known && resource->filename_known)
+  {
+    resource->uri = filename_to_uri(resource->filename);
+    resource->uri_known = TRUE;
+  }
+
+  return resource->uri;
+}
+
+/* NULL if the resource is not a local file */
+const gchar *
+util_resource_get_filename(UtilResource *resource)
+{
+  if (!resource->filename_known && resource->uri_known)
+  {
+    resource->filename = util_uri_to_filename(resource->uri, NULL);
+    resource->filename_known = TRUE;
+  }
+
+  return resource->filename;
+}
+
+void
+util_resource_clear(UtilResource *resource)
+{
+  g_free(resource->uri);
+  g_free(resource->filename);
+  *resource = (UtilResource)UTIL_RESOURCE_INIT;
+}
+
+/* Deepest item id: music/genres/<genre>/<artist>/<album>/<clip> */
+#define MAX_ITEM_ID_COMPONENTS 6
+
+/* A component of an item id, still escaped */
+struct _item_component
+{
+  const gchar *start;
+  const gchar *end;
+};
+
+static gboolean
+_component_is(const struct _item_component *component, const gchar *name)
+{
+  gsize len = component->end - component->start;
+
+  return (strlen(name) == len) &&
+         (g_ascii_strncasecmp(component->start, name, len) == 0);
+}
+
+static gchar *
+_component_unescape(const struct _item_component *component)
+{
+  return util_unescape_segment(component->start, component->end);
+}
+
+/* The components are those of the object id split by '/'. Only the ones
+ * asked for are unescaped, the category is found without allocating. The
+ * clip, if any, is returned by filename; its URI is computed on demand. */
 CategoryType
 util_extract_category_info(const gchar *object_id,
                            gchar **genre,
                            gchar **artist,
                            gchar **album,
-                           gchar **clip)
+                           UtilResource *clip)
 {
-  gchar *item_id;
-  GList *path;
-  GList *next;
-  gchar *path_name;
+  struct _item_component path[MAX_ITEM_ID_COMPONENTS];
+  const gchar *item_id;
+  const gchar *p;
   guint path_length;
   CategoryType category;
 
@@ -358,60 +753,67 @@ util_extract_category_info(const gchar *object_id,
     *album = NULL;
 
   if (clip)
-    *clip = NULL;
-
-  item_id = NULL;
+    *clip = (UtilResource)UTIL_RESOURCE_INIT;
 
   /* Skip the protocol part of the objectid to get the path-like part */
-  mafw_source_split_objectid(object_id, NULL, &item_id);
+  item_id = object_id ? strstr(object_id, "::") : NULL;
 
   /* Wrong protocol */
   if (!item_id)
     return CATEGORY_ERROR;
 
+  item_id += 2;
+
+  if (*item_id == '\0')
+    return CATEGORY_ROOT;
+
   /* Split the path of the objectid into its components */
-  path = util_itemid_to_path(item_id);
-  g_free(item_id);
+  path_length = 0;
+  p = item_id;
 
-  /* Get category type */
-  if (path != NULL)
+  while (TRUE)
   {
-    path_name = get_data(path);
-    path_length = g_list_length(path);
+    const gchar *end = strchr(p, '/');
 
-    if (g_strcasecmp(path_name, TRACKER_SOURCE_VIDEOS) == 0)
-      category = CATEGORY_VIDEO;
-    else if (g_strcasecmp(path_name, TRACKER_SOURCE_MUSIC) == 0)
-    {
-      next = g_list_next(path);
+    if (!end)
+      end = p + strlen(p);
 
-      if (!next)
-        category = CATEGORY_MUSIC;
-      else
-      {
-        path_name = get_data(next);
+    /* No category has so many levels */
+    if (path_length == MAX_ITEM_ID_COMPONENTS)
+      return CATEGORY_ERROR;
 
-        if (!g_strcasecmp(path_name, TRACKER_SOURCE_PLAYLISTS))
-          category = CATEGORY_MUSIC_PLAYLISTS;
-        else if (!g_strcasecmp( path_name, TRACKER_SOURCE_SONGS))
-          category = CATEGORY_MUSIC_SONGS;
-        else if (!g_strcasecmp(path_name, TRACKER_SOURCE_GENRES))
-        {
-          category = CATEGORY_MUSIC_GENRES;
-        }
-        else if (!g_strcasecmp( path_name, TRACKER_SOURCE_ARTISTS))
-          category = CATEGORY_MUSIC_ARTISTS;
-        else if (!g_strcasecmp(path_name, TRACKER_SOURCE_ALBUMS))
-          category = CATEGORY_MUSIC_ALBUMS;
-        else
-          category = CATEGORY_ERROR;
-      }
-    }
+    path[path_length].start = p;
+    path[path_length].end = end;
+    path_length++;
+
+    if (*end == '\0')
+      break;
+
+    p = end + 1;
+  }
+
+  /* Get category type */
+  if (_component_is(&path[0], TRACKER_SOURCE_VIDEOS))
+    category = CATEGORY_VIDEO;
+  else if (_component_is(&path[0], TRACKER_SOURCE_MUSIC))
+  {
+    if (path_length == 1)
+      category = CATEGORY_MUSIC;
+    else if (_component_is(&path[1], TRACKER_SOURCE_PLAYLISTS))
+      category = CATEGORY_MUSIC_PLAYLISTS;
+    else if (_component_is(&path[1], TRACKER_SOURCE_SONGS))
+      category = CATEGORY_MUSIC_SONGS;
+    else if (_component_is(&path[1], TRACKER_SOURCE_GENRES))
+      category = CATEGORY_MUSIC_GENRES;
+    else if (_component_is(&path[1], TRACKER_SOURCE_ARTISTS))
+      category = CATEGORY_MUSIC_ARTISTS;
+    else if (_component_is(&path[1], TRACKER_SOURCE_ALBUMS))
+      category = CATEGORY_MUSIC_ALBUMS;
     else
       category = CATEGORY_ERROR;
   }
   else
-    category = CATEGORY_ROOT;
+    category = CATEGORY_ERROR;
 
   /* Get info */
   switch (category)
@@ -428,7 +830,7 @@ util_extract_category_info(const gchar *object_id,
       if (path_length > 2)
         category = CATEGORY_ERROR;
       else if (clip && (path_length == 2))
-        *clip = filename_to_uri(get_data(g_list_nth(path, 1)));
+        util_resource_take_filename(clip, _component_unescape(&path[1]));
 
       break;
     }
@@ -437,7 +839,7 @@ util_extract_category_info(const gchar *object_id,
       if (path_length > 3)
         category = CATEGORY_ERROR;
       else if (clip && (path_length == 3))
-        *clip = filename_to_uri(get_data(g_list_nth(path, 2)));
+        util_resource_take_filename(clip, _component_unescape(&path[2]));
 
       break;
     }
@@ -448,7 +850,7 @@ util_extract_category_info(const gchar *object_id,
         case 3:
         {
           if (clip)
-            *clip = filename_to_uri(get_data(g_list_nth(path, 2)));
+            util_resource_take_filename(clip, _component_unescape(&path[2]));
 
           break;
         }
@@ -473,14 +875,14 @@ util_extract_category_info(const gchar *object_id,
         case 4:
         {
           if (clip)
-            *clip = filename_to_uri(get_data(g_list_nth(path, 3)));
+            util_resource_take_filename(clip, _component_unescape(&path[3]));
 
           /* No break */
         }
         case 3:
         {
           if (album)
-            *album = g_strdup(get_data(g_list_nth(path, 2)));
+            *album = _component_unescape(&path[2]);
 
           break;
         }
@@ -505,21 +907,21 @@ util_extract_category_info(const gchar *object_id,
         case 5:
         {
           if (clip)
-            *clip = filename_to_uri(get_data(g_list_nth(path, 4)));
+            util_resource_take_filename(clip, _component_unescape(&path[4]));
 
           /* No break */
         }
         case 4:
         {
           if (album)
-            *album = g_strdup(get_data(g_list_nth(path, 3)));
+            *album = _component_unescape(&path[3]);
 
           /* No break */
         }
         case 3:
         {
           if (artist)
-            *artist = g_strdup(get_data(g_list_nth(path, 2)));
+            *artist = _component_unescape(&path[2]);
 
           /* No break */
         }
@@ -544,28 +946,28 @@ util_extract_category_info(const gchar *object_id,
         case 6:
         {
           if (clip)
-            *clip = filename_to_uri(get_data(g_list_nth(path, 5)));
+            util_resource_take_filename(clip, _component_unescape(&path[5]));
 
           /* No break */
         }
         case 5:
         {
           if (album)
-            *album = g_strdup(get_data(g_list_nth(path, 4)));
+            *album = _component_unescape(&path[4]);
 
           /* No break */
         }
         case 4:
         {
           if (artist)
-            *artist = g_strdup(get_data(g_list_nth(path, 3)));
+            *artist = _component_unescape(&path[3]);
 
           /* No break */
         }
         case 3:
         {
           if (genre)
-            *genre = g_strdup(get_data(g_list_nth(path, 2)));
+            *genre = _component_unescape(&path[2]);
 
           break;
         }
@@ -585,10 +987,6 @@ util_extract_category_info(const gchar *object_id,
     }
   }
 
-  /* Frees */
-  g_list_foreach(path, (GFunc)g_free, NULL);
-  g_list_free(path);
-
   return category;
 }
 
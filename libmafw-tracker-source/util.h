@@ -56,13 +56,20 @@ typedef enum
 #define AGGREGATED_TYPE_CONCAT "GROUP_CONCAT"
 #define AGGREGATED_TYPE_COUNT  "COUNT"
 #define AGGREGATED_TYPE_SUM    "SUM"
+/* The value if all are the same, SEVERAL_VALUES_DELIMITER otherwise */
+#define AGGREGATED_TYPE_SAMPLE "SAMPLE"
+/* One of the values, after SEVERAL_VALUES_DELIMITER if they differ */
+#define AGGREGATED_TYPE_REPRESENTATIVE "REPRESENTATIVE"
+
+/* Separates the values of an AGGREGATED_TYPE_CONCAT aggregate */
+#define SEVERAL_VALUES_DELIMITER "|"
 
 void
 util_gvalue_free(GValue *value);
 
 gchar *util_str_replace(gchar *str, gchar *old, gchar *new);
-GList *
-util_itemid_to_path(const gchar *item_id);
+gchar *
+util_unescape_segment(const gchar *start, const gchar *end);
 gchar *
 util_unescape_string(const gchar *original);
 
@@ -81,9 +88,56 @@ perf_elapsed_time_checkpoint(gchar *event);
 
 #endif  /* G_DEBUG_DISABLE */
 
+/* Memory of a request, released all at once when the request finishes. It
+ * only holds the closures and keys of browse and get_metadata(s): what
+ * tracker-iface allocates outlives the callbacks that may release it. */
+typedef struct UtilPool UtilPool;
+
+#define util_pool_new0(pool, struct_type) \
+  ((struct_type *)util_pool_alloc0((pool), sizeof(struct_type)))
+
+UtilPool *
+util_pool_new(void);
+gpointer
+util_pool_alloc0(UtilPool *pool, gsize size);
+gchar *
+util_pool_strdup(UtilPool *pool, const gchar *str);
+gchar **
+util_pool_strdupv(UtilPool *pool, gchar **str_array);
+void
+util_pool_free(UtilPool *pool);
+
+/* A clip, known both as a file URI (what Tracker stores) and as a filename
+ * (what object ids carry). It is created from one of them and the other is
+ * computed the first time it is asked for, then kept until cleared. */
+typedef struct
+{
+  gchar *uri;
+  gchar *filename;
+  guint uri_known : 1;
+  guint filename_known : 1;
+} UtilResource;
+
+#define UTIL_RESOURCE_INIT { NULL, NULL, FALSE, FALSE }
+
+void
+util_resource_set_uri(UtilResource *resource, const gchar *uri);
+void
+util_resource_take_filename(UtilResource *resource, gchar *filename);
+gboolean
+util_resource_is_set(const UtilResource *resource);
+const gchar *
+util_resource_get_uri(UtilResource *resource);
+const gchar *
+util_resource_get_filename(UtilResource *resource);
+void
+util_resource_clear(UtilResource *resource);
+gchar *
+util_uri_to_filename(const gchar *uri, GError **error);
+
 gchar *
 util_epoch_to_iso8601(glong epoch);
-glong
+gint64
 util_iso8601_to_epoch(const gchar *iso_date);
 gint
 util_iso8601_to_year(const gchar *iso_date);
@@ -109,7 +163,7 @@ util_extract_category_info(const gchar *object_id,
                            gchar **genre,
                            gchar **artist,
                            gchar **album,
-                           gchar **clip);
+                           UtilResource *clip);
 gboolean
 util_is_duration_requested(const gchar **key_list);
 gboolean
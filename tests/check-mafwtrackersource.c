@@ -24,6 +24,7 @@
 
 #include "mafw-tracker-source.h"
 #include "tracker-iface.h"
+#include "util.h"
 #include <check.h>
 #include <checkmore.h>
 #include <gio/gio.h>
@@ -2705,6 +2706,103 @@ START_TEST(test_get_metadatas_several)
 
 END_TEST
 
+START_TEST(test_get_metadatas_batches)
+{
+  GMainLoop *loop = NULL;
+  const gchar *const *metadata_keys = NULL;
+  gchar **object_ids = NULL;
+  GList *result = NULL;
+  gint n = 3 * METADATA_BATCH_SIZE + 10;
+  gint i;
+
+  /* Known clips spread over the first, third and last batch; the second
+   * batch only has missing clips */
+  struct
+  {
+    gint index;
+    const gchar *clip;
+    const gchar *title;
+  } known[] = {
+    { 10, "clip1.mp3", "Title 1" },
+    { METADATA_BATCH_SIZE - 1, "clip2.mp3", "Title 2" },
+    { 2 * METADATA_BATCH_SIZE + 10, "clip3.mp3", "Title 3" },
+    { 2 * METADATA_BATCH_SIZE + 150, "clip4.mp3", "Title 4" },
+    { 3 * METADATA_BATCH_SIZE + 5, "clip6.wma", "Title 6" },
+  };
+
+  RUNNING_CASE = "test_get_metadatas_batches";
+  loop = g_main_loop_new(NULL, FALSE);
+
+  /* Metadata we are interested in */
+  metadata_keys = MAFW_SOURCE_LIST(
+    MAFW_METADATA_KEY_TITLE);
+
+  object_ids = g_new0(gchar *, n + 1);
+
+  for (i = 0; i < n; i++)
+  {
+    object_ids[i] = g_strdup_printf(MAFW_TRACKER_SOURCE_UUID
+                                    "::music/songs/"
+                                    "%%2Fhome%%2Fuser%%2FMyDocs%%2F"
+                                    "missing-%d.mp3", i);
+  }
+
+  for (i = 0; i < G_N_ELEMENTS(known); i++)
+  {
+    g_free(object_ids[known[i].index]);
+    object_ids[known[i].index] =
+      g_strconcat(MAFW_TRACKER_SOURCE_UUID
+                  "::music/songs/%2Fhome%2Fuser%2FMyDocs%2F",
+                  known[i].clip, NULL);
+  }
+
+  /* Execute query */
+  mafw_source_get_metadatas(g_tracker_source,
+                            (const gchar **)object_ids, metadata_keys,
+                            metadatas_result_cb,
+                            loop);
+
+  /* Check results... */
+  g_main_loop_run(loop);
+
+  ck_assert_msg(g_metadatas_called != FALSE,
+                "No metadatas_result signal received");
+
+  ck_assert_msg(g_list_length(g_metadata_results) == G_N_ELEMENTS(known),
+                "Query metadatas of %d known elements returned %d results",
+                (gint)G_N_ELEMENTS(known),
+                g_list_length(g_metadata_results));
+
+  /* Each clip must get its own metadata, not its neighbour's */
+  for (i = 0; i < G_N_ELEMENTS(known); i++)
+  {
+    MetadataResult *mdata = NULL;
+    GValue *value;
+
+    for (result = g_metadata_results; result; result = result->next)
+    {
+      mdata = result->data;
+
+      if (!strcmp(mdata->objectid, object_ids[known[i].index]))
+        break;
+    }
+
+    ck_assert_msg(result != NULL, "No metadata for %s", known[i].clip);
+
+    value = mafw_metadata_first(mdata->metadata, MAFW_METADATA_KEY_TITLE);
+
+    ck_assert_msg(value && !strcmp(g_value_get_string(value),
+                                   known[i].title),
+                  "Wrong title for %s", known[i].clip);
+  }
+
+  g_strfreev(object_ids);
+  clear_metadatas_results();
+
+  g_main_loop_unref(loop);
+}
+END_TEST
+
 static void
 metadata_set_cb(MafwSource *self,
                 const gchar *object_id,
@@ -3230,6 +3328,163 @@ START_TEST(test_destroy_failed)
 
 END_TEST
 
+/* Strings covering plain paths, reserved characters, valid and broken
+   UTF-8 and malformed escapes */
+static const gchar *escape_samples[] =
+{
+  "",
+  "/home/user/MyDocs/clip1.mp3",
+  "/home/user/MyDocs/clip 7.mp3",
+  "Artist & Album: Vol. 2/3 (live) [100%]",
+  "a-b.c_d~e+f=g?h#i",
+  "Bj\xc3\xb6rk/J\xc3\xb3ga",
+  "\xe2\x82\xac \xf0\x9f\x98\x80",
+  "\xc3",
+  "\xff\xfe",
+  "\xc0\xaf",
+  "\xed\xa0\x80",
+  "%",
+  "%2",
+  "%2F%2f",
+  "%zz",
+  "%00",
+  "%%41",
+  "a%41b%c3%a9",
+  NULL
+};
+
+START_TEST(test_escape_string)
+{
+  gint i;
+
+  for (i = 0; escape_samples[i] != NULL; i++)
+  {
+    gchar *expected = g_uri_escape_string(escape_samples[i], NULL, TRUE);
+    gchar *escaped = mafw_tracker_source_escape_string(escape_samples[i]);
+    GString *appended = g_string_new("prefix/");
+
+    mafw_tracker_source_append_escaped_string(appended, escape_samples[i]);
+
+    ck_assert_str_eq(escaped, expected);
+    ck_assert_str_eq(appended->str + strlen("prefix/"), expected);
+
+    g_string_free(appended, TRUE);
+    g_free(escaped);
+    g_free(expected);
+  }
+}
+
+END_TEST
+START_TEST(test_unescape_string)
+{
+  const gchar *segment;
+  gchar *unescaped;
+  gint i;
+
+  for (i = 0; escape_samples[i] != NULL; i++)
+  {
+    gchar *expected = g_uri_unescape_string(escape_samples[i], NULL);
+    gchar *escaped = mafw_tracker_source_escape_string(escape_samples[i]);
+    gchar *round_trip = util_unescape_string(escaped);
+
+    unescaped = util_unescape_string(escape_samples[i]);
+
+    if (expected)
+      ck_assert_str_eq(unescaped, expected);
+    else
+      ck_assert_msg(unescaped == NULL, "'%s' should not unescape",
+                    escape_samples[i]);
+
+    ck_assert_str_eq(round_trip, escape_samples[i]);
+
+    g_free(round_trip);
+    g_free(escaped);
+    g_free(unescaped);
+    g_free(expected);
+  }
+
+  /* Segments stop at the given end */
+  segment = "ab%2Fcd/ef";
+  unescaped = util_unescape_segment(segment, strchr(segment, '/'));
+  ck_assert_str_eq(unescaped, "ab/cd");
+  g_free(unescaped);
+}
+
+END_TEST
+
+/* Dates as tracker gives them, with fractions, zones, leap days and years
+   before 1900, and others the fast path must leave to GLib: other zone
+   formats, impossible days, leap seconds and malformed or truncated
+   strings */
+static const gchar *iso8601_samples[] =
+{
+  "2009-03-12T10:05:33Z",
+  "1970-01-01T00:00:00Z",
+  "2038-01-19T03:14:08Z",
+  "2009-03-12T10:05:33.5Z",
+  "2009-03-12T10:05:33.123456Z",
+  "2009-03-12T10:05:33+02:00",
+  "2009-03-12T10:05:33-05:30",
+  "2009-03-12T10:05:33.25+14:00",
+  "2009-12-31T23:30:00-01:00",
+  "2009-03-12T10:05:33+0200",
+  "2008-02-29T12:00:00Z",
+  "2009-02-29T12:00:00Z",
+  "2000-02-29T12:00:00Z",
+  "1900-02-29T12:00:00Z",
+  "1900-01-01T00:00:00Z",
+  "2016-12-31T23:59:59Z",
+  "2016-12-31T23:59:60Z",
+  "1899-12-31T23:59:59Z",
+  "1066-10-14T09:00:00Z",
+  "0001-01-01T00:00:00Z",
+  "0000-01-01T00:00:00Z",
+  "2009-13-12T10:05:33Z",
+  "2009-04-31T10:05:33Z",
+  "2009-03-12T24:05:33Z",
+  "2009-03-12T10:60:33Z",
+  "2009-03-12T10:05:33+25:00",
+  "2009-03-12T10:05:33Zjunk",
+  "2009-03-12T10:05:33",
+  "2009-03-12T",
+  "2009-03-12",
+  "2009",
+  "20x9-03-12T10:05:33Z",
+  "",
+  NULL
+};
+
+START_TEST(test_iso8601)
+{
+  GDateTime *dt;
+  gint i;
+
+  for (i = 0; iso8601_samples[i] != NULL; i++)
+  {
+    dt = g_date_time_new_from_iso8601(iso8601_samples[i], NULL);
+
+    if (dt)
+    {
+      ck_assert_msg(util_iso8601_to_year(iso8601_samples[i]) ==
+                    g_date_time_get_year(dt),
+                    "Wrong year for '%s'", iso8601_samples[i]);
+      ck_assert_msg(util_iso8601_to_epoch(iso8601_samples[i]) ==
+                    g_date_time_to_unix(dt),
+                    "Wrong epoch for '%s'", iso8601_samples[i]);
+      g_date_time_unref(dt);
+    }
+    else
+    {
+      ck_assert_msg(util_iso8601_to_year(iso8601_samples[i]) == 0,
+                    "'%s' is not a date", iso8601_samples[i]);
+      ck_assert_msg(util_iso8601_to_epoch(iso8601_samples[i]) == 0,
+                    "'%s' is not a date", iso8601_samples[i]);
+    }
+  }
+}
+
+END_TEST
+
 /* ---------------------------------------------------- */
 /*                  Suite creation                      */
 /* ---------------------------------------------------- */
@@ -3252,6 +3507,8 @@ configure_tests(void)
   TCase *tc_get_metadatas = tcase_create("GetMetadatas");
   TCase *tc_set_metadata = tcase_create("SetMetadata");
   TCase *tc_destroy = tcase_create("DestroyObject");
+  TCase *tc_escape = tcase_create("Escape");
+  TCase *tc_dates = tcase_create("Dates");
 
   /* Create unit tests for test case "Browse" */
   tcase_add_checked_fixture(tc_browse, fx_setup_dummy_tracker_source,
@@ -3313,6 +3570,7 @@ configure_tests(void)
 /* *INDENT-OFF* */
   if (1) tcase_add_test(tc_get_metadatas, test_get_metadatas_none);
   if (1) tcase_add_test(tc_get_metadatas, test_get_metadatas_several);
+  if (1) tcase_add_test(tc_get_metadatas, test_get_metadatas_batches);
 /* *INDENT-ON* */
 
   suite_add_tcase(s, tc_get_metadatas);
@@ -3343,12 +3601,29 @@ configure_tests(void)
 
   suite_add_tcase(s, tc_destroy);
 
+  /* Create unit tests for test case "Escape" */
+/* *INDENT-OFF* */
+  if (1) tcase_add_test(tc_escape, test_escape_string);
+  if (1) tcase_add_test(tc_escape, test_unescape_string);
+/* *INDENT-ON* */
+
+  suite_add_tcase(s, tc_escape);
+
+  /* Create unit tests for test case "Dates" */
+/* *INDENT-OFF* */
+  if (1) tcase_add_test(tc_dates, test_iso8601);
+/* *INDENT-ON* */
+
+  suite_add_tcase(s, tc_dates);
+
   /*Valgrind may require more time to run*/
   tcase_set_timeout(tc_browse, 60);
   tcase_set_timeout(tc_get_metadata, 60);
   tcase_set_timeout(tc_get_metadatas, 60);
   tcase_set_timeout(tc_set_metadata, 60);
   tcase_set_timeout(tc_destroy, 60);
+  tcase_set_timeout(tc_escape, 60);
+  tcase_set_timeout(tc_dates, 60);
 
   /* Create srunner object with the test suite */
   sr = srunner_create(s);
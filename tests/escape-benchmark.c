@@ -0,0 +1,77 @@
+/*
+ * This file is a part of MAFW
+ *
+ * Copyright (C) 2007, 2008, 2009 Nokia Corporation, all rights reserved.
+ *
+ * Contact: Visa Smolander <visa.smolander@nokia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ *
+ */
+
+/* Compares the escaping of paths with GLib's. Not run by 'make check'. */
+
+#include "mafw-tracker-source.h"
+#include "util.h"
+#include <glib.h>
+#include <stdlib.h>
+
+#define ROUNDS 100000
+
+int
+main(void)
+{
+  const gchar *path;
+  GTimer *timer;
+  gdouble glib_time, own_time;
+  gchar *escaped;
+  gchar *unescaped;
+  gint i;
+
+  /* A typical music path */
+  path = "/home/user/MyDocs/Music/Some Artist/"
+         "Some Album (Deluxe Edition)/01 - Some Title.mp3";
+
+  timer = g_timer_new();
+
+  for (i = 0; i < ROUNDS; i++)
+  {
+    escaped = g_uri_escape_string(path, NULL, TRUE);
+    unescaped = g_uri_unescape_string(escaped, NULL);
+    g_free(unescaped);
+    g_free(escaped);
+  }
+
+  glib_time = g_timer_elapsed(timer, NULL);
+  g_timer_start(timer);
+
+  for (i = 0; i < ROUNDS; i++)
+  {
+    escaped = mafw_tracker_source_escape_string(path);
+    unescaped = util_unescape_string(escaped);
+    g_free(unescaped);
+    g_free(escaped);
+  }
+
+  own_time = g_timer_elapsed(timer, NULL);
+
+  g_print("Escape and unescape %d paths: GLib %.3fs, source %.3fs\n",
+          ROUNDS, glib_time, own_time);
+
+  g_timer_destroy(timer);
+
+  return EXIT_SUCCESS;
+}